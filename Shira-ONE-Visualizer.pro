@@ -4,18 +4,23 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17
 
+include(simd.pri)
+
 LIBS += -lOpenGL32 -lglu32
 
 SOURCES += \
     main.cpp \
+    onecpurenderer.cpp \
     oneloader.cpp \
     onereader.cpp \
     onerenderer.cpp
 
 HEADERS += \
+    onecpurenderer.h \
     oneloader.h \
     onereader.h \
-    onerenderer.h
+    onerenderer.h \
+    oneview.h
 
 
 FORMS += \
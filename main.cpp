@@ -9,7 +9,10 @@
 #include <QVBoxLayout>
 #include <QFileDialog>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QColorDialog>
+#include <QDoubleSpinBox>
+#include <QSpinBox>
 
 class MyApplication : public QApplication {
 public:
@@ -55,33 +58,104 @@ int main(int argc, char *argv[])
     nestedCheckBox->setChecked(true);
     layout->addWidget(nestedCheckBox);
 
+    QCheckBox *bricksCheckBox = new QCheckBox("Sparse Bricks (next load)", centralWidget);
+    layout->addWidget(bricksCheckBox);
+
+    QComboBox *precisionComboBox = new QComboBox(centralWidget);
+    precisionComboBox->addItem("Float Textures: 32-bit (next load)");
+    precisionComboBox->addItem("Float Textures: 16-bit (next load)");
+    precisionComboBox->addItem("Float Textures: Scaled 8-bit (next load)");
+    layout->addWidget(precisionComboBox);
+
+    QPushButton *precisionReportButton = new QPushButton("Precision Error Report", centralWidget);
+    layout->addWidget(precisionReportButton);
+
+    QPushButton *cpuReportButton = new QPushButton("CPU Renderer Comparison", centralWidget);
+    layout->addWidget(cpuReportButton);
+
+    QPushButton *cullingReportButton = new QPushButton("Volume Culling Comparison", centralWidget);
+    layout->addWidget(cullingReportButton);
+
+    QSpinBox *uploadBudgetSpinBox = new QSpinBox(centralWidget);
+    uploadBudgetSpinBox->setPrefix("Upload Budget: ");
+    uploadBudgetSpinBox->setSuffix(" MB/frame");
+    uploadBudgetSpinBox->setRange(1, 1024);
+    uploadBudgetSpinBox->setValue(64);
+    layout->addWidget(uploadBudgetSpinBox);
+
+    QCheckBox *skippingCheckBox = new QCheckBox("Empty Space Skipping", centralWidget);
+    skippingCheckBox->setChecked(true);
+    layout->addWidget(skippingCheckBox);
+
+    QCheckBox *cullingCheckBox = new QCheckBox("Volume Culling", centralWidget);
+    cullingCheckBox->setChecked(true);
+    layout->addWidget(cullingCheckBox);
+
+    QCheckBox *frontToBackCheckBox = new QCheckBox("Front-to-Back (Early Ray Termination)", centralWidget);
+    layout->addWidget(frontToBackCheckBox);
+
+    QCheckBox *adaptiveCheckBox = new QCheckBox("Adaptive Sampling", centralWidget);
+    layout->addWidget(adaptiveCheckBox);
+
+    QDoubleSpinBox *qualitySpinBox = new QDoubleSpinBox(centralWidget);
+    qualitySpinBox->setPrefix("Sampling Quality: ");
+    qualitySpinBox->setRange(0.25, 8.0);
+    qualitySpinBox->setSingleStep(0.25);
+    qualitySpinBox->setValue(2.0);
+    qualitySpinBox->setEnabled(false);
+    layout->addWidget(qualitySpinBox);
+
+    QCheckBox *mipmapCheckBox = new QCheckBox("Mipmap LOD", centralWidget);
+    mipmapCheckBox->setChecked(true);
+    layout->addWidget(mipmapCheckBox);
+
+    QCheckBox *progressiveCheckBox = new QCheckBox("Progressive Refinement", centralWidget);
+    progressiveCheckBox->setChecked(true);
+    layout->addWidget(progressiveCheckBox);
+
+    QCheckBox *statsCheckBox = new QCheckBox("Frame Stats Overlay", centralWidget);
+    layout->addWidget(statsCheckBox);
+
     // EKLE: Background color seçme butonu
     QPushButton *colorButton = new QPushButton("Select Background Color", centralWidget);
     layout->addWidget(colorButton);
 
     OneLoader *loader = new OneLoader(&window);  // Yeni: OneLoader kullan
+    loader->getReader()->setDenseTextureLimit(OneRenderer::kMaxDenseTextures);
 
     // Asenkron yükleme sinyallerini bağlayın (loader üzerinden)
     QObject::connect(loader, &OneLoader::loadingStarted, [&]() {
-        loadButton->setEnabled(false);
-        renderer->setOneReader(nullptr);  // Invalidate renderer data during loading
+        // Load butonu açık kalır: yeni bir dosya seçmek süren yüklemeyi iptal eder
+        renderer->beginProgressiveLoad();  // Current scene stays on screen until the new one is complete
         // Opsiyonel: Progress gösterme veya bilgilendirme
         // Örneğin: QMessageBox::information(&window, "Info", "Loading started...");
     });
 
+    // Her texture çözüldüğünde (dış katmanlar önce) hemen göster
+    QObject::connect(loader, &OneLoader::textureReady, [&](OneReader::SceneHandle scene, int textureIndex, float progress) {
+        loadButton->setText(QString("Loading... %1%").arg(qRound(progress * 100.0f)));
+        renderer->textureReady(scene, textureIndex);
+    });
+
     QObject::connect(loader, &OneLoader::loadingFinished, [&](bool success) {
-        loadButton->setEnabled(true);
+        loadButton->setText("Load .ONE File");
         if (success) {
             renderer->setNestedMode(true);
-            renderer->setOneReader(loader->getReader());  // Yeni: loader->getReader()
+            renderer->setScene(loader->getReader()->currentScene());  // Yeni sahne tamamlandı, değiştir
         } else {
+            renderer->setScene(loader->getReader()->currentScene());  // Önceki sahne (varsa) kalır
             QMessageBox::warning(&window, "Error", "Failed to load .ONE file.");
         }
     });
 
+    // Queued, as the renderer warns from inside its GL work
+    QObject::connect(renderer, &OneRenderer::renderWarning, &window, [&](const QString& message) {
+        QMessageBox::warning(&window, "Warning", message);
+    }, Qt::QueuedConnection);
+
     // Load butonu bağlantısı (asenkron çağrı)
     QObject::connect(loadButton, &QPushButton::clicked, [&]() {
-        QString filename = QFileDialog::getOpenFileName(&window, "Open .ONE File", "", "ONE Files (*.one)");
+        QString filename = QFileDialog::getOpenFileName(&window, "Open .ONE File", "", "ONE Files (*.one *.onec)");
         if (!filename.isEmpty()) {
             loader->load(filename);  // Yeni: loader->load()
         }
@@ -95,6 +169,30 @@ int main(int argc, char *argv[])
 
     QObject::connect(nestedCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setNestedMode);
 
+    QObject::connect(skippingCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setEmptySpaceSkipping);
+    QObject::connect(cullingCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setVolumeCulling);
+    QObject::connect(frontToBackCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setFrontToBack);
+    QObject::connect(adaptiveCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setAdaptiveSampling);
+    QObject::connect(adaptiveCheckBox, &QCheckBox::toggled, qualitySpinBox, &QDoubleSpinBox::setEnabled);
+    QObject::connect(mipmapCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setMipmapping);
+    QObject::connect(progressiveCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setProgressiveRefinement);
+    QObject::connect(statsCheckBox, &QCheckBox::toggled, renderer, &OneRenderer::setStatsOverlay);
+    QObject::connect(qualitySpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), [&](double value) {
+        renderer->setSamplingQuality(static_cast<float>(value));
+    });
+
+    QObject::connect(bricksCheckBox, &QCheckBox::toggled, [&](bool checked) {
+        loader->getReader()->setStorageMode(checked ? OneReader::BrickedStorage : OneReader::DenseStorage);
+    });
+
+    QObject::connect(precisionComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [&](int index) {
+        loader->getReader()->setTexturePrecision(static_cast<OneReader::TexturePrecision>(index));
+    });
+    QObject::connect(precisionReportButton, &QPushButton::clicked, renderer, &OneRenderer::reportPrecisionError);
+    QObject::connect(cpuReportButton, &QPushButton::clicked, renderer, &OneRenderer::reportCpuRenderError);
+    QObject::connect(cullingReportButton, &QPushButton::clicked, renderer, &OneRenderer::reportCullingError);
+    QObject::connect(uploadBudgetSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), renderer, &OneRenderer::setUploadBudget);
+
     QObject::connect(colorButton, &QPushButton::clicked, [&]() {
         QColor color = QColorDialog::getColor(Qt::gray, &window, "Select Background Color");
         if (color.isValid()) {
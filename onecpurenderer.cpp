@@ -0,0 +1,967 @@
+// onecpurenderer.cpp
+#include "onecpurenderer.h"
+#include "oneview.h"
+#include <QElapsedTimer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector2D>
+#include <QVector4D>
+#include <QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+// SSE2 is part of every x86-64 target; 32-bit builds need it enabled
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ONE_HAVE_SSE2 1
+#endif
+
+namespace {
+
+const int kMaxRayVolumes = 64; // MAX_RAY_VOLUMES in nested.frag
+const float kBoxSize = 0.5f;
+const float kStepSize = 0.01f; // ds0
+const float kMaxStepOpacityChange = 0.05f;
+
+// One nested slot, what nested.frag reads from volumeParams
+struct Slot {
+    const OneReader::Texture* tex = nullptr;
+    QMatrix4x4 model;
+    QMatrix4x4 inverseModel;
+    float emission = 1.0f;
+    float opacity = 1.0f;
+    float blend = 0.0f;
+    bool replace = false;
+    float texelsPerUnit = 0.0f; // Along the most finely sampled axis, for the mip level
+};
+
+// Slots in the order OneRenderer::createTextures() gives them: by ORDER, then file order
+QVector<Slot> buildSlots(const OneReader::SceneData& scene) {
+    std::vector<std::pair<int, int>> orderIndices;
+    for (int i = 0; i < scene.volumes.size(); ++i) {
+        orderIndices.push_back({scene.volumes[i].order, i});
+    }
+    std::sort(orderIndices.begin(), orderIndices.end());
+
+    QVector<Slot> slots;
+    for (const auto& entry : orderIndices) {
+        const OneReader::Volume& vol = scene.volumes[entry.second];
+        const int texIndex = scene.textureIndexForVolume(vol);
+        if (texIndex < 0) continue;
+
+        Slot slot;
+        slot.tex = &scene.textures.at(texIndex);
+        slot.model = OneView::volumeModel(vol);
+        slot.inverseModel = slot.model.inverted();
+        slot.emission = vol.emission;
+        slot.opacity = vol.opacity;
+        slot.blend = vol.blend;
+        slot.replace = vol.replace;
+        const int size[3] = {slot.tex->sizeX, slot.tex->sizeY, slot.tex->sizeZ};
+        for (int c = 0; c < 3; ++c) {
+            const float axis = QVector3D(slot.model(c, 0), slot.model(c, 1), slot.model(c, 2)).length();
+            slot.texelsPerUnit = std::max(slot.texelsPerUnit, size[c] * axis);
+        }
+        slots << slot;
+    }
+    return slots;
+}
+
+inline QVector3D texturePosition(const Slot& slot, const QVector3D& position) {
+    return slot.model.map(position) + QVector3D(0.5f, 0.5f, 0.5f);
+}
+
+// length(jE) == 0 in the shader; QVector4D::isNull() is fuzzy
+inline bool isZero(const QVector4D& v) {
+    return v.x() == 0.0f && v.y() == 0.0f && v.z() == 0.0f && v.w() == 0.0f;
+}
+
+inline bool isValidPosition(const QVector3D& p) {
+    return !(p.x() < 0 || p.x() > 1 || p.y() < 0 || p.y() > 1 || p.z() < 0 || p.z() > 1);
+}
+
+inline float smoothstep(float edge0, float edge1, float x) {
+    const float t = qBound(0.0f, (x - edge0) / (edge1 - edge0), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Opacity of a point by its distance from the edges of the unit box (blendFactor in nested.frag)
+float blendFactor(const QVector3D& p, float transitionArea) {
+    if (transitionArea <= 0) return 1.0f;
+    if (transitionArea >= 1) return 0.0f;
+
+    float s = 1.0f;
+    for (int c = 0; c < 3; ++c) {
+        s *= smoothstep(0.0f, transitionArea, p[c]) - smoothstep(1.0f - transitionArea, 1.0f, p[c]);
+    }
+    return std::max(std::abs(s), 0.0f);
+}
+
+// Entry and exit of a ray through an axis aligned box (intersect_box in nested.frag), no hit if x >= y
+QVector2D intersectBox(const QVector3D& origin, const QVector3D& dir, const QVector3D& boxMin, const QVector3D& boxMax) {
+    float t0 = -INFINITY;
+    float t1 = INFINITY;
+    for (int c = 0; c < 3; ++c) {
+        const float invDir = 1.0f / dir[c];
+        const float tA = (boxMin[c] - origin[c]) * invDir;
+        const float tB = (boxMax[c] - origin[c]) * invDir;
+        t0 = std::max(t0, std::min(tA, tB));
+        t1 = std::min(t1, std::max(tA, tB));
+    }
+    return QVector2D(std::max(t0, 0.0f), t1);
+}
+
+// All four channels of a texel, filtered together
+#ifdef ONE_HAVE_SSE2
+typedef __m128 Texel4;
+
+inline Texel4 loadTexel(const float* p) {
+    return _mm_loadu_ps(p);
+}
+
+inline Texel4 loadTexel(const unsigned char* p) {
+    qint32 packed;
+    memcpy(&packed, p, sizeof(packed));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), _mm_set1_ps(1.0f / 255.0f));
+}
+
+inline Texel4 zeroTexel() {
+    return _mm_setzero_ps();
+}
+
+inline void storeTexel(float* p, Texel4 value) {
+    _mm_storeu_ps(p, value);
+}
+
+inline Texel4 lerp(Texel4 a, Texel4 b, float f) {
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(f)));
+}
+#else
+struct Texel4 {
+    float v[4];
+};
+
+inline Texel4 loadTexel(const float* p) {
+    return Texel4{{p[0], p[1], p[2], p[3]}};
+}
+
+inline Texel4 loadTexel(const unsigned char* p) {
+    const float toFloat = 1.0f / 255.0f;
+    return Texel4{{p[0] * toFloat, p[1] * toFloat, p[2] * toFloat, p[3] * toFloat}};
+}
+
+inline Texel4 zeroTexel() {
+    return Texel4{{0.0f, 0.0f, 0.0f, 0.0f}};
+}
+
+inline void storeTexel(float* p, const Texel4& value) {
+    memcpy(p, value.v, sizeof(value.v));
+}
+
+inline Texel4 lerp(const Texel4& a, const Texel4& b, float f) {
+    Texel4 r;
+    for (int c = 0; c < 4; ++c) {
+        r.v[c] = a.v[c] + (b.v[c] - a.v[c]) * f;
+    }
+    return r;
+}
+#endif
+
+// Texel coordinates of a linear filter along one axis, clamped like GL_CLAMP_TO_EDGE
+inline void filterTaps(float texPos, int size, int& i0, int& i1, float& f) {
+    const float x = texPos * size - 0.5f;
+    const float base = std::floor(x);
+    f = x - base;
+    i0 = qBound(0, static_cast<int>(base), size - 1);
+    i1 = qBound(0, static_cast<int>(base) + 1, size - 1);
+}
+
+// GL_LINEAR filtering of one dense level, all four channels at once
+template <typename T>
+Texel4 sampleLinear(const T* texels, int sx, int sy, int sz, const QVector3D& texPos) {
+    int x0, x1, y0, y1, z0, z1;
+    float fx, fy, fz;
+    filterTaps(texPos.x(), sx, x0, x1, fx);
+    filterTaps(texPos.y(), sy, y0, y1, fy);
+    filterTaps(texPos.z(), sz, z0, z1, fz);
+
+    auto at = [&](int x, int y, int z) {
+        return loadTexel(texels + ((static_cast<size_t>(z) * sy + y) * sx + x) * 4);
+    };
+    const Texel4 c00 = lerp(at(x0, y0, z0), at(x1, y0, z0), fx);
+    const Texel4 c10 = lerp(at(x0, y1, z0), at(x1, y1, z0), fx);
+    const Texel4 c01 = lerp(at(x0, y0, z1), at(x1, y0, z1), fx);
+    const Texel4 c11 = lerp(at(x0, y1, z1), at(x1, y1, z1), fx);
+    return lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+}
+
+// Level 0 is the texture itself, level n its mips[n - 1]
+Texel4 sampleLevel(const OneReader::Texture& tex, int level, const QVector3D& texPos) {
+    if (level == 0) {
+        return tex.isFloat ? sampleLinear(tex.floatTexels(), tex.sizeX, tex.sizeY, tex.sizeZ, texPos)
+                           : sampleLinear(tex.byteTexels(), tex.sizeX, tex.sizeY, tex.sizeZ, texPos);
+    }
+    const OneReader::Texture::MipLevel& mip = tex.mips[level - 1];
+    return tex.isFloat ? sampleLinear(mip.data.data(), mip.sizeX, mip.sizeY, mip.sizeZ, texPos)
+                       : sampleLinear(mip.byteData.data(), mip.sizeX, mip.sizeY, mip.sizeZ, texPos);
+}
+
+// GL_LINEAR_MIPMAP_LINEAR at an explicit level of detail, as textureLod() with the
+// mip chain's GL_TEXTURE_MAX_LEVEL
+Texel4 sampleDense(const OneReader::Texture& tex, float lod, const QVector3D& texPos) {
+    const int maxLevel = static_cast<int>(tex.mips.size());
+    if (lod <= 0.0f || maxLevel == 0) {
+        return sampleLevel(tex, 0, texPos);
+    }
+    lod = std::min(lod, static_cast<float>(maxLevel));
+    const int level = static_cast<int>(lod);
+    const float f = lod - level;
+    if (level == maxLevel || f == 0.0f) {
+        return sampleLevel(tex, level, texPos);
+    }
+    return lerp(sampleLevel(tex, level, texPos), sampleLevel(tex, level + 1, texPos), f);
+}
+
+// getBrickedTexture in nested.frag: 0 inside an empty brick, otherwise filtered
+// across the brick's apron, which holds its neighbours' texels
+Texel4 sampleBricked(const OneReader::Texture& tex, const QVector3D& texPos) {
+    const int size = OneReader::Texture::kBrickSize;
+    const int bx = qBound(0, static_cast<int>(texPos.x() * tex.sizeX) / size, tex.bricksX - 1);
+    const int by = qBound(0, static_cast<int>(texPos.y() * tex.sizeY) / size, tex.bricksY - 1);
+    const int bz = qBound(0, static_cast<int>(texPos.z() * tex.sizeZ) / size, tex.bricksZ - 1);
+    if (!tex.isBrickOccupied(bx, by, bz)) {
+        return zeroTexel();
+    }
+
+    int x0, x1, y0, y1, z0, z1;
+    float fx, fy, fz;
+    filterTaps(texPos.x(), tex.sizeX, x0, x1, fx);
+    filterTaps(texPos.y(), tex.sizeY, y0, y1, fy);
+    filterTaps(texPos.z(), tex.sizeZ, z0, z1, fz);
+
+    auto at = [&](int x, int y, int z) {
+        float rgba[4];
+        tex.texel(x, y, z, rgba);
+        return loadTexel(rgba);
+    };
+    const Texel4 c00 = lerp(at(x0, y0, z0), at(x1, y0, z0), fx);
+    const Texel4 c10 = lerp(at(x0, y1, z0), at(x1, y1, z0), fx);
+    const Texel4 c01 = lerp(at(x0, y0, z1), at(x1, y0, z1), fx);
+    const Texel4 c11 = lerp(at(x0, y1, z1), at(x1, y1, z1), fx);
+    return lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+}
+
+// The state nested.frag keeps in globals for the ray being marched
+class NestedMarcher {
+public:
+    NestedMarcher(const QVector<Slot>& slots, const OneCpuRenderer::Settings& settings, const OneReader::Scene& scene)
+        : m_slots(slots), m_settings(settings), m_jScale(scene.emission), m_kScale(scene.opacity),
+          m_pixelAngle(OneView::pixelAngle(settings.size.height())) {}
+
+    // main() of nested.frag for the ray from cameraPos along rayDir. Returns
+    // false where the shader discards (the ray hits no volume).
+    bool shade(const QVector3D& cameraPos, const QVector3D& rayDir, QVector3D& color);
+
+private:
+    const QVector<Slot>& m_slots;
+    const OneCpuRenderer::Settings& m_settings;
+    const float m_jScale;
+    const float m_kScale;
+    const float m_pixelAngle;
+
+    int m_rayVolumes[kMaxRayVolumes];
+    QVector2D m_rayVolumeSpans[kMaxRayVolumes];
+    int m_numRayVolumes = 0;
+    bool m_rayVolumesComplete = true;
+    int m_activeVolumes[kMaxRayVolumes];
+    int m_numActiveVolumes = 0;
+    bool m_allVolumesActive = true;
+    float m_sampleFootprint = 0.0f;
+    bool m_isOrtho = false;
+
+    int activeVolumeCount() const { return m_allVolumesActive ? m_slots.size() : m_numActiveVolumes; }
+    int activeVolume(int k) const { return m_allVolumesActive ? k : m_activeVolumes[k]; }
+
+    QVector4D getTexture(const Slot& slot, const QVector3D& texPos) const;
+    QVector4D getJ(const QVector3D& position, float& ds) const;
+    float stepScale(const QVector3D& position) const;
+    float emptySpan(const QVector3D& origin, const QVector3D& dir, float t, float marchDir) const;
+    float adaptiveStep(const QVector3D& position, const QVector3D& dir, float t, float kGradient) const;
+    float skipStep(float span, float dsInit) const;
+    QVector3D rayTransfer(const QVector3D& origin, const QVector3D& dir, QVector3D I, float t0, float t1);
+    void rayTransferFront(const QVector3D& origin, const QVector3D& dir, QVector3D& I, float& T, float t0, float t1);
+    void frontStep(QVector3D& I, float& T, const QVector4D& jE, float ds) const;
+    QVector2D volumeSpan(const Slot& slot, const QVector3D& origin, const QVector3D& dir) const;
+    bool selectSegmentVolumes(float t0, float t1);
+};
+
+// Texel in the shader's .brga order
+QVector4D NestedMarcher::getTexture(const Slot& slot, const QVector3D& texPos) const {
+    Texel4 value;
+    if (slot.tex->isBricked) {
+        value = sampleBricked(*slot.tex, texPos);
+    } else {
+        float lod = 0.0f;
+        if (m_settings.mipmapping) {
+            lod = std::max(0.0f, std::log2(std::max(m_sampleFootprint * slot.texelsPerUnit, 1E-6f)));
+        }
+        value = sampleDense(*slot.tex, lod, texPos);
+    }
+    float rgba[4];
+    storeTexel(rgba, value);
+    return QVector4D(rgba[2], rgba[0], rgba[1], rgba[3]);
+}
+
+QVector4D NestedMarcher::getJ(const QVector3D& position, float& ds) const {
+    QVector4D jE;
+    float maxScale = 1.0f;
+    float totalWeight = 1.0f;
+
+    for (int a = 0; a < activeVolumeCount(); ++a) {
+        const Slot& slot = m_slots[activeVolume(a)];
+        const QVector3D texPos = texturePosition(slot, position);
+        if (!isValidPosition(texPos)) continue;
+
+        const float scale = slot.model(0, 0);
+        const float weight = blendFactor(texPos, slot.blend) * totalWeight;
+
+        QVector4D jETex = getTexture(slot, texPos) * weight;
+        jETex.setX(jETex.x() * slot.emission);
+        jETex.setY(jETex.y() * slot.emission);
+        jETex.setZ(jETex.z() * slot.emission);
+        jETex.setW(jETex.w() * slot.opacity);
+        jE += jETex;
+
+        maxScale = std::max(scale, maxScale);
+        totalWeight -= weight;
+        if (slot.replace && totalWeight <= 0) break;
+    }
+
+    ds = ds * std::min(1.0f, 1.0f / maxScale) * 0.5f;
+    return jE;
+}
+
+// The factor getJ() scales ds by at position, without sampling the textures
+float NestedMarcher::stepScale(const QVector3D& position) const {
+    float maxScale = 1.0f;
+    float totalWeight = 1.0f;
+    for (int a = 0; a < activeVolumeCount(); ++a) {
+        const Slot& slot = m_slots[activeVolume(a)];
+        const QVector3D texPos = texturePosition(slot, position);
+        if (!isValidPosition(texPos)) continue;
+
+        maxScale = std::max(slot.model(0, 0), maxScale);
+        totalWeight -= blendFactor(texPos, slot.blend) * totalWeight;
+        if (slot.replace && totalWeight <= 0) break;
+    }
+    return std::min(1.0f, 1.0f / maxScale) * 0.5f;
+}
+
+float NestedMarcher::emptySpan(const QVector3D& origin, const QVector3D& dir, float t, float marchDir) const {
+    const QVector3D position = origin + dir * t;
+    float span = 1e30f;
+
+    for (int a = 0; a < activeVolumeCount(); ++a) {
+        const Slot& slot = m_slots[activeVolume(a)];
+        const QVector3D texPos = texturePosition(slot, position);
+        const QVector3D texDir = marchDir * slot.model.mapVector(dir);
+        const QVector3D invDir(1.0f / texDir.x(), 1.0f / texDir.y(), 1.0f / texDir.z());
+
+        if (!isValidPosition(texPos)) {
+            // Not inside this texture yet, but the ray may enter it further on
+            const QVector3D tA = (QVector3D(0, 0, 0) - texPos) * invDir;
+            const QVector3D tB = (QVector3D(1, 1, 1) - texPos) * invDir;
+            float enter = -INFINITY;
+            float leave = INFINITY;
+            for (int c = 0; c < 3; ++c) {
+                enter = std::max(enter, std::min(tA[c], tB[c]));
+                leave = std::min(leave, std::max(tA[c], tB[c]));
+            }
+            if (enter <= leave && leave > 0) {
+                span = std::min(span, std::max(enter, 0.0f));
+            }
+            continue;
+        }
+
+        const OneReader::Texture& tex = *slot.tex;
+        const int count[3] = {tex.macroX, tex.macroY, tex.macroZ};
+        const int size[3] = {tex.sizeX, tex.sizeY, tex.sizeZ};
+        if (count[0] == 0 || count[1] == 0 || count[2] == 0) return 0.0f;
+
+        int cell[3];
+        float cellMin[3];
+        float cellMax[3];
+        for (int c = 0; c < 3; ++c) {
+            const float cellSize = static_cast<float>(OneReader::Texture::kMacroCellSize) / size[c];
+            cell[c] = qBound(0, static_cast<int>(texPos[c] / cellSize), count[c] - 1);
+            cellMin[c] = cell[c] * cellSize;
+            cellMax[c] = std::min(cellMin[c] + cellSize, 1.0f);
+        }
+        if (tex.macroCells[(static_cast<size_t>(cell[2]) * count[1] + cell[1]) * count[0] + cell[0]] != 0) return 0.0f;
+
+        // Distance to where the ray leaves this empty cell
+        for (int c = 0; c < 3; ++c) {
+            span = std::min(span, std::max((cellMin[c] - texPos[c]) * invDir[c], (cellMax[c] - texPos[c]) * invDir[c]));
+        }
+    }
+
+    return span;
+}
+
+float NestedMarcher::adaptiveStep(const QVector3D& position, const QVector3D& dir, float t, float kGradient) const {
+    float voxelStep = 1e30f;
+    for (int a = 0; a < activeVolumeCount(); ++a) {
+        const Slot& slot = m_slots[activeVolume(a)];
+        if (!isValidPosition(texturePosition(slot, position))) continue;
+
+        const QVector3D texels = QVector3D(slot.tex->sizeX, slot.tex->sizeY, slot.tex->sizeZ) * slot.model.mapVector(dir);
+        voxelStep = std::min(voxelStep, 1.0f / std::max(texels.length(), 1E-6f));
+    }
+    if (voxelStep >= 1e30f) {
+        voxelStep = kStepSize;
+    }
+
+    float ds = std::max(voxelStep / m_settings.samplingQuality, t * m_pixelAngle);
+    if (kGradient > 1E-6f) {
+        ds = std::min(ds, std::sqrt(kMaxStepOpacityChange / (m_settings.samplingQuality * kGradient)));
+    }
+    return std::max(ds, 1E-4f);
+}
+
+float NestedMarcher::skipStep(float span, float dsInit) const {
+    if (m_settings.adaptiveSampling) {
+        return span + 1E-4f;
+    }
+    return dsInit * std::max(1.0f, std::floor(span / dsInit));
+}
+
+QVector3D transfer(const QVector3D& I0, const QVector3D& jE, float k, float ds) {
+    if (k < 1E-3f) {
+        return I0 + jE * ds;
+    }
+    const float etau = std::exp(-k * ds);
+    return I0 * etau + (jE / k) * (1.0f - etau);
+}
+
+QVector3D NestedMarcher::rayTransfer(const QVector3D& origin, const QVector3D& dir, QVector3D I, float t0, float t1) {
+    float ds = kStepSize;
+    float dsInit = ds;
+    if (!m_isOrtho) {
+        dsInit *= (1 + t0 / 0.5f);
+    }
+
+    float kPrev = 0;
+    float dsPrev = dsInit;
+    for (float t = t1 - m_settings.rayJitter * dsInit; t >= t0; t -= ds) {
+        if (m_settings.emptySpaceSkipping) {
+            const float span = emptySpan(origin, dir, t, -1.0f);
+            if (span > 0) {
+                ds = skipStep(span, dsInit);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        ds = dsInit;
+        const QVector3D position = origin + dir * t;
+        m_sampleFootprint = t * m_pixelAngle;
+        const QVector4D jE = getJ(position, ds);
+
+        if (m_settings.adaptiveSampling) {
+            const float k = jE.w() * m_kScale;
+            ds = adaptiveStep(position, dir, t, std::abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
+        if (isZero(jE)) {
+            if (!m_settings.adaptiveSampling) {
+                ds = ds * 2.0f;
+            }
+            continue;
+        }
+
+        ds = std::max(.00001f, ds);
+        I = transfer(I, jE.toVector3D() * m_jScale, jE.w() * m_kScale, ds);
+    }
+    return I;
+}
+
+void NestedMarcher::rayTransferFront(const QVector3D& origin, const QVector3D& dir, QVector3D& I, float& T, float t0, float t1) {
+    float dsInit = kStepSize;
+    if (!m_isOrtho) {
+        dsInit *= (1 + t0 / 0.5f);
+    }
+
+    // Without adaptive sampling, start on the last sample of the back to front
+    // march so both take the same samples. It steps by dsInit as scaled by
+    // getJ(), which is taken for the volumes at the middle of the segment.
+    float tStart = t0 + m_settings.rayJitter * dsInit;
+    float tEnd = t1;
+    if (!m_settings.adaptiveSampling) {
+        const float tLast = t1 - m_settings.rayJitter * dsInit;
+        if (tLast < t0) return;
+        const float dsGrid = dsInit * stepScale(origin + dir * (0.5f * (t0 + t1)));
+        tStart = tLast - std::floor((tLast - t0) / dsGrid) * dsGrid;
+        tEnd = tLast + 0.5f * dsGrid;
+    }
+
+    // rayTransfer() steps over the sample after each empty one it takes, which
+    // seen from the front drops a sample exactly when an odd run of empty samples
+    // lies behind it. So each sample waits until the run behind it is known.
+    QVector4D pending;
+    float pendingDs = 0.0f;
+    bool hasPending = false;
+    int emptyRun = 0;
+
+    float ds = dsInit;
+    float kPrev = 0;
+    float dsPrev = dsInit;
+    for (float t = tStart; t <= tEnd; t += ds) {
+        if (T < m_settings.terminationThreshold) return;
+
+        if (m_settings.emptySpaceSkipping) {
+            const float span = emptySpan(origin, dir, t, 1.0f);
+            if (span > 0) {
+                ds = skipStep(span, dsInit);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        ds = dsInit;
+        const QVector3D position = origin + dir * t;
+        m_sampleFootprint = t * m_pixelAngle;
+        const QVector4D jE = getJ(position, ds);
+
+        if (m_settings.adaptiveSampling) {
+            const float k = jE.w() * m_kScale;
+            ds = adaptiveStep(position, dir, t, std::abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
+        if (isZero(jE)) {
+            ++emptyRun;
+            continue;
+        }
+
+        if (hasPending && (m_settings.adaptiveSampling || emptyRun % 2 == 0)) {
+            frontStep(I, T, pending, pendingDs);
+        }
+        pending = jE;
+        pendingDs = std::max(.00001f, ds);
+        hasPending = true;
+        emptyRun = 0;
+    }
+    if (hasPending && (m_settings.adaptiveSampling || emptyRun % 2 == 0)) {
+        frontStep(I, T, pending, pendingDs);
+    }
+}
+
+// The light one sample adds on its own, dimmed by everything in front of it
+void NestedMarcher::frontStep(QVector3D& I, float& T, const QVector4D& jE, float ds) const {
+    const float k = jE.w() * m_kScale;
+    I += T * transfer(QVector3D(), jE.toVector3D() * m_jScale, k, ds);
+    if (k >= 1E-3f) {
+        T *= std::exp(-k * ds);
+    }
+}
+
+QVector2D NestedMarcher::volumeSpan(const Slot& slot, const QVector3D& origin, const QVector3D& dir) const {
+    const QVector3D texPos = texturePosition(slot, origin);
+    const QVector3D texDir = slot.model.mapVector(dir);
+    float tNear = -INFINITY;
+    float tFar = INFINITY;
+    for (int c = 0; c < 3; ++c) {
+        const float invDir = 1.0f / texDir[c];
+        const float tA = (0.0f - texPos[c]) * invDir;
+        const float tB = (1.0f - texPos[c]) * invDir;
+        tNear = std::max(tNear, std::min(tA, tB));
+        tFar = std::min(tFar, std::max(tA, tB));
+    }
+    return QVector2D(tNear, tFar);
+}
+
+bool NestedMarcher::selectSegmentVolumes(float t0, float t1) {
+    m_allVolumesActive = !m_rayVolumesComplete;
+    if (m_allVolumesActive) return true;
+
+    m_numActiveVolumes = 0;
+    for (int k = 0; k < m_numRayVolumes; ++k) {
+        if (m_rayVolumeSpans[k].x() <= t1 && m_rayVolumeSpans[k].y() >= t0) {
+            m_activeVolumes[m_numActiveVolumes++] = m_rayVolumes[k];
+        }
+    }
+    return m_numActiveVolumes > 0;
+}
+
+bool NestedMarcher::shade(const QVector3D& cameraPos, const QVector3D& rayDir, QVector3D& color) {
+    const QVector3D origin = cameraPos * 0.5f; // As nested.frag, which marches from half the camera distance
+    const QVector3D dir = rayDir.normalized();
+
+    m_numRayVolumes = 0;
+    m_rayVolumesComplete = true;
+    m_allVolumesActive = true;
+    m_isOrtho = false;
+
+    // The volumes the ray really passes through, in slot order. Every slot is a
+    // candidate: the GL tile lists only drop volumes that miss the pixel anyway.
+    for (int i = 0; i < m_slots.size(); ++i) {
+        const QVector2D span = volumeSpan(m_slots[i], origin, dir);
+        if (span.x() >= span.y() || span.y() <= 0) continue;
+        if (m_numRayVolumes == kMaxRayVolumes) {
+            m_rayVolumesComplete = false;
+            break;
+        }
+        m_rayVolumes[m_numRayVolumes] = i;
+        m_rayVolumeSpans[m_numRayVolumes] = span;
+        m_numRayVolumes++;
+    }
+
+    float ts[kMaxRayVolumes * 2];
+    int numTs = 0;
+    float tFirst = 1e30f;
+    float tLast = -1e30f;
+    const QVector3D boxMin0(-kBoxSize, -kBoxSize, -kBoxSize);
+    const QVector3D boxMax0(kBoxSize, kBoxSize, kBoxSize);
+    for (const Slot& slot : m_slots) {
+        const QVector2D hit = intersectBox(origin, dir, slot.inverseModel.map(boxMin0), slot.inverseModel.map(boxMax0));
+        if (hit.x() >= hit.y()) continue;
+
+        tFirst = std::min(tFirst, hit.x());
+        tLast = std::max(tLast, hit.y());
+        if (numTs == kMaxRayVolumes * 2) continue;
+        ts[numTs++] = hit.x();
+        ts[numTs++] = hit.y();
+    }
+    if (numTs == 0) return false;
+
+    std::sort(ts, ts + numTs);
+    ts[0] = std::min(ts[0], tFirst);
+    ts[numTs - 1] = std::max(ts[numTs - 1], tLast);
+    if (ts[0] > 10.0f) {
+        m_isOrtho = true;
+    }
+
+    const QVector3D background = m_settings.backgroundColor;
+    if (m_settings.frontToBack) {
+        QVector3D front;
+        float T = 1.0f;
+        for (int i = 1; i < numTs; ++i) {
+            if (!selectSegmentVolumes(ts[i - 1], ts[i])) continue;
+            rayTransferFront(origin, dir, front, T, ts[i - 1], ts[i]);
+            if (T < m_settings.terminationThreshold) break;
+        }
+        color = front + T * background;
+    } else {
+        color = background;
+        for (int i = numTs - 1; i > 0; --i) {
+            if (!selectSegmentVolumes(ts[i - 1], ts[i])) continue;
+            color = rayTransfer(origin, dir, color, ts[i - 1], ts[i]);
+        }
+    }
+    return true;
+}
+
+// single.frag: the first volume's texture over the unit box, without its transform
+class SingleMarcher {
+public:
+    SingleMarcher(const OneReader::Texture& tex, const OneCpuRenderer::Settings& settings, float jScale, float kScale)
+        : m_tex(tex), m_settings(settings), m_jScale(jScale), m_kScale(kScale),
+          m_pixelAngle(OneView::pixelAngle(settings.size.height())),
+          m_texSize(tex.sizeX, tex.sizeY, tex.sizeZ),
+          m_maxSize(std::max(tex.sizeX, std::max(tex.sizeY, tex.sizeZ))) {}
+
+    bool shade(const QVector3D& cameraPos, const QVector3D& rayDir, QVector3D& color);
+
+private:
+    const OneReader::Texture& m_tex;
+    const OneCpuRenderer::Settings& m_settings;
+    const float m_jScale;
+    const float m_kScale;
+    const float m_pixelAngle;
+    const QVector3D m_texSize;
+    const int m_maxSize;
+    float m_sampleFootprint = 0.0f;
+
+    QVector4D getJ(const QVector3D& position) const;
+    float emptySpan(const QVector3D& origin, const QVector3D& dir, float t, float marchDir) const;
+    float adaptiveStep(const QVector3D& dir, float t, float kGradient) const;
+    float skipStep(float span) const;
+    QVector3D rayTransfer(const QVector3D& origin, const QVector3D& dir, float t0, float t1);
+    QVector3D rayTransferFront(const QVector3D& origin, const QVector3D& dir, float t0, float t1);
+};
+
+// Texel in the shader's .bgra order
+QVector4D SingleMarcher::getJ(const QVector3D& position) const {
+    const QVector3D texPos = position + QVector3D(0.5f, 0.5f, 0.5f);
+    Texel4 value;
+    if (m_tex.isBricked) {
+        value = sampleBricked(m_tex, QVector3D(qBound(0.0f, texPos.x(), 1.0f), qBound(0.0f, texPos.y(), 1.0f),
+                                               qBound(0.0f, texPos.z(), 1.0f)));
+    } else {
+        float lod = 0.0f;
+        if (m_settings.mipmapping) {
+            lod = std::max(0.0f, std::log2(std::max(m_sampleFootprint * m_maxSize, 1E-6f)));
+        }
+        value = sampleDense(m_tex, lod, texPos);
+    }
+    float rgba[4];
+    storeTexel(rgba, value);
+    return QVector4D(rgba[2], rgba[1], rgba[0], rgba[3]);
+}
+
+float SingleMarcher::emptySpan(const QVector3D& origin, const QVector3D& dir, float t, float marchDir) const {
+    const int count[3] = {m_tex.macroX, m_tex.macroY, m_tex.macroZ};
+    if (count[0] == 0 || count[1] == 0 || count[2] == 0) return 0.0f;
+
+    const QVector3D position = origin + dir * t + QVector3D(0.5f, 0.5f, 0.5f);
+    int cell[3];
+    float texPos[3];
+    float cellSize[3];
+    for (int c = 0; c < 3; ++c) {
+        texPos[c] = qBound(0.0f, position[c], 1.0f);
+        cellSize[c] = OneReader::Texture::kMacroCellSize / m_texSize[c];
+        cell[c] = qBound(0, static_cast<int>(texPos[c] / cellSize[c]), count[c] - 1);
+    }
+    if (m_tex.macroCells[(static_cast<size_t>(cell[2]) * count[1] + cell[1]) * count[0] + cell[0]] != 0) return 0.0f;
+
+    // Distance to where the ray leaves this empty cell
+    float span = INFINITY;
+    for (int c = 0; c < 3; ++c) {
+        const float invDir = 1.0f / (marchDir * dir[c]);
+        const float cellMin = cell[c] * cellSize[c];
+        const float cellMax = std::min(cellMin + cellSize[c], 1.0f);
+        span = std::min(span, std::max((cellMin - texPos[c]) * invDir, (cellMax - texPos[c]) * invDir));
+    }
+    return span;
+}
+
+float SingleMarcher::adaptiveStep(const QVector3D& dir, float t, float kGradient) const {
+    const float voxelStep = 1.0f / std::max((m_texSize * dir).length(), 1E-6f);
+    float ds = std::max(voxelStep / m_settings.samplingQuality, t * m_pixelAngle);
+    if (kGradient > 1E-6f) {
+        ds = std::min(ds, std::sqrt(kMaxStepOpacityChange / (m_settings.samplingQuality * kGradient)));
+    }
+    return std::max(ds, 1E-4f);
+}
+
+float SingleMarcher::skipStep(float span) const {
+    if (m_settings.adaptiveSampling) {
+        return span + 1E-4f;
+    }
+    return kStepSize * std::max(1.0f, std::floor(span / kStepSize));
+}
+
+// transfer() of single.frag, which differs from nested.frag's at small k
+QVector3D transferSingle(const QVector3D& I0, const QVector3D& jE, float k, float ds) {
+    if (k == 0.0f) {
+        return I0 + jE * ds;
+    }
+    const float etau = std::exp(-k * ds);
+    return I0 * etau + (jE / (k + .0000001f)) * (1.0f - etau);
+}
+
+QVector3D SingleMarcher::rayTransfer(const QVector3D& origin, const QVector3D& dir, float t0, float t1) {
+    QVector3D I;
+    float ds = kStepSize;
+    float kPrev = 0;
+    float dsPrev = kStepSize;
+    for (float t = t1 - m_settings.rayJitter * kStepSize; t >= t0; t -= ds) {
+        ds = kStepSize;
+        if (m_settings.emptySpaceSkipping) {
+            const float span = emptySpan(origin, dir, t, -1.0f);
+            if (span > 0) {
+                ds = skipStep(span);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        m_sampleFootprint = t * m_pixelAngle;
+        const QVector4D jE = getJ(origin + dir * t);
+        const float k = jE.w() * m_kScale;
+        if (m_settings.adaptiveSampling) {
+            ds = adaptiveStep(dir, t, std::abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+        I = transferSingle(I, jE.toVector3D() * m_jScale, k, ds);
+    }
+    return I;
+}
+
+QVector3D SingleMarcher::rayTransferFront(const QVector3D& origin, const QVector3D& dir, float t0, float t1) {
+    QVector3D I;
+    float T = 1.0f;
+    float ds = kStepSize;
+    float kPrev = 0;
+    float dsPrev = kStepSize;
+
+    // Start on the last sample of the back to front march so both take the same samples
+    const float tLast = t1 - m_settings.rayJitter * kStepSize;
+    const float tStart = m_settings.adaptiveSampling ? t0 + m_settings.rayJitter * kStepSize
+                                                     : tLast - std::floor((tLast - t0) / kStepSize) * kStepSize;
+    // Half a step of slack, so rounding in t cannot lose that last sample
+    const float tEnd = m_settings.adaptiveSampling ? t1 : tLast + 0.5f * kStepSize;
+    for (float t = tStart; t <= tEnd; t += ds) {
+        if (T < m_settings.terminationThreshold) break;
+
+        ds = kStepSize;
+        if (m_settings.emptySpaceSkipping) {
+            const float span = emptySpan(origin, dir, t, 1.0f);
+            if (span > 0) {
+                ds = skipStep(span);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        m_sampleFootprint = t * m_pixelAngle;
+        const QVector4D jE = getJ(origin + dir * t);
+        const float k = jE.w() * m_kScale;
+        if (m_settings.adaptiveSampling) {
+            ds = adaptiveStep(dir, t, std::abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
+        I += T * transferSingle(QVector3D(), jE.toVector3D() * m_jScale, k, ds);
+        if (k != 0.0f) {
+            T *= std::exp(-k * ds);
+        }
+    }
+    return I;
+}
+
+bool SingleMarcher::shade(const QVector3D& cameraPos, const QVector3D& rayDir, QVector3D& color) {
+    const QVector3D origin = cameraPos * 0.5f;
+    const QVector3D dir = rayDir.normalized();
+    const QVector2D hit = intersectBox(origin, dir, QVector3D(-kBoxSize, -kBoxSize, -kBoxSize),
+                                       QVector3D(kBoxSize, kBoxSize, kBoxSize));
+    if (hit.x() >= hit.y()) return false;
+
+    color = m_settings.frontToBack ? rayTransferFront(origin, dir, hit.x(), hit.y())
+                                   : rayTransfer(origin, dir, hit.x(), hit.y());
+    return true;
+}
+
+// Whether the ray hits the cube OneRenderer draws to start its rays, so the pixel gets a fragment
+bool coversPixel(const QVector3D& cameraPos, const QVector3D& dir) {
+    float t0 = -INFINITY;
+    float t1 = INFINITY;
+    for (int c = 0; c < 3; ++c) {
+        const float invDir = 1.0f / dir[c];
+        const float tA = (-1.0f - cameraPos[c]) * invDir;
+        const float tB = (1.0f - cameraPos[c]) * invDir;
+        t0 = std::max(t0, std::min(tA, tB));
+        t1 = std::min(t1, std::max(tA, tB));
+    }
+    return t0 < t1 && t1 > 0;
+}
+
+} // namespace
+
+bool OneCpuRenderer::render(const OneReader::SceneData& scene, const Settings& settings, std::vector<float>& image) {
+    QElapsedTimer timer;
+    timer.start();
+
+    const int width = settings.size.width();
+    const int height = settings.size.height();
+    image.assign(static_cast<size_t>(std::max(0, width)) * std::max(0, height) * 4, 0.0f);
+    for (size_t i = 3; i < image.size(); i += 4) {
+        image[i] = 1.0f;
+    }
+    m_stats = Stats();
+    if (width <= 0 || height <= 0 || scene.volumes.isEmpty()) return false;
+
+    const QVector3D cameraPos = settings.viewMatrix.inverted().map(QVector3D(0, 0, 0));
+    const QMatrix4x4 inverseViewProjection = (settings.projectionMatrix * settings.viewMatrix).inverted();
+
+    const int tilesX = (width + kTileSize - 1) / kTileSize;
+    const int tilesY = (height + kTileSize - 1) / kTileSize;
+    const int tileCount = tilesX * tilesY;
+    std::atomic<int> nextTile{0};
+    std::atomic<qint64> rays{0};
+    const int threads = settings.threads > 0 ? settings.threads : std::max(1, QThread::idealThreadCount());
+
+    // Every worker marches with a marcher of its own, pulling tiles until none
+    // are left. A pool of its own keeps the global pool's size from capping
+    // the worker count, so threads is what actually runs.
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    auto renderTiles = [&](auto makeMarcher, float exposure) {
+        auto work = [&]() {
+            auto marcher = makeMarcher();
+            qint64 hits = 0;
+            for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+                const int x0 = (tile % tilesX) * kTileSize;
+                const int y0 = (tile / tilesX) * kTileSize;
+                for (int y = y0; y < std::min(y0 + kTileSize, height); ++y) {
+                    for (int x = x0; x < std::min(x0 + kTileSize, width); ++x) {
+                        // Pixel centre, with y up like gl_FragCoord
+                        const QVector3D farPoint = inverseViewProjection.map(
+                            QVector3D(2.0f * (x + 0.5f) / width - 1.0f, 2.0f * (y + 0.5f) / height - 1.0f, 1.0f));
+                        const QVector3D rayDir = farPoint - cameraPos;
+                        if (!coversPixel(cameraPos, rayDir)) continue;
+                        ++hits;
+
+                        QVector3D color;
+                        if (!marcher.shade(cameraPos, rayDir, color)) continue;
+                        float* out = image.data() + (static_cast<size_t>(height - 1 - y) * width + x) * 4;
+                        out[0] = color.x() * exposure;
+                        out[1] = color.y() * exposure;
+                        out[2] = color.z() * exposure;
+                    }
+                }
+            }
+            rays += hits;
+        };
+        QVector<QFuture<void>> workers;
+        for (int i = 0; i < threads; ++i) {
+            workers << QtConcurrent::run(&pool, work);
+        }
+        for (QFuture<void>& worker : workers) {
+            worker.waitForFinished();
+        }
+    };
+
+    if (settings.nestedMode) {
+        const QVector<Slot> slots = buildSlots(scene);
+        if (slots.isEmpty()) return false;
+        // As OneRenderer::drawVolume sets the exposure uniform
+        const float exposure = (settings.overrideExposure ? settings.exposure : scene.scene.exposure) / 2.0f;
+        renderTiles([&]() { return NestedMarcher(slots, settings, scene.scene); }, exposure);
+    } else {
+        // Single mode shows the first volume, with the scene values as fallback
+        const OneReader::Volume& first = scene.volumes[0];
+        const int texIndex = scene.textureIndexForVolume(first);
+        if (texIndex < 0) return false;
+        const OneReader::Texture& tex = scene.textures.at(texIndex);
+        const float jScale = first.hasEmission ? first.emission : scene.scene.emission;
+        const float kScale = first.hasOpacity ? first.opacity : scene.scene.opacity;
+        renderTiles([&]() { return SingleMarcher(tex, settings, jScale, kScale); }, 1.0f);
+    }
+
+    m_stats.rays = rays;
+    m_stats.nsecs = timer.nsecsElapsed();
+    m_stats.threads = threads;
+    return true;
+}
+
+QImage OneCpuRenderer::toImage(const std::vector<float>& image, const QSize& size) {
+    QImage result(size, QImage::Format_RGBA8888);
+    for (int y = 0; y < size.height(); ++y) {
+        uchar* line = result.scanLine(y);
+        const float* row = image.data() + static_cast<size_t>(y) * size.width() * 4;
+        for (int i = 0; i < size.width() * 4; ++i) {
+            line[i] = static_cast<uchar>(qRound(qBound(0.0f, row[i], 1.0f) * 255.0f));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,68 @@
+// onecpurenderer.h
+#ifndef ONECPURENDERER_H
+#define ONECPURENDERER_H
+
+#include "onereader.h"
+#include <QImage>
+#include <QMatrix4x4>
+#include <QSize>
+#include <QVector3D>
+#include <vector>
+
+// Software version of the raymarchers (shaders/nested.frag and single.frag),
+// for rendering without a GPU. It reads the loader's textures directly and
+// reproduces the shaders step for step: the same slot order, boundary sorting,
+// step sizes, blending and transfer, so its images match the GL path up to
+// texture precision and filtering rounding. Stars and scattering are left out,
+// as the GL renderer never enables them.
+//
+// The image is split into kTileSize tiles that worker threads pull from a
+// shared counter until none are left, so slow tiles (dense volumes) do not hold
+// up a thread's whole share. Samples are filtered with SIMD, four channels at once.
+class OneCpuRenderer {
+public:
+    static const int kTileSize = 16; // Pixels per side of a work tile, same as the GL culling tiles
+
+    // Render options, with the defaults of OneRenderer
+    struct Settings {
+        QSize size = QSize(640, 480);
+        QMatrix4x4 viewMatrix;
+        QMatrix4x4 projectionMatrix;
+        bool frontToBack = false;
+        float terminationThreshold = 0.001f;
+        bool emptySpaceSkipping = true;
+        bool adaptiveSampling = false;
+        float samplingQuality = 2.0f;
+        bool mipmapping = true;
+        float rayJitter = 0.0f;
+        QVector3D backgroundColor = QVector3D(0.0f, 0.0f, 0.0f);
+        bool nestedMode = true; // Otherwise the first volume alone, like single.frag
+        // Exposure in the units of the scene's EXPOSURE param, used instead of
+        // it when overrideExposure is set (nested mode only, as in GL)
+        bool overrideExposure = false;
+        float exposure = 0.0f;
+        int threads = 0; // 0 uses QThread::idealThreadCount()
+    };
+
+    struct Stats {
+        qint64 rays = 0; // Pixels whose ray hit the bounding cube
+        qint64 nsecs = 0;
+        int threads = 0;
+        double raysPerSecond() const { return nsecs > 0 ? rays * 1e9 / nsecs : 0.0; }
+    };
+
+    // Renders scene into image, RGBA floats row by row from the top, like a
+    // readback of the GL target flipped upright. Pixels the bounding cube does
+    // not cover are (0, 0, 0, 1), the GL clear color.
+    bool render(const OneReader::SceneData& scene, const Settings& settings, std::vector<float>& image);
+
+    const Stats& lastStats() const { return m_stats; }
+
+    // 8-bit copy of a float image, clamped like a write to an RGBA8 target
+    static QImage toImage(const std::vector<float>& image, const QSize& size);
+
+private:
+    Stats m_stats;
+};
+
+#endif // ONECPURENDERER_H
@@ -1,11 +1,26 @@
 // oneloader.cpp (Yeni dosya: Implementation for OneLoader class)
 #include "oneloader.h"
 #include <QDebug>
+#include <QFileInfo>
+#include <QDateTime>
 
 OneLoader::OneLoader(QObject *parent) : QObject(parent), m_reader(new OneReader(this)), m_currentFilename("") {
     // Forward signals from reader
     connect(m_reader, &OneReader::loadingStarted, this, &OneLoader::loadingStarted);
+    connect(m_reader, &OneReader::textureReady, this, &OneLoader::textureReady);
     connect(m_reader, &OneReader::loadingFinished, this, &OneLoader::loadingFinished);
+    connect(m_reader, &OneReader::loadingFinished, this, [this](bool success) {
+        // Superseded reader loads end quietly, so a result with a pending key is
+        // the load of m_currentFilename. Without one it is a scene served from
+        // the cache, whose name must stay.
+        if (m_pendingKey.isEmpty()) return;
+        if (!success) {
+            m_currentFilename.clear();  // Allow retrying the same file
+        } else {
+            insertIntoCache(m_pendingKey, m_reader->currentScene());
+        }
+        m_pendingKey.clear();
+    });
 }
 
 OneLoader::~OneLoader() {
@@ -13,14 +28,84 @@ OneLoader::~OneLoader() {
 }
 
 void OneLoader::load(const QString& filename) {
-    if (filename == m_currentFilename) {
-        qDebug() << "Same file already loaded, skipping.";
+    if (filename == m_currentFilename && !m_pendingKey.isEmpty()) {
+        qDebug() << "Same file already loading, skipping.";
         return;  // Pass if same file
     }
     m_currentFilename = filename;
+
+    // Reopening a recent file reuses its decoded scene
+    const QString key = cacheKey(filename);
+    if (m_cache.contains(key)) {
+        qDebug() << "Scene cache hit:" << filename;
+        m_cacheOrder.removeOne(key);
+        m_cacheOrder.prepend(key);
+        m_pendingKey.clear();
+        m_reader->publishScene(m_cache.value(key).scene);
+        return;
+    }
+
+    m_pendingKey = key;
     m_reader->load(filename);
 }
 
 OneReader* OneLoader::getReader() const {
     return m_reader;
 }
+
+void OneLoader::setCacheBudget(qint64 bytes) {
+    m_cacheBudget = bytes;
+    trimCache();
+}
+
+qint64 OneLoader::cacheBudget() const {
+    return m_cacheBudget;
+}
+
+void OneLoader::clearCache() {
+    m_cache.clear();
+    m_cacheOrder.clear();
+    m_cacheBytes = 0;
+}
+
+QString OneLoader::cacheKey(const QString& filename) const {
+    // Path + size + mtime identify the file; the storage mode, texture
+    // precision and mip chains change what is decoded
+    QFileInfo info(filename);
+    return QString("%1|%2|%3|%4|%5|%6")
+        .arg(info.canonicalFilePath())
+        .arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch())
+        .arg(int(m_reader->storageMode()))
+        .arg(int(m_reader->texturePrecision()))
+        .arg(int(m_reader->mipmaps()));
+}
+
+void OneLoader::insertIntoCache(const QString& key, OneReader::SceneHandle scene) {
+    if (!scene) return;
+
+    CacheEntry entry;
+    entry.scene = scene;
+    entry.bytes = qint64(scene->memoryBytes());
+    if (entry.bytes > m_cacheBudget) {
+        qDebug() << "Scene too large for the cache:" << entry.bytes / 1048576.0 << "MB";
+        return;
+    }
+
+    if (m_cache.contains(key)) {
+        m_cacheBytes -= m_cache.value(key).bytes;
+        m_cacheOrder.removeOne(key);
+    }
+    m_cache.insert(key, entry);
+    m_cacheOrder.prepend(key);
+    m_cacheBytes += entry.bytes;
+    trimCache();
+}
+
+void OneLoader::trimCache() {
+    while (m_cacheBytes > m_cacheBudget && !m_cacheOrder.isEmpty()) {
+        QString key = m_cacheOrder.takeLast();
+        m_cacheBytes -= m_cache.value(key).bytes;
+        m_cache.remove(key);
+    }
+}
@@ -4,6 +4,8 @@
 
 #include <QObject>
 #include <QString>
+#include <QList>
+#include <QMap>
 #include "onereader.h"  // Include OneReader header
 
 class OneLoader : public QObject {
@@ -16,13 +18,34 @@ public:
     void load(const QString& filename);
     OneReader* getReader() const;
 
+    // Recently decoded scenes are kept for instant reopening, least recently
+    // used first out once their texel memory exceeds the budget.
+    void setCacheBudget(qint64 bytes);
+    qint64 cacheBudget() const;
+    void clearCache();
+
 signals:
     void loadingStarted();
+    void textureReady(OneReader::SceneHandle scene, int textureIndex, float progress);
     void loadingFinished(bool success);
 
 private:
+    struct CacheEntry {
+        OneReader::SceneHandle scene;
+        qint64 bytes = 0;
+    };
+
+    QString cacheKey(const QString& filename) const;
+    void insertIntoCache(const QString& key, OneReader::SceneHandle scene);
+    void trimCache();
+
     OneReader *m_reader;
     QString m_currentFilename;
+    QString m_pendingKey; // Cache key of the load in flight
+    QMap<QString, CacheEntry> m_cache;
+    QList<QString> m_cacheOrder; // Most recently used first
+    qint64 m_cacheBytes = 0;
+    qint64 m_cacheBudget = qint64(2) << 30;
 };
 
 #endif // ONELOADER_H
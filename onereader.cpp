@@ -2,46 +2,747 @@
 #include "onereader.h"
 #include <algorithm>
 #include <vector>
+#include <cstring>
+#include <numeric>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <QDebug>
+#include <QtEndian>
+#include <QThread>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QSaveFile>
+#include <QFloat16>
 #include <climits>  // For INT_MAX, INT_MIN
+#include <array>
+#include <cmath>
+
+// SSE2 is part of every x86-64 target; 32-bit builds need it enabled
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ONE_HAVE_SSE2 1
+#endif
+// The byte swap's _mm_shuffle_epi8 needs SSSE3 (or AVX, which implies it)
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define ONE_HAVE_SSSE3 1
+#endif
+
+namespace {
+
+const qint64 kFloatRecordSize = 3 * 4 + 4 * 4;
+const qint64 kByteRecordSize = 3 * 4 + 4;
+const qint64 kRecordsPerBatch = 1 << 16;
+const qint64 kBlockSize = 64 << 20; // Block size when the file cannot be mapped
+const qint64 kParallelVoxelThreshold = 1 << 20; // Textures above this are split across threads
+const qint64 kMaxRangeVoxels = 1 << 20; // Largest work item, bounds how long a cancel goes unnoticed
+
+using CancelCheck = OneReader::CancelCheck;
+
+// Generation of loadScene() jobs: never cancelled, no textureReady.
+const int kDetachedLoad = -1;
+
+// .onec layout: fixed preamble, QDataStream header, then one texel payload and
+// one brick slot table per texture, each starting on a kBakedAlignment boundary.
+// Everything is little-endian.
+const char kBakedMagic[4] = {'O', 'N', 'E', 'C'};
+const quint32 kBakedVersion = 1;
+const quint32 kBakedBricked = 0x1; // Preamble flag: textures use BrickedStorage
+const qint64 kBakedPreambleSize = 24; // magic, version, flags, reserved, header size
+const qint64 kBakedAlignment = 64;
+const int kBakedMaxAxis = 1 << 16; // Sanity limit on texture sizes read back from a header
+
+struct BakedPayload {
+    quint64 texelOffset = 0;
+    quint64 texelBytes = 0;
+    quint64 slotsOffset = 0;
+    quint64 slotCount = 0;
+};
+
+qint64 alignBaked(qint64 offset) {
+    return (offset + kBakedAlignment - 1) / kBakedAlignment * kBakedAlignment;
+}
+
+// Reads the fixed preamble; false if the file is not a .onec of a known version.
+bool readBakedPreamble(QFile& file, quint32& flags, quint64& headerBytes) {
+    uchar preamble[kBakedPreambleSize];
+    if (!file.seek(0) || file.read(reinterpret_cast<char*>(preamble), kBakedPreambleSize) != kBakedPreambleSize) {
+        return false;
+    }
+    if (memcmp(preamble, kBakedMagic, 4) != 0 || qFromLittleEndian<quint32>(preamble + 4) != kBakedVersion) {
+        return false;
+    }
+    flags = qFromLittleEndian<quint32>(preamble + 8);
+    headerBytes = qFromLittleEndian<quint64>(preamble + 16);
+    return true;
+}
+
+// Zero-fills up to `offset`, where the next payload starts.
+bool padBaked(QIODevice& out, qint64 offset) {
+    static const char zeros[kBakedAlignment] = {};
+    while (out.pos() < offset) {
+        if (out.write(zeros, std::min(kBakedAlignment, offset - out.pos())) <= 0) return false;
+    }
+    return true;
+}
+
+// Hands out contiguous byte ranges of the file, either straight from a memory
+// mapping or from a large read buffer that is refilled on demand.
+class ByteSource {
+public:
+    explicit ByteSource(QFile& file) : m_file(file) {
+        m_size = file.size();
+        m_base = file.map(0, m_size);
+        if (!m_base) {
+            qDebug() << "Memory mapping failed, falling back to block reads:" << file.errorString();
+        }
+    }
+
+    ~ByteSource() {
+        if (m_base) m_file.unmap(m_base);
+    }
+
+    bool isMapped() const { return m_base != nullptr; }
+    const uchar* mappedData() const { return m_base; }
+    qint64 pos() const { return m_pos; }
+
+    bool seek(qint64 pos) {
+        if (pos < 0 || pos > m_size) return false;
+        m_pos = pos;
+        m_bufStart = m_bufEnd = 0;
+        return m_base || m_file.seek(pos);
+    }
+
+    // Returns a pointer to the next `bytes` bytes and advances past them,
+    // or nullptr if the file ends first.
+    const uchar* take(qint64 bytes) {
+        if (m_base) {
+            if (bytes > m_size - m_pos) return nullptr;
+            const uchar* p = m_base + m_pos;
+            m_pos += bytes;
+            return p;
+        }
+
+        qint64 available = m_bufEnd - m_bufStart;
+        if (available < bytes) {
+            size_t capacity = static_cast<size_t>(std::max(bytes, kBlockSize));
+            if (m_buffer.size() < capacity) {
+                m_buffer.resize(capacity);
+            }
+            memmove(m_buffer.data(), m_buffer.data() + m_bufStart, static_cast<size_t>(available));
+            m_bufStart = 0;
+            m_bufEnd = available;
+            qint64 got = m_file.read(reinterpret_cast<char*>(m_buffer.data()) + m_bufEnd,
+                                     static_cast<qint64>(m_buffer.size()) - m_bufEnd);
+            if (got > 0) m_bufEnd += got;
+            if (m_bufEnd < bytes) return nullptr;
+        }
+        const uchar* p = m_buffer.data() + m_bufStart;
+        m_bufStart += bytes;
+        m_pos += bytes;
+        return p;
+    }
+
+private:
+    QFile& m_file;
+    uchar* m_base = nullptr;
+    qint64 m_size = 0;
+    qint64 m_pos = 0;
+    std::vector<uchar> m_buffer;
+    qint64 m_bufStart = 0;
+    qint64 m_bufEnd = 0;
+};
+
+// Bounding box of a texture's voxel coordinates, gathered in the first pass.
+struct Bounds {
+    int minX = INT_MAX, minY = INT_MAX, minZ = INT_MAX;
+    int maxX = INT_MIN, maxY = INT_MIN, maxZ = INT_MIN;
+
+    void add(int x, int y, int z) {
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        minZ = std::min(minZ, z);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+        maxZ = std::max(maxZ, z);
+    }
+
+    void merge(const Bounds& other) {
+        minX = std::min(minX, other.minX);
+        minY = std::min(minY, other.minY);
+        minZ = std::min(minZ, other.minZ);
+        maxX = std::max(maxX, other.maxX);
+        maxY = std::max(maxY, other.maxY);
+        maxZ = std::max(maxZ, other.maxZ);
+    }
+
+    bool isEmpty() const { return minX > maxX; }
+};
+
+// Pass one: only the three big-endian coordinates of each record are read.
+void accumulateBounds(const uchar* src, qint64 count, qint64 recordSize, Bounds& bounds) {
+    for (qint64 i = 0; i < count; ++i, src += recordSize) {
+        bounds.add(qFromBigEndian<qint32>(src),
+                   qFromBigEndian<qint32>(src + 4),
+                   qFromBigEndian<qint32>(src + 8));
+    }
+}
+
+const int kBrick = OneReader::Texture::kBrickSize;
+
+// Sizes the texture to the bounding box.
+void sizeTexture(OneReader::Texture& tex, const Bounds& bounds) {
+    if (bounds.isEmpty()) {
+        tex.sizeX = tex.sizeY = tex.sizeZ = 0;
+        return;
+    }
+
+    tex.sizeX = bounds.maxX - bounds.minX + 1;
+    tex.sizeY = bounds.maxY - bounds.minY + 1;
+    tex.sizeZ = bounds.maxZ - bounds.minZ + 1;
+}
+
+// Allocates the zeroed dense texel array over the bounding box.
+void allocateDense(OneReader::Texture& tex) {
+    size_t count = static_cast<size_t>(tex.sizeX) * tex.sizeY * tex.sizeZ * 4;
+    if (tex.isFloat) {
+        tex.data.assign(count, 0.0f);
+    } else {
+        tex.byteData.assign(count, 0);
+    }
+}
+
+// Per-brick "holds at least one voxel" flags. The occupancy pass may run on
+// several threads at once, hence the atomics.
+class BrickOccupancy {
+public:
+    BrickOccupancy(OneReader::Texture& tex, const Bounds& bounds) : m_bounds(bounds) {
+        tex.isBricked = true;
+        tex.bricksX = (tex.sizeX + kBrick - 1) / kBrick;
+        tex.bricksY = (tex.sizeY + kBrick - 1) / kBrick;
+        tex.bricksZ = (tex.sizeZ + kBrick - 1) / kBrick;
+        m_bricksX = tex.bricksX;
+        m_bricksY = tex.bricksY;
+        m_count = static_cast<size_t>(tex.bricksX) * tex.bricksY * tex.bricksZ;
+        m_flags.reset(new std::atomic<quint8>[m_count]());
+    }
+
+    void markBrick(int bx, int by, int bz) {
+        m_flags[(static_cast<size_t>(bz) * m_bricksY + by) * m_bricksX + bx].store(1, std::memory_order_relaxed);
+    }
+
+    void mark(const uchar* src, qint64 count, qint64 recordSize) {
+        for (qint64 i = 0; i < count; ++i, src += recordSize) {
+            markBrick((qFromBigEndian<qint32>(src) - m_bounds.minX) / kBrick,
+                      (qFromBigEndian<qint32>(src + 4) - m_bounds.minY) / kBrick,
+                      (qFromBigEndian<qint32>(src + 8) - m_bounds.minZ) / kBrick);
+        }
+    }
+
+    // Hands out pool slots to the occupied bricks and allocates the pool.
+    void allocate(OneReader::Texture& tex) {
+        tex.brickSlots.assign(m_count, -1);
+        qint32 next = 0;
+        for (size_t i = 0; i < m_count; ++i) {
+            if (m_flags[i].load(std::memory_order_relaxed)) {
+                tex.brickSlots[i] = next++;
+            }
+        }
+        tex.occupiedBricks = next;
+
+        size_t count = static_cast<size_t>(next) * kBrick * kBrick * kBrick * 4;
+        if (tex.isFloat) {
+            tex.data.assign(count, 0.0f);
+        } else {
+            tex.byteData.assign(count, 0);
+        }
+    }
+
+private:
+    Bounds m_bounds;
+    int m_bricksX = 0;
+    int m_bricksY = 0;
+    size_t m_count = 0;
+    std::unique_ptr<std::atomic<quint8>[]> m_flags;
+};
+
+// Maps file coordinates to the element offset of their texel, for either layout.
+struct TexelLayout {
+    Bounds bounds;
+    size_t sizeX = 0;
+    size_t sizeY = 0;
+    const qint32* brickSlots = nullptr; // Null for dense textures
+    size_t bricksX = 0;
+    size_t bricksY = 0;
+
+    TexelLayout(const OneReader::Texture& tex, const Bounds& b)
+        : bounds(b), sizeX(tex.sizeX), sizeY(tex.sizeY) {
+        if (tex.isBricked) {
+            brickSlots = tex.brickSlots.data();
+            bricksX = tex.bricksX;
+            bricksY = tex.bricksY;
+        }
+    }
+
+    size_t operator()(int x, int y, int z) const {
+        size_t lx = x - bounds.minX;
+        size_t ly = y - bounds.minY;
+        size_t lz = z - bounds.minZ;
+        if (!brickSlots) {
+            return ((lz * sizeY + ly) * sizeX + lx) * 4;
+        }
+        size_t slot = brickSlots[((lz / kBrick) * bricksY + ly / kBrick) * bricksX + lx / kBrick];
+        return (((slot * kBrick + lz % kBrick) * kBrick + ly % kBrick) * kBrick + lx % kBrick) * 4;
+    }
+};
+
+// Pass two for RGBA_FLOAT: records are seven big-endian dwords (x, y, z, r, g, b, a)
+// and land in the texture in g, b, r, a order.
+void scatterFloatRecords(const uchar* src, qint64 count, float* texels, const TexelLayout& layout) {
+    qint64 i = 0;
+#ifdef ONE_HAVE_SSSE3
+    const __m128i swap32 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i < count; ++i, src += kFloatRecordSize) {
+        alignas(16) qint32 xyzr[4];
+        alignas(16) float rgba[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(xyzr),
+                        _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), swap32));
+        _mm_store_si128(reinterpret_cast<__m128i*>(rgba),
+                        _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), swap32));
+        float* dst = texels + layout(xyzr[0], xyzr[1], xyzr[2]);
+        dst[0] = rgba[1];
+        dst[1] = rgba[2];
+        dst[2] = rgba[0];
+        dst[3] = rgba[3];
+    }
+#endif
+    for (; i < count; ++i, src += kFloatRecordSize) {
+        quint32 words[4];
+        for (int k = 0; k < 4; ++k) {
+            words[k] = qFromBigEndian<quint32>(src + 12 + 4 * k);
+        }
+        float rgba[4];
+        memcpy(rgba, words, sizeof(rgba));
+        float* dst = texels + layout(qFromBigEndian<qint32>(src), qFromBigEndian<qint32>(src + 4),
+                                     qFromBigEndian<qint32>(src + 8));
+        dst[0] = rgba[1];
+        dst[1] = rgba[2];
+        dst[2] = rgba[0];
+        dst[3] = rgba[3];
+    }
+}
+
+// Pass two for RGBA8: three big-endian coordinates followed by r, g, b, a bytes,
+// copied straight into g, b, r, a order without going through float.
+void scatterByteRecords(const uchar* src, qint64 count, unsigned char* texels, const TexelLayout& layout) {
+    for (qint64 i = 0; i < count; ++i, src += kByteRecordSize) {
+        unsigned char* dst = texels + layout(qFromBigEndian<qint32>(src), qFromBigEndian<qint32>(src + 4),
+                                             qFromBigEndian<qint32>(src + 8));
+        dst[0] = src[13];
+        dst[1] = src[14];
+        dst[2] = src[12];
+        dst[3] = src[15];
+    }
+}
+
+void scatterRecords(const uchar* src, qint64 count, OneReader::Texture& tex, const TexelLayout& layout) {
+    if (tex.isFloat) {
+        scatterFloatRecords(src, count, tex.data.data(), layout);
+    } else {
+        scatterByteRecords(src, count, tex.byteData.data(), layout);
+    }
+}
+
+// Rebuilds a dense texture as bricks, dropping bricks that are entirely zero.
+// Used after the stream reader, which always decodes densely.
+void convertToBricks(OneReader::Texture& tex) {
+    Bounds bounds;
+    bounds.add(0, 0, 0);
+    bounds.add(tex.sizeX - 1, tex.sizeY - 1, tex.sizeZ - 1);
+    if (tex.sizeX == 0) {
+        bounds = Bounds();
+    }
+
+    OneReader::Texture dense;
+    dense.sizeX = tex.sizeX;
+    dense.sizeY = tex.sizeY;
+    dense.sizeZ = tex.sizeZ;
+    dense.isFloat = tex.isFloat;
+    dense.data.swap(tex.data);
+    dense.byteData.swap(tex.byteData);
+
+    BrickOccupancy occupancy(tex, bounds);
+    auto brickHasData = [&](int bx, int by, int bz) {
+        for (int z = bz * kBrick; z < std::min(tex.sizeZ, (bz + 1) * kBrick); ++z) {
+            for (int y = by * kBrick; y < std::min(tex.sizeY, (by + 1) * kBrick); ++y) {
+                size_t row = (static_cast<size_t>(z) * tex.sizeY + y) * tex.sizeX;
+                size_t begin = (row + bx * kBrick) * 4;
+                size_t end = (row + std::min(tex.sizeX, (bx + 1) * kBrick)) * 4;
+                for (size_t i = begin; i < end; ++i) {
+                    if (tex.isFloat ? dense.data[i] != 0.0f : dense.byteData[i] != 0) return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    for (int bz = 0; bz < tex.bricksZ; ++bz) {
+        for (int by = 0; by < tex.bricksY; ++by) {
+            for (int bx = 0; bx < tex.bricksX; ++bx) {
+                if (brickHasData(bx, by, bz)) {
+                    occupancy.markBrick(bx, by, bz);
+                }
+            }
+        }
+    }
+    occupancy.allocate(tex);
+
+    TexelLayout layout(tex, bounds);
+    for (int z = 0; z < tex.sizeZ; ++z) {
+        for (int y = 0; y < tex.sizeY; ++y) {
+            for (int x = 0; x < tex.sizeX; ++x) {
+                if (tex.brickSlots[(static_cast<size_t>(z / kBrick) * tex.bricksY + y / kBrick) * tex.bricksX + x / kBrick] < 0) {
+                    continue;
+                }
+                size_t src = ((static_cast<size_t>(z) * tex.sizeY + y) * tex.sizeX + x) * 4;
+                size_t dst = layout(x, y, z);
+                for (int c = 0; c < 4; ++c) {
+                    if (tex.isFloat) {
+                        tex.data[dst + c] = dense.data[src + c];
+                    } else {
+                        tex.byteData[dst + c] = dense.byteData[src + c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Where a texture's voxel records start in the file, found by the pre-scan.
+struct TextureBlock {
+    qint64 offset = 0;
+    qint64 numVoxels = 0;
+};
+
+// A slice of one texture's records, decoded by a single worker.
+struct VoxelRange {
+    qint64 begin = 0;
+    qint64 count = 0;
+    Bounds bounds;
+};
+
+// Decodes one texture straight out of the mapped file. Large textures are cut
+// into ranges so that every pass runs across the thread pool.
+// Returns false if the load was cancelled part way.
+bool decodeMappedTexture(OneReader::Texture& tex, const uchar* records, qint64 numVoxels, bool bricked,
+                         const CancelCheck& cancelled) {
+    const qint64 recordSize = tex.isFloat ? kFloatRecordSize : kByteRecordSize;
+    qint64 rangeCount = 1;
+    if (numVoxels >= kParallelVoxelThreshold) {
+        rangeCount = std::max(1, QThread::idealThreadCount()) * 4;
+    }
+    qint64 rangeSize = std::max<qint64>(1, (numVoxels + rangeCount - 1) / rangeCount);
+    rangeSize = std::min(rangeSize, kMaxRangeVoxels);
+
+    QVector<VoxelRange> ranges;
+    for (qint64 begin = 0; begin < numVoxels; begin += rangeSize) {
+        VoxelRange range;
+        range.begin = begin;
+        range.count = std::min(rangeSize, numVoxels - begin);
+        ranges.append(range);
+    }
+
+    QtConcurrent::blockingMap(ranges, [&](VoxelRange& range) {
+        if (cancelled()) return;
+        accumulateBounds(records + range.begin * recordSize, range.count, recordSize, range.bounds);
+    });
+    if (cancelled()) return false;
+
+    Bounds bounds;
+    for (const VoxelRange& range : ranges) {
+        bounds.merge(range.bounds);
+    }
+
+    sizeTexture(tex, bounds);
+    if (bricked) {
+        BrickOccupancy occupancy(tex, bounds);
+        QtConcurrent::blockingMap(ranges, [&](VoxelRange& range) {
+            if (cancelled()) return;
+            occupancy.mark(records + range.begin * recordSize, range.count, recordSize);
+        });
+        if (cancelled()) return false;
+        occupancy.allocate(tex);
+    } else {
+        allocateDense(tex);
+    }
+
+    const TexelLayout layout(tex, bounds);
+    QtConcurrent::blockingMap(ranges, [&](VoxelRange& range) {
+        if (cancelled()) return;
+        scatterRecords(records + range.begin * recordSize, range.count, tex, layout);
+    });
+    return !cancelled();
+}
+
+// Decodes one texture through the block-read buffer, for files that could not be mapped.
+// Returns false if the load was cancelled part way or a block could not be read.
+bool decodeBufferedTexture(ByteSource& source, OneReader::Texture& tex, const TextureBlock& block, bool bricked,
+                           const CancelCheck& cancelled) {
+    const qint64 recordSize = tex.isFloat ? kFloatRecordSize : kByteRecordSize;
+    auto forEachBatch = [&](const std::function<void(const uchar*, qint64)>& fn) {
+        source.seek(block.offset);
+        for (qint64 done = 0; done < block.numVoxels; ) {
+            if (cancelled()) return false;
+            qint64 count = std::min<qint64>(kRecordsPerBatch, block.numVoxels - done);
+            const uchar* records = source.take(count * recordSize);
+            if (!records) {
+                qDebug() << "Failed to read voxels of texture" << tex.id << "at record" << done;
+                return false;
+            }
+            fn(records, count);
+            done += count;
+        }
+        return true;
+    };
+
+    // First pass: coordinates only, to find the bounding box
+    Bounds bounds;
+    bool ok = forEachBatch([&](const uchar* records, qint64 count) {
+        accumulateBounds(records, count, recordSize, bounds);
+    });
+    if (!ok) return false;
+
+    sizeTexture(tex, bounds);
+    if (bricked) {
+        BrickOccupancy occupancy(tex, bounds);
+        ok = forEachBatch([&](const uchar* records, qint64 count) {
+            occupancy.mark(records, count, recordSize);
+        });
+        if (!ok) return false;
+        occupancy.allocate(tex);
+    } else {
+        allocateDense(tex);
+    }
+
+    // Second pass: decode straight into the final texel layout
+    const TexelLayout layout(tex, bounds);
+    return forEachBatch([&](const uchar* records, qint64 count) {
+        scatterRecords(records, count, tex, layout);
+    });
+}
+
+// One RGBA texel as floats; bytes keep their 0..255 scale
+#ifdef ONE_HAVE_SSE2
+inline __m128 loadTexel(const float* p) {
+    return _mm_loadu_ps(p);
+}
+
+inline __m128 loadTexel(const unsigned char* p) {
+    qint32 packed;
+    memcpy(&packed, p, 4);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+#endif
+
+// Box filters src into dst, a level of half the size (rounded down). On an odd
+// axis the last destination texel also takes in the leftover source texel, so
+// every source texel counts. Slices of dst are filled side by side.
+// Returns false if cancelled part way.
+template <typename T>
+bool downsample(const T* src, int sx, int sy, int sz, float* dst, int dx, int dy, int dz,
+                const CancelCheck& cancelled) {
+    auto span = [](int d, int n, int s, int& first, int& last) {
+        first = std::min(2 * d, s - 1);
+        last = std::min(d == n - 1 ? s - 1 : 2 * d + 1, s - 1);
+    };
+    QVector<int> slices(dz);
+    std::iota(slices.begin(), slices.end(), 0);
+    QtConcurrent::blockingMap(slices, [&](int& z) {
+        if (cancelled()) return;
+        int z0, z1;
+        span(z, dz, sz, z0, z1);
+        for (int y = 0; y < dy; ++y) {
+            int y0, y1;
+            span(y, dy, sy, y0, y1);
+            for (int x = 0; x < dx; ++x) {
+                int x0, x1;
+                span(x, dx, sx, x0, x1);
+                const float weight = 1.0f / ((x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1));
+                float* out = dst + ((static_cast<size_t>(z) * dy + y) * dx + x) * 4;
+#ifdef ONE_HAVE_SSE2
+                __m128 sum = _mm_setzero_ps();
+                for (int k = z0; k <= z1; ++k)
+                    for (int j = y0; j <= y1; ++j)
+                        for (int i = x0; i <= x1; ++i)
+                            sum = _mm_add_ps(sum, loadTexel(src + ((static_cast<size_t>(k) * sy + j) * sx + i) * 4));
+                _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(weight)));
+#else
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int k = z0; k <= z1; ++k)
+                    for (int j = y0; j <= y1; ++j)
+                        for (int i = x0; i <= x1; ++i) {
+                            const T* texel = src + ((static_cast<size_t>(k) * sy + j) * sx + i) * 4;
+                            for (int c = 0; c < 4; ++c) sum[c] += texel[c];
+                        }
+                for (int c = 0; c < 4; ++c) out[c] = sum[c] * weight;
+#endif
+            }
+        }
+    });
+    return !cancelled();
+}
+
+} // namespace
 
 OneReader::OneReader(QObject *parent) : QObject(parent) {}
 
 OneReader::~OneReader() {
-    if (m_watcher) {
-        m_watcher->cancel();
-        m_watcher->waitForFinished();
-        delete m_watcher;
+    // Cancel whatever is still running; the jobs write into this object
+    ++m_loadGeneration;
+    for (QFutureWatcher<bool>* watcher : m_pendingLoads) {
+        watcher->waitForFinished();
     }
 }
 
 void OneReader::load(const QString& filename) {
-    if (m_watcher && !m_watcher->isFinished()) {
-        qDebug() << "Loading already in progress.";
-        return;
+    QElapsedTimer requested;
+    requested.start();
+    // Newest load wins: bumping the generation cancels any job still running
+    const int generation = ++m_loadGeneration;
+    if (!m_pendingLoads.isEmpty()) {
+        qDebug() << "Cancelling previous load.";
     }
 
-    delete m_watcher;
-    m_watcher = new QFutureWatcher<bool>(this);
+    QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>(this);
+    m_pendingLoads.append(watcher);
 
-    connect(m_watcher, &QFutureWatcher<bool>::finished, this, [this]() {
-        bool success = m_watcher->result();
-        emit loadingFinished(success);
-        m_watcher->deleteLater();
-        m_watcher = nullptr;
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, generation]() {
+        m_pendingLoads.removeOne(watcher);
+        // A superseded job ends quietly, its successor reports instead
+        if (!isCancelled(generation)) {
+            emit loadingFinished(watcher->result());
+        }
+        watcher->deleteLater();
     });
 
-    QFuture<bool> future = QtConcurrent::run(this, &OneReader::doLoad, filename);
-    m_watcher->setFuture(future);
+    // Announce before any textureReady of this load can arrive
+    emit loadingStarted();
+
+    QFuture<bool> future = QtConcurrent::run(this, &OneReader::runLoad, filename, m_settings, generation, requested);
+    watcher->setFuture(future);
+}
+
+bool OneReader::isCancelled(int generation) const {
+    return generation != kDetachedLoad && m_loadGeneration.load() != generation;
+}
+
+qint64 OneReader::lastLoadWait() const {
+    return m_lastLoadWait.load();
+}
+
+bool OneReader::runLoad(const QString& filename, LoadSettings settings, int generation, QElapsedTimer requested) {
+    // Jobs decode one at a time. A superseded job runs on until its next cancel
+    // check, which is what bounds the wait here.
+    QMutexLocker locker(&m_loadMutex);
+    const qint64 waited = requested.elapsed();
+    if (isCancelled(generation)) {
+        return false;
+    }
+    m_lastLoadWait = waited;
+    if (waited > 0) {
+        qDebug() << "Previous load stopped after" << waited << "ms";
+    }
+
+    // Build into a fresh scene; the published one stays untouched until the swap
+    std::shared_ptr<SceneData> data = std::make_shared<SceneData>();
+    bool ok = doLoad(filename, settings, generation, data);
+    if (isCancelled(generation)) {
+        // Our reference goes away here, so the partial data is freed unless a
+        // listener still holds textures it was shown
+        qDebug() << "Load cancelled:" << filename;
+        return false;
+    }
+    if (ok) {
+        // Checked again under the lock, so a scene published meanwhile is not overwritten
+        QMutexLocker publishLocker(&m_publishMutex);
+        if (isCancelled(generation)) {
+            return false;
+        }
+        std::atomic_store(&m_currentScene, SceneHandle(data));
+    }
+    return ok;
+}
 
+void OneReader::publishScene(SceneHandle scene) {
+    {
+        QMutexLocker publishLocker(&m_publishMutex);
+        ++m_loadGeneration;  // Cancels any running load
+        std::atomic_store(&m_currentScene, scene);
+    }
     emit loadingStarted();
+    emit loadingFinished(scene != nullptr);
+}
+
+void OneReader::notifyTextureReady(int generation, const SceneHandle& data, int textureIndex, float progress) {
+    if (generation == kDetachedLoad) return;
+
+    // Delivered on the reader's thread and dropped if a newer load() started since
+    QMetaObject::invokeMethod(this, [this, generation, data, textureIndex, progress]() {
+        if (!isCancelled(generation)) {
+            emit textureReady(data, textureIndex, progress);
+        }
+    }, Qt::QueuedConnection);
 }
 
-bool OneReader::doLoad(const QString& filename) {
-    // Önceki verileri tamamen temizle
-    scene = Scene();  // Sıfırla
-    volumes.clear();
-    textures.clear();
+OneReader::SceneHandle OneReader::currentScene() const {
+    return std::atomic_load(&m_currentScene);
+}
+
+OneReader::SceneHandle OneReader::loadScene(const QString& filename) {
+    std::shared_ptr<SceneData> data = std::make_shared<SceneData>();
+    if (!doLoad(filename, m_settings, kDetachedLoad, data)) {
+        return nullptr;
+    }
+    return data;
+}
+
+bool OneReader::doLoad(const QString& filename, LoadSettings settings, int generation,
+                       const std::shared_ptr<SceneData>& data) {
+    if (filename.endsWith(".onec", Qt::CaseInsensitive)) {
+        return readBaked(filename, settings, generation, data);
+    }
+
+    // An up-to-date companion in the requested layout skips decoding entirely
+    const QString bakedName = bakedFileName(filename);
+    QFileInfo bakedInfo(bakedName);
+    if (settings.useBaked && bakedInfo.exists() && bakedInfo.lastModified() >= QFileInfo(filename).lastModified()) {
+        QFile bakedFile(bakedName);
+        quint32 flags = 0;
+        quint64 headerBytes = 0;
+        if (bakedFile.open(QIODevice::ReadOnly) && readBakedPreamble(bakedFile, flags, headerBytes)
+            && ((flags & kBakedBricked) != 0) == (settings.storageMode == BrickedStorage)) {
+            bakedFile.close();
+            if (readBaked(bakedName, settings, generation, data)) {
+                return true;
+            }
+            if (isCancelled(generation)) {
+                return false;
+            }
+            qDebug() << "Falling back to" << filename;
+            *data = SceneData();
+        }
+    }
+
+    Scene& scene = data->scene;
+    QVector<Volume>& volumes = data->volumes;
+    QVector<Texture>& textures = data->textures;
+
+    QElapsedTimer timer;
+    timer.start();
 
     QFile file(filename);
     if (!file.open(QIODevice::ReadOnly)) {
@@ -90,6 +791,8 @@ bool OneReader::doLoad(const QString& filename) {
         vol.params = parseParams(readString(in));
     }
 
+    parseTypedParams(*data);
+
     qint32 numTextures;
     in >> numTextures;
     textures.resize(numTextures);
@@ -98,11 +801,38 @@ bool OneReader::doLoad(const QString& filename) {
         in >> tex.id;
         tex.name = readString(in);
         tex.params = parseParams(readString(in));
+        tex.isFloat = (tex.params.value("TYPE", "") == "RGBA_FLOAT");
     }
 
     // Read data from beginning
-    file.seek(0);
-    for (int i = 0; i < numTextures; ++i) {
+    const bool bricked = (settings.storageMode == BrickedStorage);
+    if (!bricked && settings.denseTextureLimit > 0) {
+        settings.atlasTextures = atlasTextures(*data, settings.denseTextureLimit);
+    }
+    bool ok = (settings.loadMode == MappedLoad) ? readTexturesMapped(file, bricked, settings, generation, data)
+                                                : readTexturesStream(in, bricked, settings, generation, data);
+    if (!ok) {
+        return false;
+    }
+
+    size_t textureBytes = data->memoryBytes();
+
+    qint64 elapsed = std::max<qint64>(1, timer.elapsed());
+    qDebug() << "Loaded" << filename << "in" << elapsed << "ms,"
+             << (fileSize / 1048576.0) / (elapsed / 1000.0) << "MB/s"
+             << (settings.loadMode == MappedLoad ? "(mapped)" : "(stream)")
+             << "texel memory" << textureBytes / 1048576.0 << "MB"
+             << (bricked ? "(bricked)" : "(dense)");
+    return true;
+}
+
+bool OneReader::readTexturesStream(QDataStream& in, bool bricked, const LoadSettings& settings, int generation,
+                                   const std::shared_ptr<SceneData>& data) {
+    QVector<Texture>& textures = data->textures;
+    const CancelCheck cancelled = [this, generation]() { return isCancelled(generation); };
+    QIODevice* device = in.device();
+    device->seek(0);
+    for (int i = 0; i < textures.size(); ++i) {
         Texture& tex = textures[i];
 
         qint64 readId;
@@ -115,88 +845,873 @@ bool OneReader::doLoad(const QString& filename) {
         qint32 numVoxels;
         in >> numVoxels;
 
-        QString type = tex.params.value("TYPE", "");
-        tex.isFloat = (type == "RGBA_FLOAT");
+        const int payloadSize = tex.isFloat ? 4 * 4 : 4;
+        const qint64 recordsStart = device->pos();
 
-        int minX = INT_MAX, minY = INT_MAX, minZ = INT_MAX;
-        int maxX = INT_MIN, maxY = INT_MIN, maxZ = INT_MIN;
+        // First pass: coordinates only, to find the bounding box
+        Bounds bounds;
+        for (int v = 0; v < numVoxels; ++v) {
+            if (v % kRecordsPerBatch == 0 && cancelled()) return false;
+            qint32 x, y, z;
+            in >> x >> y >> z;
+            in.skipRawData(payloadSize);
+            bounds.add(x, y, z);
+        }
 
-        struct VoxelData {
-            int x, y, z;
-            float r, g, b, a;
-        };
-        std::vector<VoxelData> voxList;
-        voxList.reserve(numVoxels);
+        sizeTexture(tex, bounds);
+        allocateDense(tex);
+        const TexelLayout layout(tex, bounds);
 
+        // Second pass: scatter the values into place
+        device->seek(recordsStart);
+        in.resetStatus();
         for (int v = 0; v < numVoxels; ++v) {
+            if (v % kRecordsPerBatch == 0 && cancelled()) return false;
             qint32 x, y, z;
             in >> x >> y >> z;
-            minX = std::min(minX, x);
-            minY = std::min(minY, y);
-            minZ = std::min(minZ, z);
-            maxX = std::max(maxX, x);
-            maxY = std::max(maxY, y);
-            maxZ = std::max(maxZ, z);
-
-            float r, g, b, a;
+            size_t index = layout(x, y, z);
+
             if (tex.isFloat) {
+                float r, g, b, a;
                 in >> r >> g >> b >> a;
+                tex.data[index] = g;
+                tex.data[index + 1] = b;
+                tex.data[index + 2] = r;
+                tex.data[index + 3] = a;
             } else {
                 quint8 rb, gb, bb, ab;
                 in >> rb >> gb >> bb >> ab;
-                r = rb / 255.0f;
-                g = gb / 255.0f;
-                b = bb / 255.0f;
-                a = ab / 255.0f;
+                tex.byteData[index] = gb;
+                tex.byteData[index + 1] = bb;
+                tex.byteData[index + 2] = rb;
+                tex.byteData[index + 3] = ab;
             }
-            voxList.push_back({x, y, z, r, g, b, a});
         }
 
-        tex.sizeX = maxX - minX + 1;
-        tex.sizeY = maxY - minY + 1;
-        tex.sizeZ = maxZ - minZ + 1;
+        if (bricked || settings.atlasTextures.contains(i)) {
+            convertToBricks(tex);
+        }
+        if (!finishTexture(tex, settings, cancelled)) {
+            return false;
+        }
 
-        if (tex.isFloat) {
-            tex.data.resize(static_cast<size_t>(tex.sizeX) * tex.sizeY * tex.sizeZ * 4, 0.0f);
-        } else {
-            tex.byteData.resize(static_cast<size_t>(tex.sizeX) * tex.sizeY * tex.sizeZ * 4, 0);
+        // The stream is read in file order, so progress is counted in textures
+        notifyTextureReady(generation, data, i, float(i + 1) / textures.size());
+    }
+
+    return true;
+}
+
+bool OneReader::readTexturesMapped(QFile& file, bool bricked, const LoadSettings& settings, int generation,
+                                   const std::shared_ptr<SceneData>& data) {
+    QVector<Texture>& textures = data->textures;
+    ByteSource source(file);
+    if (!source.seek(0)) {
+        return false;
+    }
+
+    // Pre-scan: walk the block headers to find where each texture's records start
+    QVector<TextureBlock> blocks(textures.size());
+    for (int i = 0; i < textures.size(); ++i) {
+        const Texture& tex = textures[i];
+
+        const uchar* blockHeader = source.take(12);
+        if (!blockHeader) {
+            qDebug() << "Unexpected end of file before texture" << tex.id;
+            return false;
         }
 
-        for (const auto& v : voxList) {
-            int shifted_x = v.x - minX;
-            int shifted_y = v.y - minY;
-            int shifted_z = v.z - minZ;
+        qint64 readId = qFromBigEndian<qint64>(blockHeader);
+        if (readId != tex.id) {
+            qDebug() << "Texture ID mismatch: read " << readId << " expected " << tex.id;
+            return false;
+        }
+
+        qint32 numVoxels = qFromBigEndian<qint32>(blockHeader + 8);
+        if (numVoxels < 0) {
+            qDebug() << "Invalid voxel count" << numVoxels << "for texture" << tex.id;
+            return false;
+        }
+
+        const qint64 recordSize = tex.isFloat ? kFloatRecordSize : kByteRecordSize;
+        blocks[i].offset = source.pos();
+        blocks[i].numVoxels = numVoxels;
+        if (!source.seek(blocks[i].offset + numVoxels * recordSize)) {
+            qDebug() << "Unexpected end of file in texture" << tex.id;
+            return false;
+        }
+    }
+
+    qint64 totalVoxels = 0;
+    for (const TextureBlock& block : blocks) {
+        totalVoxels += block.numVoxels;
+    }
+    const CancelCheck cancelled = [this, generation]() { return isCancelled(generation); };
+    std::atomic<qint64> decodedVoxels(0);
+    auto textureDone = [&](int i) {
+        if (!finishTexture(textures[i], settings, cancelled)) return;
+        qint64 decoded = decodedVoxels.fetch_add(blocks[i].numVoxels) + blocks[i].numVoxels;
+        notifyTextureReady(generation, data, i, totalVoxels > 0 ? float(double(decoded) / totalVoxels) : 1.0f);
+    };
+
+    QVector<int> order = decodeOrder(*data);
+
+    if (!source.isMapped()) {
+        for (int i : order) {
+            if (!decodeBufferedTexture(source, textures[i], blocks[i], bricked || settings.atlasTextures.contains(i),
+                                       cancelled)) {
+                return false;
+            }
+            textureDone(i);
+        }
+        return true;
+    }
+
+    // Every block is independent, so textures are decoded side by side. The
+    // pool picks them up in coarse-first order, so outer volumes arrive first.
+    const uchar* base = source.mappedData();
+    Texture* texArray = textures.data();
+    QtConcurrent::blockingMap(order, [&](int& i) {
+        if (decodeMappedTexture(texArray[i], base + blocks[i].offset, blocks[i].numVoxels,
+                                bricked || settings.atlasTextures.contains(i), cancelled)) {
+            textureDone(i);
+        }
+    });
+
+    return !cancelled();
+}
+
+bool OneReader::readBaked(const QString& filename, const LoadSettings& settings, int generation,
+                          const std::shared_ptr<SceneData>& data) {
+    QElapsedTimer timer;
+    timer.start();
+
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    Q_UNUSED(settings);
+    Q_UNUSED(generation);
+    Q_UNUSED(data);
+    qDebug() << "Pre-baked files need a little-endian host:" << filename;
+    return false;
+#else
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(filename);
+    if (!file->open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open file:" << filename;
+        return false;
+    }
+
+    quint32 flags = 0;
+    quint64 headerBytes = 0;
+    const qint64 fileSize = file->size();
+    if (!readBakedPreamble(*file, flags, headerBytes) || headerBytes > quint64(fileSize - kBakedPreambleSize)) {
+        qDebug() << "Not a pre-baked ONE file:" << filename;
+        return false;
+    }
+
+    QByteArray header = file->read(static_cast<qint64>(headerBytes));
+    QDataStream in(header);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    Scene& scene = data->scene;
+    QVector<Volume>& volumes = data->volumes;
+    QVector<Texture>& textures = data->textures;
+
+    in >> scene.id >> scene.name >> scene.params;
+
+    qint32 numVolumes = 0;
+    in >> numVolumes;
+    if (numVolumes < 0 || in.status() != QDataStream::Ok) {
+        qDebug() << "Corrupt pre-baked header:" << filename;
+        return false;
+    }
+    volumes.resize(numVolumes);
+    for (Volume& vol : volumes) {
+        in >> vol.id >> vol.name >> vol.params;
+    }
+    parseTypedParams(*data);
+
+    qint32 numTextures = 0;
+    in >> numTextures;
+    if (numTextures < 0 || in.status() != QDataStream::Ok) {
+        qDebug() << "Corrupt pre-baked header:" << filename;
+        return false;
+    }
+    textures.resize(numTextures);
+    QVector<BakedPayload> payloads(numTextures);
+    for (int i = 0; i < numTextures; ++i) {
+        Texture& tex = textures[i];
+        BakedPayload& payload = payloads[i];
+        in >> tex.id >> tex.name >> tex.params >> tex.isFloat
+           >> tex.sizeX >> tex.sizeY >> tex.sizeZ
+           >> tex.isBricked >> tex.bricksX >> tex.bricksY >> tex.bricksZ >> tex.occupiedBricks
+           >> payload.texelOffset >> payload.texelBytes >> payload.slotsOffset >> payload.slotCount;
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "Corrupt pre-baked header:" << filename;
+        return false;
+    }
+
+    // Validate every payload against the file before anything points into it
+    for (int i = 0; i < numTextures; ++i) {
+        const Texture& tex = textures[i];
+        const BakedPayload& payload = payloads[i];
+        const size_t elementSize = tex.isFloat ? sizeof(float) : 1;
+        const quint64 slotCount = tex.isBricked ? quint64(tex.bricksX) * tex.bricksY * tex.bricksZ : 0;
+        bool valid = tex.sizeX >= 0 && tex.sizeY >= 0 && tex.sizeZ >= 0
+                  && tex.sizeX <= kBakedMaxAxis && tex.sizeY <= kBakedMaxAxis && tex.sizeZ <= kBakedMaxAxis
+                  && (!tex.isBricked || (tex.bricksX == (tex.sizeX + kBrick - 1) / kBrick
+                                         && tex.bricksY == (tex.sizeY + kBrick - 1) / kBrick
+                                         && tex.bricksZ == (tex.sizeZ + kBrick - 1) / kBrick
+                                         && tex.occupiedBricks >= 0 && quint64(tex.occupiedBricks) <= slotCount))
+                  && payload.texelBytes == tex.valueCount() * elementSize
+                  && payload.slotCount == slotCount
+                  && payload.texelOffset % kBakedAlignment == 0 && payload.slotsOffset % kBakedAlignment == 0
+                  && payload.texelOffset <= quint64(fileSize) && payload.texelBytes <= quint64(fileSize) - payload.texelOffset
+                  && payload.slotsOffset <= quint64(fileSize)
+                  && payload.slotCount * sizeof(qint32) <= quint64(fileSize) - payload.slotsOffset;
+        if (!valid) {
+            qDebug() << "Invalid payload for texture" << tex.id << "in" << filename;
+            return false;
+        }
+    }
+
+    // Map once; textures then point straight into the file
+    const uchar* base = file->map(0, fileSize);
+    if (base) {
+        data->bakedFile = file;
+    } else {
+        qDebug() << "Memory mapping failed, reading payloads:" << file->errorString();
+    }
+
+    // A dense bake holds every texture densely, so the ones past the dense
+    // texture limit are bricked here like the .ONE readers do, not on the GUI
+    // thread once they reach the renderer
+    const QSet<int> atlas = settings.denseTextureLimit > 0 ? atlasTextures(*data, settings.denseTextureLimit)
+                                                           : QSet<int>();
+    int atlasBricked = 0;
 
-            size_t index = (static_cast<size_t>(shifted_z) * tex.sizeY + shifted_y) * tex.sizeX + shifted_x;
-            index *= 4;
+    const CancelCheck cancelled = [this, generation]() { return isCancelled(generation); };
+    for (int i = 0; i < numTextures; ++i) {
+        if (cancelled()) {
+            return false;
+        }
 
+        Texture& tex = textures[i];
+        const BakedPayload& payload = payloads[i];
+        tex.brickSlots.resize(payload.slotCount);
+        if (base) {
+            tex.mappedTexels = base + payload.texelOffset;
+            if (payload.slotCount > 0) {
+                memcpy(tex.brickSlots.data(), base + payload.slotsOffset, payload.slotCount * sizeof(qint32));
+            }
+        } else {
+            char* texels = nullptr;
             if (tex.isFloat) {
-                tex.data[index] = v.g;
-                tex.data[index + 1] = v.b;
-                tex.data[index + 2] = v.r;
-                tex.data[index + 3] = v.a;
+                tex.data.resize(tex.valueCount());
+                texels = reinterpret_cast<char*>(tex.data.data());
             } else {
-                tex.byteData[index] = static_cast<unsigned char>(v.g * 255.0f);
-                tex.byteData[index + 1] = static_cast<unsigned char>(v.b * 255.0f);
-                tex.byteData[index + 2] = static_cast<unsigned char>(v.r * 255.0f);
-                tex.byteData[index + 3] = static_cast<unsigned char>(v.a * 255.0f);
+                tex.byteData.resize(tex.valueCount());
+                texels = reinterpret_cast<char*>(tex.byteData.data());
+            }
+            bool ok = file->seek(payload.texelOffset)
+                   && file->read(texels, payload.texelBytes) == qint64(payload.texelBytes)
+                   && file->seek(payload.slotsOffset)
+                   && file->read(reinterpret_cast<char*>(tex.brickSlots.data()), payload.slotCount * sizeof(qint32))
+                          == qint64(payload.slotCount * sizeof(qint32));
+            if (!ok) {
+                qDebug() << "Unexpected end of file in texture" << tex.id;
+                return false;
+            }
+        }
+        // Slots index the brick payload, so one out of range would read past its end
+        for (qint32 slot : tex.brickSlots) {
+            if (slot < -1 || slot >= tex.occupiedBricks) {
+                qDebug() << "Invalid brick slot" << slot << "in texture" << tex.id << "of" << filename;
+                return false;
             }
         }
+        if (!tex.isBricked && atlas.contains(i)) {
+            // Bricking rebuilds owned texels, so a mapped payload is copied first
+            if (tex.mappedTexels) {
+                const size_t count = tex.valueCount();
+                if (tex.isFloat) {
+                    tex.data.assign(tex.floatTexels(), tex.floatTexels() + count);
+                } else {
+                    tex.byteData.assign(tex.byteTexels(), tex.byteTexels() + count);
+                }
+                tex.mappedTexels = nullptr;
+            }
+            convertToBricks(tex);
+            ++atlasBricked;
+        }
+        if (!finishTexture(tex, settings, cancelled)) {
+            return false;
+        }
 
+        notifyTextureReady(generation, data, i, float(i + 1) / numTextures);
+    }
+
+    qDebug() << "Loaded" << filename << "in" << std::max<qint64>(1, timer.elapsed()) << "ms (pre-baked"
+             << (base ? "mapped)" : "read)") << "texel memory" << data->memoryBytes() / 1048576.0 << "MB"
+             << ((flags & kBakedBricked) ? "(bricked)" : "(dense)")
+             << atlasBricked << "textures bricked for the atlas";
+    return true;
+#endif
+}
+
+bool OneReader::saveBaked(const SceneData& data, const QString& filename) {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    Q_UNUSED(data);
+    qDebug() << "Pre-baked files need a little-endian host:" << filename;
+    return false;
+#else
+    // Header fields are fixed-width, so its size does not depend on the offsets
+    // filled in on the second pass
+    auto writeHeader = [&data](const QVector<BakedPayload>& payloads) {
+        QByteArray header;
+        QDataStream out(&header, QIODevice::WriteOnly);
+        out.setByteOrder(QDataStream::LittleEndian);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << data.scene.id << data.scene.name << data.scene.params;
+        out << qint32(data.volumes.size());
+        for (const Volume& vol : data.volumes) {
+            out << vol.id << vol.name << vol.params;
+        }
+        out << qint32(data.textures.size());
+        for (int i = 0; i < data.textures.size(); ++i) {
+            const Texture& tex = data.textures[i];
+            const BakedPayload& payload = payloads[i];
+            out << tex.id << tex.name << tex.params << tex.isFloat
+                << qint32(tex.sizeX) << qint32(tex.sizeY) << qint32(tex.sizeZ)
+                << tex.isBricked << qint32(tex.bricksX) << qint32(tex.bricksY) << qint32(tex.bricksZ)
+                << qint32(tex.occupiedBricks)
+                << payload.texelOffset << payload.texelBytes << payload.slotsOffset << payload.slotCount;
+        }
+        return header;
+    };
+
+    QVector<BakedPayload> payloads(data.textures.size());
+    QByteArray header = writeHeader(payloads);
+    qint64 offset = alignBaked(kBakedPreambleSize + header.size());
+    // Dense scenes may hold bricked textures past the dense texture limit, so
+    // only an all bricked scene counts as BrickedStorage
+    quint32 flags = data.textures.isEmpty() ? 0 : kBakedBricked;
+    for (int i = 0; i < data.textures.size(); ++i) {
+        const Texture& tex = data.textures[i];
+        BakedPayload& payload = payloads[i];
+        payload.texelOffset = offset;
+        payload.texelBytes = tex.valueCount() * (tex.isFloat ? sizeof(float) : 1);
+        offset = alignBaked(offset + payload.texelBytes);
+        payload.slotsOffset = offset;
+        payload.slotCount = tex.brickSlots.size();
+        offset = alignBaked(offset + payload.slotCount * sizeof(qint32));
+        if (!tex.isBricked) {
+            flags &= ~kBakedBricked;
+        }
     }
+    header = writeHeader(payloads);
 
+    uchar preamble[kBakedPreambleSize] = {};
+    memcpy(preamble, kBakedMagic, 4);
+    qToLittleEndian<quint32>(kBakedVersion, preamble + 4);
+    qToLittleEndian<quint32>(flags, preamble + 8);
+    qToLittleEndian<quint64>(quint64(header.size()), preamble + 16);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to create file:" << filename;
+        return false;
+    }
+    bool ok = file.write(reinterpret_cast<const char*>(preamble), kBakedPreambleSize) == kBakedPreambleSize
+           && file.write(header) == header.size();
+    for (int i = 0; ok && i < data.textures.size(); ++i) {
+        const Texture& tex = data.textures[i];
+        const BakedPayload& payload = payloads[i];
+        const char* texels = tex.isFloat ? reinterpret_cast<const char*>(tex.floatTexels())
+                                         : reinterpret_cast<const char*>(tex.byteTexels());
+        ok = padBaked(file, payload.texelOffset)
+          && file.write(texels, payload.texelBytes) == qint64(payload.texelBytes)
+          && padBaked(file, payload.slotsOffset)
+          && file.write(reinterpret_cast<const char*>(tex.brickSlots.data()), payload.slotCount * sizeof(qint32))
+                 == qint64(payload.slotCount * sizeof(qint32));
+    }
+    ok = ok && padBaked(file, offset);
+    if (!ok || !file.commit()) {
+        qDebug() << "Failed to write file:" << filename << file.errorString();
+        return false;
+    }
     return true;
+#endif
+}
+
+QString OneReader::bakedFileName(const QString& filename) {
+    QFileInfo info(filename);
+    return info.dir().filePath(info.completeBaseName() + ".onec");
+}
+
+QVector<int> OneReader::decodeOrder(const SceneData& data) {
+    // A texture takes the lowest ORDER of the volumes that use it; unused ones go last
+    std::vector<std::pair<int, int>> keyed;
+    for (int i = 0; i < data.textures.size(); ++i) {
+        int order = INT_MAX;
+        for (const Volume& vol : data.volumes) {
+            if (data.textureIndexForVolume(vol) == i) {
+                order = std::min(order, vol.order);
+            }
+        }
+        keyed.push_back({order, i});
+    }
+    std::stable_sort(keyed.begin(), keyed.end());
+
+    QVector<int> order;
+    for (const auto& entry : keyed) {
+        order.append(entry.second);
+    }
+    return order;
+}
+
+// Textures the renderer reads only through its brick atlas: it hands sampler
+// units to the volumes in ORDER, one per volume, and a texture none of whose
+// volumes got one is bricked there
+QSet<int> OneReader::atlasTextures(const SceneData& data, int denseLimit) {
+    std::vector<std::pair<int, int>> keyed;
+    for (int i = 0; i < data.volumes.size(); ++i) {
+        keyed.push_back({data.volumes[i].order, i});
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    QSet<int> dense;
+    QSet<int> atlas;
+    int units = 0;
+    for (const auto& entry : keyed) {
+        int texIndex = data.textureIndexForVolume(data.volumes[entry.second]);
+        if (texIndex < 0) continue;
+        if (units < denseLimit) {
+            dense.insert(texIndex);
+            ++units;
+        } else {
+            atlas.insert(texIndex);
+        }
+    }
+    return atlas.subtract(dense);
+}
+
+void OneReader::setLoadMode(LoadMode mode) {
+    m_settings.loadMode = mode;
+}
+
+OneReader::LoadMode OneReader::loadMode() const {
+    return m_settings.loadMode;
 }
 
-OneReader::Texture* OneReader::getTextureForVolume(const Volume& vol) {
-    QString texIdStr = vol.params.value("TEXTURE_ID_0", "");
-    bool ok;
-    qint64 texId = texIdStr.toLongLong(&ok);
-    if (!ok) return nullptr;
-    for (auto& tex : textures) {
-        if (tex.id == texId) return &tex;
+void OneReader::setStorageMode(StorageMode mode) {
+    m_settings.storageMode = mode;
+}
+
+OneReader::StorageMode OneReader::storageMode() const {
+    return m_settings.storageMode;
+}
+
+void OneReader::setUseBaked(bool enable) {
+    m_settings.useBaked = enable;
+}
+
+bool OneReader::useBaked() const {
+    return m_settings.useBaked;
+}
+
+void OneReader::setTexturePrecision(TexturePrecision precision) {
+    m_settings.precision = precision;
+}
+
+OneReader::TexturePrecision OneReader::texturePrecision() const {
+    return m_settings.precision;
+}
+
+void OneReader::setMipmaps(bool enable) {
+    m_settings.mipmaps = enable;
+}
+
+bool OneReader::mipmaps() const {
+    return m_settings.mipmaps;
+}
+
+void OneReader::setDenseTextureLimit(int count) {
+    m_settings.denseTextureLimit = std::max(0, count);
+}
+
+int OneReader::denseTextureLimit() const {
+    return m_settings.denseTextureLimit;
+}
+
+bool OneReader::finishTexture(Texture& tex, const LoadSettings& settings, const CancelCheck& cancelled) {
+    // Each pass polls per slice, so a superseded load lets go of m_loadMutex
+    // within one slice of the pass it is in
+    if (!tex.buildMacroCells(cancelled) || !tex.convertPrecision(settings.precision, cancelled)) {
+        return false;
+    }
+    return !settings.mipmaps || tex.buildMips(cancelled);
+}
+
+qint32 OneReader::Texture::brickSlot(int bx, int by, int bz) const {
+    if (!isBricked || bx < 0 || by < 0 || bz < 0 || bx >= bricksX || by >= bricksY || bz >= bricksZ) {
+        return -1;
+    }
+    return brickSlots[(static_cast<size_t>(bz) * bricksY + by) * bricksX + bx];
+}
+
+void OneReader::Texture::texel(int x, int y, int z, float rgba[4]) const {
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.0f;
+    if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ) {
+        return;
+    }
+
+    size_t index;
+    if (isBricked) {
+        qint32 slot = brickSlot(x / kBrickSize, y / kBrickSize, z / kBrickSize);
+        if (slot < 0) {
+            return;
+        }
+        index = ((static_cast<size_t>(slot) * kBrickSize + z % kBrickSize) * kBrickSize + y % kBrickSize) * kBrickSize + x % kBrickSize;
+    } else {
+        index = (static_cast<size_t>(z) * sizeY + y) * sizeX + x;
+    }
+    index *= 4;
+
+    if (isFloat) {
+        const float* texels = floatTexels();
+        for (int c = 0; c < 4; ++c) {
+            rgba[c] = texels[index + c];
+        }
+    } else {
+        const unsigned char* texels = byteTexels();
+        for (int c = 0; c < 4; ++c) {
+            rgba[c] = texels[index + c] / 255.0f;
+        }
+    }
+}
+
+bool OneReader::Texture::buildMacroCells(const CancelCheck& cancelled) {
+    const int cell = kMacroCellSize;
+    macroX = (sizeX + cell - 1) / cell;
+    macroY = (sizeY + cell - 1) / cell;
+    macroZ = (sizeZ + cell - 1) / cell;
+    macroCells.assign(static_cast<size_t>(macroX) * macroY * macroZ, 0);
+    if (macroCells.empty()) return true;
+
+    const float* floats = isFloat ? floatTexels() : nullptr;
+    const unsigned char* bytes = isFloat ? nullptr : byteTexels();
+
+    // Every layer of cells reads its own texel slab plus a one texel border,
+    // so layers are independent and filled side by side.
+    QVector<int> layers(macroZ);
+    std::iota(layers.begin(), layers.end(), 0);
+    QtConcurrent::blockingMap(layers, [&](int& cz) {
+        quint8* layer = macroCells.data() + static_cast<size_t>(cz) * macroY * macroX;
+        const int z0 = std::max(0, cz * cell - 1);
+        const int z1 = std::min(sizeZ, (cz + 1) * cell + 1);
+        for (int z = z0; z < z1; ++z) {
+            if (cancelled()) return;
+            for (int y = 0; y < sizeY; ++y) {
+                const int cy0 = std::max(0, y - 1) / cell;
+                const int cy1 = std::min(sizeY - 1, y + 1) / cell;
+                for (int x = 0; x < sizeX; ++x) {
+                    size_t index;
+                    if (isBricked) {
+                        qint32 slot = brickSlot(x / kBrickSize, y / kBrickSize, z / kBrickSize);
+                        if (slot < 0) {
+                            x = (x / kBrickSize + 1) * kBrickSize - 1; // Skip the rest of the empty brick
+                            continue;
+                        }
+                        index = ((static_cast<size_t>(slot) * kBrickSize + z % kBrickSize) * kBrickSize + y % kBrickSize) * kBrickSize + x % kBrickSize;
+                    } else {
+                        index = (static_cast<size_t>(z) * sizeY + y) * sizeX + x;
+                    }
+                    index *= 4;
+
+                    bool nonZero = isFloat
+                        ? (floats[index] != 0.0f || floats[index + 1] != 0.0f || floats[index + 2] != 0.0f || floats[index + 3] != 0.0f)
+                        : (bytes[index] | bytes[index + 1] | bytes[index + 2] | bytes[index + 3]) != 0;
+                    if (!nonZero) continue;
+
+                    // Filtering anywhere within one texel of x reads it
+                    const int cx0 = std::max(0, x - 1) / cell;
+                    const int cx1 = std::min(sizeX - 1, x + 1) / cell;
+                    for (int cy = cy0; cy <= cy1; ++cy) {
+                        for (int cx = cx0; cx <= cx1; ++cx) {
+                            layer[static_cast<size_t>(cy) * macroX + cx] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    });
+    return !cancelled();
+}
+
+bool OneReader::Texture::convertPrecision(TexturePrecision precision, const CancelCheck& cancelled) {
+    gpuPrecision = Float32Precision;
+    halfTexels.clear();
+    scaledTexels.clear();
+    for (int c = 0; c < 4; ++c) {
+        channelScale[c] = 1.0f;
+        channelBias[c] = 0.0f;
+        maxError[c] = 0.0f;
+    }
+    const size_t count = valueCount();
+    if (!isFloat || precision == Float32Precision || count == 0) return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    const float* src = floatTexels();
+
+    // Texels are converted in independent runs, side by side. A run is
+    // smaller than a slice of any texture worth converting, so the cancel
+    // check is polled per run.
+    const size_t runTexels = 1 << 16;
+    QVector<int> runs(static_cast<int>((count / 4 + runTexels - 1) / runTexels));
+    std::iota(runs.begin(), runs.end(), 0);
+    std::vector<std::array<float, 4>> runError(runs.size(), {{0.0f, 0.0f, 0.0f, 0.0f}});
+    auto runRange = [&](int run, size_t& begin, size_t& end) {
+        begin = run * runTexels * 4;
+        end = std::min(count, begin + runTexels * 4);
+    };
+
+    if (precision == Float16Precision) {
+        halfTexels.resize(count);
+        qfloat16* dst = reinterpret_cast<qfloat16*>(halfTexels.data());
+        QtConcurrent::blockingMap(runs, [&](int& run) {
+            if (cancelled()) return;
+            size_t begin, end;
+            runRange(run, begin, end);
+            // Qt converts in bulk with F16C where the CPU has it
+            qFloatToFloat16(dst + begin, src + begin, end - begin);
+            std::vector<float> back(end - begin);
+            qFloatFromFloat16(back.data(), dst + begin, end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                float& err = runError[run][i % 4];
+                err = std::max(err, std::abs(back[i - begin] - src[i]));
+            }
+        });
+    } else {
+        // Range per channel: colour shares MAX_GREY, alpha uses MAX_A, both
+        // widened to the data so nothing clips; negative data moves the bias
+        std::vector<std::array<float, 8>> runRanges(runs.size());
+        QtConcurrent::blockingMap(runs, [&](int& run) {
+            if (cancelled()) return;
+            size_t begin, end;
+            runRange(run, begin, end);
+            std::array<float, 8>& range = runRanges[run];
+            for (int c = 0; c < 4; ++c) {
+                range[c] = 0.0f;
+                range[4 + c] = 0.0f;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                range[i % 4] = std::min(range[i % 4], src[i]);
+                range[4 + i % 4] = std::max(range[4 + i % 4], src[i]);
+            }
+        });
+        float lo[2] = {0.0f, 0.0f};
+        float hi[2] = {params.value("MAX_GREY", "0").toFloat(), params.value("MAX_A", "0").toFloat()};
+        for (const std::array<float, 8>& range : runRanges) {
+            for (int c = 0; c < 4; ++c) {
+                lo[c / 3] = std::min(lo[c / 3], range[c]);
+                hi[c / 3] = std::max(hi[c / 3], range[4 + c]);
+            }
+        }
+        if (cancelled()) return false;
+        for (int c = 0; c < 4; ++c) {
+            channelBias[c] = lo[c / 3];
+            channelScale[c] = hi[c / 3] > lo[c / 3] ? hi[c / 3] - lo[c / 3] : 1.0f;
+        }
+
+        // Both paths clamp first and then round half up, so SSE and scalar agree on every texel
+        float toByte[4];
+        for (int c = 0; c < 4; ++c) {
+            toByte[c] = 255.0f / channelScale[c];
+        }
+        scaledTexels.resize(count);
+        quint8* dst = scaledTexels.data();
+        QtConcurrent::blockingMap(runs, [&](int& run) {
+            if (cancelled()) return;
+            size_t begin, end;
+            runRange(run, begin, end);
+            size_t i = begin;
+#ifdef ONE_HAVE_SSE2
+            const __m128 bias = _mm_loadu_ps(channelBias);
+            const __m128 scale = _mm_loadu_ps(toByte);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 top = _mm_set1_ps(255.0f);
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; i < end; i += 4) {
+                __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + i), bias), scale), zero), top);
+                __m128i q = _mm_cvttps_epi32(_mm_add_ps(x, half));
+                q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+                qint32 packed = _mm_cvtsi128_si32(q);
+                memcpy(dst + i, &packed, 4);
+            }
+#endif
+            for (; i < end; ++i) {
+                float x = qBound(0.0f, (src[i] - channelBias[i % 4]) * toByte[i % 4], 255.0f);
+                dst[i] = static_cast<quint8>(x + 0.5f);
+            }
+            for (i = begin; i < end; ++i) {
+                float back = dst[i] / 255.0f * channelScale[i % 4] + channelBias[i % 4];
+                float& err = runError[run][i % 4];
+                err = std::max(err, std::abs(back - src[i]));
+            }
+        });
+    }
+
+    if (cancelled()) return false;
+
+    gpuPrecision = precision;
+    for (const std::array<float, 4>& err : runError) {
+        for (int c = 0; c < 4; ++c) {
+            maxError[c] = std::max(maxError[c], err[c]);
+        }
+    }
+    qDebug() << "Texture" << id << (precision == Float16Precision ? "as RGBA16F" : "as scaled RGBA8")
+             << "in" << timer.elapsed() << "ms, max error colour" << std::max({maxError[0], maxError[1], maxError[2]})
+             << "alpha" << maxError[3];
+    return true;
+}
+
+bool OneReader::Texture::buildMips(const CancelCheck& cancelled) {
+    mips.clear();
+    if (isBricked || valueCount() == 0) return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<float> level; // The level being reduced next, as floats
+    size_t bytes = 0;
+    int sx = sizeX;
+    int sy = sizeY;
+    int sz = sizeZ;
+    while (sx > 1 || sy > 1 || sz > 1) {
+        MipLevel mip;
+        mip.sizeX = std::max(1, sx / 2);
+        mip.sizeY = std::max(1, sy / 2);
+        mip.sizeZ = std::max(1, sz / 2);
+        std::vector<float> reduced(static_cast<size_t>(mip.sizeX) * mip.sizeY * mip.sizeZ * 4);
+        bool reducedOk;
+        if (!mips.empty()) {
+            reducedOk = downsample(level.data(), sx, sy, sz, reduced.data(), mip.sizeX, mip.sizeY, mip.sizeZ, cancelled);
+        } else if (isFloat) {
+            reducedOk = downsample(floatTexels(), sx, sy, sz, reduced.data(), mip.sizeX, mip.sizeY, mip.sizeZ, cancelled);
+        } else {
+            reducedOk = downsample(byteTexels(), sx, sy, sz, reduced.data(), mip.sizeX, mip.sizeY, mip.sizeZ, cancelled);
+        }
+        if (!reducedOk) {
+            mips.clear();
+            return false;
+        }
+
+        // Stored like level 0: byte textures round back to bytes, float ones
+        // also get the GPU copy at their precision
+        if (!isFloat) {
+            mip.byteData.resize(reduced.size());
+            for (size_t i = 0; i < reduced.size(); ++i) {
+                mip.byteData[i] = static_cast<unsigned char>(std::min(255.0f, reduced[i] + 0.5f));
+            }
+        } else {
+            mip.data = reduced;
+            if (gpuPrecision == Float16Precision) {
+                mip.halfTexels.resize(reduced.size());
+                qFloatToFloat16(reinterpret_cast<qfloat16*>(mip.halfTexels.data()), reduced.data(), reduced.size());
+            } else if (gpuPrecision == Scaled8Precision) {
+                mip.scaledTexels.resize(reduced.size());
+                for (size_t i = 0; i < reduced.size(); ++i) {
+                    float x = qBound(0.0f, (reduced[i] - channelBias[i % 4]) * (255.0f / channelScale[i % 4]), 255.0f);
+                    mip.scaledTexels[i] = static_cast<quint8>(x + 0.5f);
+                }
+            }
+        }
+
+        bytes += mip.data.size() * sizeof(float) + mip.byteData.size() + mip.halfTexels.size() * sizeof(quint16)
+               + mip.scaledTexels.size();
+        sx = mip.sizeX;
+        sy = mip.sizeY;
+        sz = mip.sizeZ;
+        level.swap(reduced);
+        mips.push_back(std::move(mip));
+    }
+    qDebug() << "Texture" << id << "mip chain:" << mips.size() << "levels in" << timer.elapsed() << "ms,"
+             << bytes / 1048576.0 << "MB";
+    return true;
+}
+
+size_t OneReader::Texture::valueCount() const {
+    size_t texels = isBricked ? static_cast<size_t>(occupiedBricks) * kBrickSize * kBrickSize * kBrickSize
+                              : static_cast<size_t>(sizeX) * sizeY * sizeZ;
+    return texels * 4;
+}
+
+const float* OneReader::Texture::floatTexels() const {
+    return mappedTexels ? reinterpret_cast<const float*>(mappedTexels) : data.data();
+}
+
+const unsigned char* OneReader::Texture::byteTexels() const {
+    return mappedTexels ? mappedTexels : byteData.data();
+}
+
+size_t OneReader::SceneData::memoryBytes() const {
+    size_t bytes = 0;
+    for (const Texture& tex : textures) {
+        bytes += tex.memoryBytes();
+    }
+    return bytes;
+}
+
+size_t OneReader::Texture::memoryBytes() const {
+    size_t bytes = valueCount() * (isFloat ? sizeof(float) : 1) + brickSlots.size() * sizeof(qint32) + macroCells.size()
+                 + halfTexels.size() * sizeof(quint16) + scaledTexels.size();
+    for (const MipLevel& mip : mips) {
+        bytes += mip.data.size() * sizeof(float) + mip.byteData.size() + mip.halfTexels.size() * sizeof(quint16)
+               + mip.scaledTexels.size();
+    }
+    return bytes;
+}
+
+int OneReader::SceneData::textureIndexForVolume(const Volume& vol) const {
+    if (!vol.hasTexture) return -1;
+    for (int i = 0; i < textures.size(); ++i) {
+        if (textures[i].id == vol.textureId) return i;
+    }
+    return -1;
+}
+
+const OneReader::Texture* OneReader::SceneData::getTextureForVolume(const Volume& vol) const {
+    int index = textureIndexForVolume(vol);
+    return index >= 0 ? &textures[index] : nullptr;
+}
+
+void OneReader::parseTypedParams(SceneData& data) {
+    const QMap<QString, QString>& sceneParams = data.scene.params;
+    data.scene.emission = sceneParams.value("EMISSION", "1.0").toFloat();
+    data.scene.opacity = sceneParams.value("OPACITY", "600.0").toFloat();
+    data.scene.exposure = sceneParams.value("EXPOSURE").toFloat();
+
+    for (Volume& vol : data.volumes) {
+        const QMap<QString, QString>& params = vol.params;
+        vol.scale[0] = params.value("SCALE_X", "1.0").toFloat();
+        vol.scale[1] = params.value("SCALE_Y", "1.0").toFloat();
+        vol.scale[2] = params.value("SCALE_Z", "1.0").toFloat();
+        vol.offset[0] = params.value("OFFSET_X", "0.0").toFloat();
+        vol.offset[1] = params.value("OFFSET_Y", "0.0").toFloat();
+        vol.offset[2] = params.value("OFFSET_Z", "0.0").toFloat();
+        vol.rotation[0] = params.value("ROT_X", "0.0").toFloat();
+        vol.rotation[1] = params.value("ROT_Y", "0.0").toFloat();
+        vol.rotation[2] = params.value("ROT_Z", "0.0").toFloat();
+        vol.hasEmission = params.contains("EMISSION");
+        vol.hasOpacity = params.contains("OPACITY");
+        vol.emission = params.value("EMISSION", "1.0").toFloat();
+        vol.opacity = params.value("OPACITY", "1.0").toFloat();
+        vol.blend = params.value("BLEND", "0.0").toFloat();
+        vol.replace = (params.value("REPLACE", "false").toLower() == "true");
+        vol.order = params.value("ORDER", "0").toInt();
+        vol.textureId = params.value("TEXTURE_ID_0", "").toLongLong(&vol.hasTexture);
     }
-    return nullptr;
 }
 
 QMap<QString, QString> OneReader::parseParams(const QString& paramStr) {
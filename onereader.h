@@ -3,13 +3,19 @@
 #define ONEREADER_H
 
 #include <QMap>
+#include <QSet>
 #include <QString>
 #include <QVector>
 #include <QFile>
 #include <QDataStream>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QtConcurrent>
 #include <QFutureWatcher>
+#include <QMutex>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 class OneReader : public QObject {
     Q_OBJECT
@@ -18,7 +24,37 @@ public:
     explicit OneReader(QObject *parent = nullptr);
     ~OneReader();
 
+    // How voxel records are pulled from the file. MappedLoad memory-maps the
+    // file (or falls back to large block reads) and byte-swaps records in bulk;
+    // StreamLoad is the original per-field QDataStream path, kept for comparison.
+    enum LoadMode {
+        MappedLoad,
+        StreamLoad
+    };
+
+    // How texel data is kept in memory. DenseStorage expands each texture over
+    // its bounding box; BrickedStorage keeps only the bricks that hold voxels.
+    enum StorageMode {
+        DenseStorage,
+        BrickedStorage
+    };
+
+    // Precision RGBA_FLOAT textures get on the GPU. Lower precisions are
+    // converted on the loader thread into a GPU copy kept next to the float
+    // data, which the CPU side (macro cells, bricks, baking) keeps using.
+    enum TexturePrecision {
+        Float32Precision, // GL_RGBA32F, 16 bytes per texel
+        Float16Precision, // GL_RGBA16F, 8 bytes per texel
+        Scaled8Precision  // GL_RGBA8 with a per-texture scale and bias, 4 bytes per texel
+    };
+
+    // Polled by the load passes between slices; true once a newer load() has
+    // superseded the running one.
+    using CancelCheck = std::function<bool()>;
+
     struct Texture {
+        static constexpr int kBrickSize = 16; // Bricks are kBrickSize^3 texels
+
         qint64 id;
         QString name;
         QMap<QString, QString> params;
@@ -28,39 +64,218 @@ public:
         bool isFloat = false;
         std::vector<float> data; // RGBA float, 4 channels
         std::vector<unsigned char> byteData; // Yeni: Byte tipi için (RGBA8)
+
+        // Sparse layout (BrickedStorage). data/byteData then hold the occupied
+        // bricks back to back, each brick z-major like a small dense texture.
+        bool isBricked = false;
+        int bricksX = 0;
+        int bricksY = 0;
+        int bricksZ = 0;
+        int occupiedBricks = 0;
+        std::vector<qint32> brickSlots; // Per brick: slot in data/byteData, or -1 if empty
+
+        // Set when the payload is read in place from a mapped .onec file, which
+        // the owning SceneData keeps open; data/byteData are then empty.
+        const uchar* mappedTexels = nullptr;
+
+        // Empty space skipping: one byte per kMacroCellSize^3 block of texels,
+        // non-zero if linear filtering anywhere inside the block can read a
+        // non-zero texel. Built at load time by buildMacroCells(), which like
+        // the other load passes below returns false if cancelled part way.
+        static constexpr int kMacroCellSize = 8;
+        int macroX = 0;
+        int macroY = 0;
+        int macroZ = 0;
+        std::vector<quint8> macroCells;
+        bool buildMacroCells(const CancelCheck& cancelled);
+
+        // Reduced precision GPU copy of a float texture, in the layout of data.
+        // Scaled8Precision texels decode as byte / 255 * channelScale + channelBias,
+        // per channel in stored order. Built by convertPrecision().
+        TexturePrecision gpuPrecision = Float32Precision;
+        std::vector<quint16> halfTexels; // Float16Precision
+        std::vector<quint8> scaledTexels; // Scaled8Precision
+        float channelScale[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        float channelBias[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float maxError[4] = {0.0f, 0.0f, 0.0f, 0.0f}; // Largest conversion error per channel
+        bool convertPrecision(TexturePrecision precision, const CancelCheck& cancelled);
+
+        // Mip chain of a dense texture for level of detail, level 1 first. Each
+        // level is a box filtered half of the one before (sizes rounded down, at
+        // least 1) in the layout of data, kept as floats or bytes like the texture
+        // plus the GPU copy gpuPrecision asks for. Built by buildMips().
+        struct MipLevel {
+            int sizeX = 0;
+            int sizeY = 0;
+            int sizeZ = 0;
+            std::vector<float> data;
+            std::vector<unsigned char> byteData;
+            std::vector<quint16> halfTexels;
+            std::vector<quint8> scaledTexels;
+        };
+        std::vector<MipLevel> mips;
+        bool buildMips(const CancelCheck& cancelled);
+
+        size_t valueCount() const; // Floats or bytes in the texel payload, from the layout
+        const float* floatTexels() const;
+        const unsigned char* byteTexels() const;
+
+        qint32 brickSlot(int bx, int by, int bz) const;
+        bool isBrickOccupied(int bx, int by, int bz) const { return brickSlot(bx, by, bz) >= 0; }
+
+        // Texel at (x, y, z) in either layout, in stored channel order; byte
+        // textures are scaled to 0..1. Empty bricks and outside positions read as 0.
+        void texel(int x, int y, int z, float rgba[4]) const;
+
+        size_t memoryBytes() const;
     };
 
     struct Volume {
         qint64 id;
         QString name;
         QMap<QString, QString> params;
+
+        // Typed copies of params, parsed once at load time
+        float scale[3] = {1.0f, 1.0f, 1.0f};
+        float offset[3] = {0.0f, 0.0f, 0.0f};
+        float rotation[3] = {0.0f, 0.0f, 0.0f}; // Degrees about X, Y, Z
+        float emission = 1.0f;
+        float opacity = 1.0f;
+        bool hasEmission = false; // Single mode falls back to the scene values
+        bool hasOpacity = false;
+        float blend = 0.0f;
+        bool replace = false;
+        int order = 0;
+        bool hasTexture = false;
+        qint64 textureId = 0; // TEXTURE_ID_0
     };
 
     struct Scene {
         qint64 id;
         QString name;
         QMap<QString, QString> params;
+
+        // Typed copies of params, parsed once at load time
+        float emission = 1.0f;
+        float opacity = 600.0f;
+        float exposure = 0.0f;
+    };
+
+    // Everything one load produces. Built privately by the loader thread and
+    // published as an immutable snapshot once complete.
+    struct SceneData {
+        Scene scene;
+        QVector<Volume> volumes;
+        QVector<Texture> textures;
+
+        const Texture* getTextureForVolume(const Volume& vol) const;
+        int textureIndexForVolume(const Volume& vol) const; // -1 if the volume has no texture
+        size_t memoryBytes() const; // Texel memory of all textures
+
+        std::shared_ptr<QFile> bakedFile; // Mapped .onec the textures point into, if any
     };
+    typedef std::shared_ptr<const SceneData> SceneHandle;
+
+    // The last successfully loaded scene, or null. A new load only replaces it
+    // when complete; holders of the old handle keep a valid scene. Thread-safe.
+    SceneHandle currentScene() const;
+    // Makes an already decoded scene current, as if a load of it had just
+    // finished (loadingStarted, then loadingFinished). Cancels any running load.
+    void publishScene(SceneHandle scene);
+
+    // Synchronous load for tools: decodes on the calling thread with the current
+    // settings and returns the scene without publishing it. Null on failure.
+    SceneHandle loadScene(const QString& filename);
 
-    Scene scene;
-    QVector<Volume> volumes;
-    QVector<Texture> textures;
+    // Pre-baked companion format (.onec): parsed params plus GPU-ready texel
+    // payloads, little-endian and aligned, so loading is a header read and a
+    // memory map. load() picks up an up-to-date foo.onec next to foo.one.
+    static bool saveBaked(const SceneData& data, const QString& filename);
+    static QString bakedFileName(const QString& filename);
 
-    void load(const QString& filename); // Asynchronous load
+    // Asynchronous load. Calling it again while a load is running cancels the
+    // older one; only the newest load reports loadingFinished.
+    void load(const QString& filename);
+    // Milliseconds the last load() to start decoding waited, from the call, for
+    // the load it superseded to let go of the loader; -1 before the first.
+    qint64 lastLoadWait() const;
 
-    Texture* getTextureForVolume(const Volume& vol);
+    void setLoadMode(LoadMode mode);
+    LoadMode loadMode() const;
+
+    void setStorageMode(StorageMode mode);
+    StorageMode storageMode() const;
+
+    // GPU precision of float textures in the next load (default Float32Precision)
+    void setTexturePrecision(TexturePrecision precision);
+    TexturePrecision texturePrecision() const;
+
+    // Whether the next load builds mip chains for dense textures (default on)
+    void setMipmaps(bool enable);
+    bool mipmaps() const;
+
+    // Whether loading foo.one may read an up-to-date foo.onec instead (default on)
+    void setUseBaked(bool enable);
+    bool useBaked() const;
+
+    // Dense textures the renderer gives a sampler of their own, taken in ORDER
+    // of the volumes like its slots (default 0, no limit). With DenseStorage the
+    // textures past the limit are bricked on the loader thread, as the renderer
+    // only reads them through its brick atlas.
+    void setDenseTextureLimit(int count);
+    int denseTextureLimit() const;
 
 signals:
     void loadingStarted();
-    void loadingFinished(bool success);
+    // Emitted (queued, on the reader's thread) once scene->textures[textureIndex]
+    // of the scene being loaded is fully decoded; that texture no longer changes.
+    // Textures arrive coarse-first (by the lowest ORDER of their volumes);
+    // progress is the fraction of the file's texel data decoded so far.
+    void textureReady(OneReader::SceneHandle scene, int textureIndex, float progress);
+    void loadingFinished(bool success); // On success currentScene() is the new scene
 
 private:
-    bool doLoad(const QString& filename); // Synchronous loading logic
+    // Snapshot of the load options, handed to the worker thread
+    struct LoadSettings {
+        LoadMode loadMode = MappedLoad;
+        StorageMode storageMode = DenseStorage;
+        bool useBaked = true;
+        TexturePrecision precision = Float32Precision;
+        bool mipmaps = true;
+        int denseTextureLimit = 0;
+        QSet<int> atlasTextures; // Per load: dense textures past denseTextureLimit
+    };
+
+    bool runLoad(const QString& filename, LoadSettings settings, int generation,
+                 QElapsedTimer requested); // Worker entry point
+    bool doLoad(const QString& filename, LoadSettings settings, int generation,
+                const std::shared_ptr<SceneData>& data); // Synchronous loading logic
+    bool readTexturesStream(QDataStream& in, bool bricked, const LoadSettings& settings, int generation,
+                            const std::shared_ptr<SceneData>& data);
+    bool readTexturesMapped(QFile& file, bool bricked, const LoadSettings& settings, int generation,
+                            const std::shared_ptr<SceneData>& data);
+    bool readBaked(const QString& filename, const LoadSettings& settings, int generation,
+                   const std::shared_ptr<SceneData>& data);
+    static bool finishTexture(Texture& tex, const LoadSettings& settings,
+                              const CancelCheck& cancelled); // Derived data, once the texels are in
+    bool isCancelled(int generation) const;
+    void notifyTextureReady(int generation, const SceneHandle& data, int textureIndex, float progress);
+    static QVector<int> decodeOrder(const SceneData& data);
+    static QSet<int> atlasTextures(const SceneData& data, int denseLimit);
 
     QMap<QString, QString> parseParams(const QString& paramStr);
+    static void parseTypedParams(SceneData& data);
     QString readString(QDataStream& ds);
 
-    QFutureWatcher<bool> *m_watcher = nullptr;
+    QList<QFutureWatcher<bool>*> m_pendingLoads; // Jobs not finished yet, newest last
+    std::atomic<int> m_loadGeneration{0}; // Bumped by every load(); older jobs see it and stop
+    QMutex m_loadMutex; // One decode at a time, so an old and a new scene never both grow in memory
+    std::atomic<qint64> m_lastLoadWait{-1};
+    SceneHandle m_currentScene; // Accessed through std::atomic_load/atomic_store
+    QMutex m_publishMutex; // Makes "not cancelled, then store" atomic against publishScene()
+    LoadSettings m_settings;
 };
 
+Q_DECLARE_METATYPE(OneReader::SceneHandle)
+
 #endif // ONEREADER_H
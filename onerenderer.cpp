@@ -1,50 +1,221 @@
 #define _USE_MATH_DEFINES // For M_PI in MSVC
 #include "onerenderer.h"
+#include "oneview.h"
+#include "onecpurenderer.h"
 #include <QDebug>
 #include <cmath>
 #include <QFile>
 #include <QTextStream>
+#include <QtMath>
+#include <QFloat16>
+#include <QLabel>
+#include <QRect>
+#include <QStringList>
+#include <QVector4D>
 #include <algorithm>
 #include <cstring>
+#include <limits>
+#include <numeric>
 
 OneRenderer::OneRenderer(QWidget *parent) : QOpenGLWidget(parent) {
     memset(m_textures, 0, sizeof(m_textures));
+
+    // Input that stops for this long ends the interaction and starts refining
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(150);
+    connect(&m_idleTimer, &QTimer::timeout, this, [this]() {
+        m_interacting = false;
+        restartRefinement();
+    });
+
+    // Stats overlay: a label over the view, so drawing it leaves the GL state alone
+    m_overlay = new QLabel(this);
+    m_overlay->setAttribute(Qt::WA_TransparentForMouseEvents);
+    m_overlay->setStyleSheet("QLabel { color: white; background: rgba(0, 0, 0, 160); padding: 4px;"
+                             " font-family: monospace; }");
+    m_overlay->move(8, 8);
+    m_overlay->hide();
 }
 
 OneRenderer::~OneRenderer() {
     makeCurrent();
-    for (int i = 0; i < 10; ++i) {
-        if (m_textures[i]) glDeleteTextures(1, &m_textures[i]);
-    }
+    releaseTextures();
+    m_interactiveFbo.reset();
+    m_frameFbo.reset();
+    m_accumFbo.reset();
     m_vbo.destroy();
     m_boundVBO.destroy();
+    for (TimerQuery& timer : m_timerQueries) {
+        glDeleteQueries(1, &timer.volume);
+        glDeleteQueries(1, &timer.bounds);
+    }
     glDeleteVertexArrays(1, &m_vao);
     glDeleteVertexArrays(1, &m_boundVAO);
 }
 
-void OneRenderer::setOneReader(OneReader *reader) {
-    m_reader = reader;
+void OneRenderer::setScene(OneReader::SceneHandle scene) {
     makeCurrent();
+    if (scene != m_scene) {
+        // Swap first, then free the previous scene's textures
+        QMap<qint64, ResidentTexture> previous = m_denseTextures;
+        m_denseTextures.clear();
+        if (scene && scene == m_pendingScene) {
+            m_denseTextures = m_pendingTextures;  // Uploaded while the old scene was on screen
+            m_pendingTextures.clear();
+        }
+        m_scene = scene;
+        m_residentScene = nullptr;
+        deleteTextures(previous);
+        armFirstPixel();
+    }
+    deleteTextures(m_pendingTextures);
+    m_pendingScene.reset();
+    m_progressiveLoad = false;
+    m_sceneComplete = true;
+
+    m_readyTextures.clear();
+    if (m_scene) {
+        for (int i = 0; i < m_scene->textures.size(); ++i) {
+            m_readyTextures.insert(i);
+        }
+    }
     createTextures();
-    update();
+    restartRefinement();
+}
+
+void OneRenderer::beginProgressiveLoad() {
+    makeCurrent();
+    // A scene shown part way through a superseded load will never complete
+    if (m_scene && !m_sceneComplete) {
+        m_scene.reset();
+        m_readyTextures.clear();
+        createTextures();
+        deleteTextures(m_denseTextures);
+    }
+    deleteTextures(m_pendingTextures);
+    m_pendingScene.reset();
+    m_progressiveLoad = true;
+    m_firstPixelPending = false;
+    m_loadTimer.start();
+    restartRefinement();
+}
+
+void OneRenderer::textureReady(OneReader::SceneHandle scene, int textureIndex) {
+    if (!m_progressiveLoad || !scene) return;
+
+    makeCurrent();
+    if (!m_scene || m_scene == scene) {
+        // Nothing else on screen: show the new scene as it arrives
+        if (m_scene != scene) {
+            m_scene = scene;
+            m_residentScene = nullptr;
+            m_sceneComplete = false;
+            m_readyTextures.clear();
+            armFirstPixel();
+        }
+        m_readyTextures.insert(textureIndex);
+        createTextures();
+        restartRefinement();
+        return;
+    }
+
+    // Keep the current scene on screen and upload ahead of the swap
+    if (scene != m_pendingScene) {
+        deleteTextures(m_pendingTextures);
+        m_pendingScene = scene;
+    }
+    const OneReader::Texture& tex = scene->textures.at(textureIndex);
+    if (!tex.isBricked && !m_pendingTextures.contains(tex.id)) {
+        m_pendingTextures.insert(tex.id, uploadDenseTexture(scene, &tex));
+    }
+}
+
+void OneRenderer::armFirstPixel() {
+    // Only the first new scene after beginProgressiveLoad() is timed
+    if (m_loadTimer.isValid()) {
+        m_firstPixelPending = true;
+    }
 }
 
 void OneRenderer::toggleBounds(bool enable) {
     m_drawBounds = enable;
-    update();
+    restartRefinement();
 }
 
 void OneRenderer::setNestedMode(bool enable) {
     m_nestedMode = enable;
-    if (m_reader) {
+    if (m_scene) {
+        makeCurrent();
         createTextures();
     }
-    update();
+    restartRefinement();
 }
 
 void OneRenderer::setBackgroundColor(const QVector3D &color)
 {
     m_backgroundColor = color;
+    restartRefinement();
+}
+
+void OneRenderer::setEmptySpaceSkipping(bool enable) {
+    m_emptySpaceSkipping = enable;
+    restartRefinement();
+}
+
+void OneRenderer::setVolumeCulling(bool enable) {
+    m_volumeCulling = enable;
+    restartRefinement();
+}
+
+void OneRenderer::setFrontToBack(bool enable) {
+    m_frontToBack = enable;
+    restartRefinement();
+}
+
+void OneRenderer::setTerminationThreshold(float transmittance) {
+    m_terminationThreshold = qBound(0.0f, transmittance, 1.0f);
+    restartRefinement();
+}
+
+void OneRenderer::setAdaptiveSampling(bool enable) {
+    m_adaptiveSampling = enable;
+    restartRefinement();
+}
+
+void OneRenderer::setSamplingQuality(float quality) {
+    m_samplingQuality = qBound(0.1f, quality, 16.0f);
+    restartRefinement();
+}
+
+void OneRenderer::setProgressiveRefinement(bool enable) {
+    m_progressiveRefinement = enable;
+    if (!enable) {
+        makeCurrent();
+        m_interactiveFbo.reset();
+        m_frameFbo.reset();
+        m_accumFbo.reset();
+    }
+    restartRefinement();
+}
+
+void OneRenderer::setInteractiveScale(int scale) {
+    m_interactiveScale = qBound(1, scale, 8);
+    update();
+}
+
+void OneRenderer::setMipmapping(bool enable) {
+    m_mipmapping = enable;
+    restartRefinement();
+}
+
+void OneRenderer::setUploadBudget(int megabytes) {
+    m_uploadBudget = qint64(std::max(1, megabytes)) << 20;
+    update();
+}
+
+void OneRenderer::setStatsOverlay(bool enable) {
+    m_overlay->setVisible(enable);
+    m_overlayTimer.invalidate();
     update();
 }
 
@@ -62,7 +233,8 @@ void OneRenderer::initializeGL() {
     initializeOpenGLFunctions();
 
     // Load common vertex shader
-    QString vertSource = loadShaderSource(":/shaders/single.vert");
+    m_vertSource = loadShaderSource(":/shaders/single.vert");
+    const QString& vertSource = m_vertSource;
 
     // Load single fragment shader
     QString singleFragSource = loadShaderSource(":/shaders/single.frag");
@@ -76,17 +248,11 @@ void OneRenderer::initializeGL() {
         qDebug() << "Single shader link error:" << m_singleProgram.log();
     }
 
-    // Load nested fragment shader
-    QString nestedFragSource = loadShaderSource(":/shaders/nested.frag");
-    if (!m_nestedProgram.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSource)) {
-        qDebug() << "Nested vertex compile error:" << m_nestedProgram.log();
-    }
-    if (!m_nestedProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, nestedFragSource)) {
-        qDebug() << "Nested fragment shader compile error:" << m_nestedProgram.log();
-    }
-    if (!m_nestedProgram.link()) {
-        qDebug() << "Nested shader link error:" << m_nestedProgram.log();
-    }
+    // Load nested fragment shader; its variants are built from it on demand,
+    // starting with the one for any volume count
+    m_nestedFragSource = loadShaderSource(":/shaders/nested.frag");
+    m_nestedVariant = nestedVariantKey(0);
+    nestedProgram(m_nestedVariant);
 
     // Line shader (hardcoded as it's simple)
     QString lineVertSource = R"(
@@ -115,139 +281,250 @@ void main() {
         qDebug() << "Line shader link error:" << m_lineProgram.log();
     }
 
+    // Screen shader: one triangle over the whole target, for progressive refinement
+    QString screenVertSource = R"(
+#version 330
+out vec2 uv;
+void main() {
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0, 1);
+}
+)";
+    QString screenFragSource = R"(
+#version 330
+uniform sampler2D image;
+in vec2 uv;
+out vec4 fragColor;
+void main() {
+    fragColor = texture(image, uv);
+}
+)";
+    if (!m_screenProgram.addShaderFromSourceCode(QOpenGLShader::Vertex, screenVertSource)) {
+        qDebug() << "Screen vertex shader compile error:" << m_screenProgram.log();
+    }
+    if (!m_screenProgram.addShaderFromSourceCode(QOpenGLShader::Fragment, screenFragSource)) {
+        qDebug() << "Screen fragment shader compile error:" << m_screenProgram.log();
+    }
+    if (!m_screenProgram.link()) {
+        qDebug() << "Screen shader link error:" << m_screenProgram.log();
+    }
+    m_screenProgram.bind();
+    m_screenProgram.setUniformValue("image", 0);
+    m_screenProgram.release();
+
+    // Sampler units never change, so they are bound once here rather than every frame
+    m_singleProgram.bind();
+    m_singleProgram.setUniformValue("tex", 0);
+    m_singleProgram.setUniformValue("brickAtlas", 10);
+    m_singleProgram.setUniformValue("brickIndex", 11);
+    m_singleProgram.setUniformValue("brickSize", OneReader::Texture::kBrickSize);
+    m_singleProgram.setUniformValue("macroCells", 12);
+    m_singleProgram.setUniformValue("macroCellSize", OneReader::Texture::kMacroCellSize);
+    m_singleProgram.release();
+
+    for (TimerQuery& timer : m_timerQueries) {
+        glGenQueries(1, &timer.volume);
+        glGenQueries(1, &timer.bounds);
+    }
+
     setupCubeGeometry();
     setupBoundLines();
 }
 
+// Variant of nested.frag for the given number of volume slots. Only counts of a
+// complete scene whose volumes all have a slot are exact; while a scene loads
+// the count changes, so it is left open.
+quint32 OneRenderer::nestedVariantKey(int volumeCount) const {
+    if (volumeCount > kMaxSpecializedVolumes) volumeCount = 0;
+    return static_cast<quint32>(volumeCount);
+}
+
+// The cached program for a variant, compiled with its volume count as a
+// #define after the #version line the first time it is asked for. Scenes carry
+// no emitters or star textures and texture normalization stays off, so those
+// paths are always compiled out.
+QOpenGLShaderProgram& OneRenderer::nestedProgram(quint32 key) {
+    auto it = m_nestedVariants.find(key);
+    if (it != m_nestedVariants.end()) return *it->second;
+
+    QElapsedTimer timer;
+    timer.start();
+    const QString defines = QString("#define TEXTURE_NORMALIZE 0\n#define SCATTERING 0\n#define STARS 0\n"
+                                    "#define VOLUME_COUNT %1\n")
+                                .arg(key);
+    QString fragSource = m_nestedFragSource;
+    fragSource.insert(fragSource.indexOf('\n') + 1, defines);
+
+    std::unique_ptr<QOpenGLShaderProgram> prog(new QOpenGLShaderProgram);
+    if (!prog->addShaderFromSourceCode(QOpenGLShader::Vertex, m_vertSource)) {
+        qDebug() << "Nested vertex compile error:" << prog->log();
+    }
+    if (!prog->addShaderFromSourceCode(QOpenGLShader::Fragment, fragSource)) {
+        qDebug() << "Nested fragment shader compile error:" << prog->log();
+    }
+    if (!prog->link()) {
+        qDebug() << "Nested shader link error:" << prog->log();
+    }
+
+    // Sampler units never change, so they are bound once here rather than every frame
+    prog->bind();
+    for (int i = 0; i < kMaxDenseTextures; ++i) {
+        prog->setUniformValue(QString("textures[%1]").arg(i).toUtf8().constData(), i);
+    }
+    prog->setUniformValue("brickAtlas", 10);
+    prog->setUniformValue("brickIndex", 11);
+    prog->setUniformValue("brickSize", OneReader::Texture::kBrickSize);
+    prog->setUniformValue("macroCells", 12);
+    prog->setUniformValue("macroCellSize", OneReader::Texture::kMacroCellSize);
+    prog->setUniformValue("volumeParams", 13);
+    prog->setUniformValue("tileVolumes", 14);
+    prog->setUniformValue("tileSize", kTileSize);
+    prog->release();
+
+    qDebug() << "Nested shader variant" << defines.simplified() << "built in" << timer.nsecsElapsed() / 1e6 << "ms";
+    return *m_nestedVariants.emplace(key, std::move(prog)).first->second;
+}
+
 void OneRenderer::resizeGL(int w, int h) {
+    m_refineFrame = 0;
     glViewport(0, 0, w, h);
-    m_projMatrix.setToIdentity();
-    m_projMatrix.perspective(45.0f, static_cast<float>(w) / h, 0.1f, 100.0f);
+    m_projMatrix = OneView::projectionMatrix(QSize(w, h));
 }
 
 void OneRenderer::paintGL() {
+    QElapsedTimer cpuTimer;
+    cpuTimer.start();
+    m_setupNs = 0;
+    collectTimerQueries();
+
+    // Stream queued texture uploads, within the per frame budget
+    QElapsedTimer uploadTimer;
+    uploadTimer.start();
+    const bool advanced = pumpUploads(m_uploadBudget, false);
+    if (advanced) {
+        updateResidency();
+        m_refineFrame = 0;
+    }
+    m_uploadNs += uploadTimer.nsecsElapsed();
+    if (!m_uploadJobs.isEmpty() || std::any_of(std::begin(m_uploadSlots), std::end(m_uploadSlots),
+                                               [](const UploadSlot& slot) { return slot.mapped != nullptr; })) {
+        update();
+    } else if (m_uploadSummaryPending) {
+        m_uploadSummaryPending = false;
+        size_t residentBytes = 0;
+        for (const ResidentTexture& resident : m_denseTextures) {
+            residentBytes += resident.bytes;
+        }
+        qDebug() << "Texture upload:" << (m_uploadedBytes - m_reportedUploadBytes) / 1048576.0 << "MB sent, resident"
+                 << m_denseTextures.size() << "textures" << residentBytes / 1048576.0 << "MB";
+        m_reportedUploadBytes = m_uploadedBytes;
+    }
+
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    if (!m_reader || m_reader->volumes.isEmpty()) return;
+    if (!m_scene || m_scene->volumes.isEmpty()) return;
 
     glDepthMask(GL_FALSE);
     glDisable(GL_DEPTH_TEST);
 
-    QOpenGLShaderProgram& prog = m_nestedMode ? m_nestedProgram : m_singleProgram;
-    prog.bind();
-
-    QVector3D cameraPos = m_rotation.rotatedVector(QVector3D(0, 0, -m_distance));
-    QVector3D up = m_rotation.rotatedVector(QVector3D(0, 1, 0));
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.lookAt(cameraPos, QVector3D(0, 0, 0), up);
-
+    m_viewMatrix = OneView::viewMatrix(m_rotation, m_distance);
     QMatrix4x4 vp = m_projMatrix * m_viewMatrix;
-    prog.setUniformValue("viewProjectionMatrix", vp);
-    QMatrix4x4 invView = m_viewMatrix.inverted();
-    prog.setUniformValue("inverseViewMatrix", invView);
-
-    float globalJScale = m_reader->scene.params.value("EMISSION", "1.0").toFloat();
-    float globalKScale = m_reader->scene.params.value("OPACITY", "600.0").toFloat();
-    prog.setUniformValue("jScale", globalJScale);
-    prog.setUniformValue("kScale", globalKScale);
-
-    QMatrix4x4 trans[10];
-    QMatrix4x4 itrans[10];
-    float tj[10];
-    float tk[10];
-    float tb[10];
-    int tr[10];
 
-    for (int i = 0; i < 10; ++i) {
-        trans[i].setToIdentity();
-        itrans[i].setToIdentity();
-        tj[i] = 1.0f;
-        tk[i] = 1.0f;
-        tb[i] = 0.0f;
-        tr[i] = 0;
+    // This frame's timer queries, unless they are still busy from a few frames back
+    TimerQuery& timer = m_timerQueries[m_nextTimerQuery];
+    const bool timing = timer.frame < 0;
+    if (timing) {
+        timer.frame = m_sampledFrames;
+        timer.boundsUsed = m_drawBounds;
+        m_nextTimerQuery = (m_nextTimerQuery + 1) % kTimerFrames;
+        glBeginQuery(GL_TIME_ELAPSED, timer.volume);
+    }
+    if (m_progressiveRefinement) {
+        renderProgressive();
+    } else {
+        drawVolume(m_projMatrix, 0.0f, framebufferSize());
+    }
+    if (timing) {
+        glEndQuery(GL_TIME_ELAPSED);
     }
 
-    QMatrix4x4 outerModel;
-    outerModel.setToIdentity();
-
-    if (m_nestedMode) {
-        prog.setUniformValue("numValidTextures", m_numTextures);
-
-        for (int i = 0; i < 10; ++i) {
-            int unit = i;
-            glActiveTexture(GL_TEXTURE0 + unit);
-            glBindTexture(GL_TEXTURE_3D, (i < m_numTextures) ? m_textures[i] : 0);
-            prog.setUniformValue(QString("textures[%1]").arg(i).toUtf8().constData(), unit);
+    if (m_drawBounds) {
+        if (timing) {
+            glBeginQuery(GL_TIME_ELAPSED, timer.bounds);
         }
-
+        m_lineProgram.bind();
+        m_lineProgram.setUniformValue("viewProjectionMatrix", vp);
         for (int j = 0; j < m_numTextures; ++j) {
+            m_lineProgram.setUniformValue("modelMatrix", m_nestedMode ? m_slotParams[j].inverseModel : m_singleModel);
+            glBindVertexArray(m_boundVAO);
+            glDrawArrays(GL_LINES, 0, 24);
+        }
+        glBindVertexArray(0);
+        m_lineProgram.release();
+        if (timing) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+    }
 
-            int idx = m_sortedVolumeIndices[j];
-            const auto& vol = m_reader->volumes[idx];
-            const auto& params = vol.params;
-
-            float sx = params.value("SCALE_X", "1.0").toFloat();
-            float sy = params.value("SCALE_Y", "1.0").toFloat();
-            float sz = params.value("SCALE_Z", "1.0").toFloat();
-            float ox = params.value("OFFSET_X", "0.0").toFloat();
-            float oy = params.value("OFFSET_Y", "0.0").toFloat();
-            float oz = params.value("OFFSET_Z", "0.0").toFloat();
-            float rx = params.value("ROT_X", "0.0").toFloat();
-            float ry = params.value("ROT_Y", "0.0").toFloat();
-            float rz = params.value("ROT_Z", "0.0").toFloat();
-
-            QMatrix4x4 model;
-            model.setToIdentity();
-            model.scale(1.0 / sx, 1.0 / sy, 1.0 / sz);
-            model.rotate(rx, 1.0f, 0.0f, 0.0f);
-            model.rotate(ry, 0.0f, 1.0f, 0.0f);
-            model.rotate(rz, 0.0f, 0.0f, 1.0f);
-            model.translate(-0.5 * ox, -0.5 * oy, -0.5 * oz);
-
-
-            //qDebug()<<params;
-            //qDebug()<<m_reader->scene.name<<m_reader->scene.params;
-            //qDebug()<<"vol"<<vol.id<<vol.params;
-            //auto* tex = m_reader->getTextureForVolume(m_reader->volumes[idx]);
-            //qDebug()<<"tex"<<tex->id<<tex->params;
-            //qDebug()<<"tex"<<tex->id<<tex->sizeX<<tex->sizeY<<tex->sizeZ;
-            //qDebug() << "Volume" << idx << "Transform:" << model;
-            //qDebug() << "Inverse Transform:" << model.inverted();
+    // CPU cost of issuing the frame; the GPU work itself is not waited for
+    FrameSample& sample = m_samples[m_sampledFrames % kStatsFrames];
+    sample = FrameSample();
+    sample.paintMs = cpuTimer.nsecsElapsed() / 1e6f;
+    sample.setupMs = m_setupNs / 1e6f;
+    sample.uploadMs = m_uploadNs / 1e6f;
+    sample.uploadBytes = m_uploadedBytes - m_sampledUploadBytes;
+    m_uploadNs = 0;
+    m_sampledUploadBytes = m_uploadedBytes;
+    if (++m_sampledFrames % kStatsFrames == 0) {
+        const FrameStats stats = frameStats();
+        qDebug() << "Frame stats over" << stats.frames << "frames (p50/p95 ms): paint" << stats.paintP50Ms
+                 << stats.paintP95Ms << "setup" << stats.setupP50Ms << stats.setupP95Ms << "GPU volume"
+                 << stats.volumeGpuP50Ms << stats.volumeGpuP95Ms << "GPU bounds" << stats.boundsGpuP50Ms
+                 << stats.boundsGpuP95Ms << "upload" << stats.uploadMB << "MB in" << stats.uploadMs << "ms";
+    }
+    if (m_overlay->isVisible() && (!m_overlayTimer.isValid() || m_overlayTimer.elapsed() >= 250)) {
+        updateOverlay();
+    }
 
+    if (m_firstPixelPending && std::any_of(m_brickInfo.begin(), m_brickInfo.end(),
+                                           [](const BrickInfo& info) { return info.bricked >= 0; })) {
+        m_firstPixelPending = false;
+        qDebug() << "Time to first pixel:" << m_loadTimer.elapsed() << "ms";
+        m_loadTimer.invalidate();
+    }
+}
 
-            trans[j] = model;
-            itrans[j] = model.inverted();
+// Raymarches the scene into the bound framebuffer
+void OneRenderer::drawVolume(const QMatrix4x4& projection, float rayJitter, const QSize& target) {
+    QElapsedTimer setupTimer;
+    setupTimer.start();
+    QOpenGLShaderProgram& prog = m_nestedMode ? nestedProgram(m_nestedVariant) : m_singleProgram;
+    prog.bind();
 
-            tj[j] = params.value("EMISSION","1.0").toFloat();
-            tk[j] = params.value("OPACITY","1.0").toFloat();
+    prog.setUniformValue("viewProjectionMatrix", projection * m_viewMatrix);
+    QMatrix4x4 invView = m_viewMatrix.inverted();
+    prog.setUniformValue("inverseViewMatrix", invView);
 
-            tb[j] = params.value("BLEND", "0.0").toFloat();
-            tr[j] = (params.value("REPLACE", "false").toLower() == "true") ? 1 : 0;
+    prog.setUniformValue("jScale", m_scene->scene.emission);
+    prog.setUniformValue("kScale", m_scene->scene.opacity);
+    prog.setUniformValue("frontToBack", m_frontToBack ? 1 : 0);
+    prog.setUniformValue("terminationThreshold", m_terminationThreshold);
+    prog.setUniformValue("adaptiveSampling", m_adaptiveSampling ? 1 : 0);
+    prog.setUniformValue("samplingQuality", m_samplingQuality);
+    prog.setUniformValue("rayJitter", rayJitter);
+    prog.setUniformValue("mipmapping", m_mipmapping ? 1 : 0);
+    prog.setUniformValue("pixelAngle", OneView::pixelAngle(target.height()));
 
+    if (m_nestedMode) {
+        prog.setUniformValue("numValidTextures", m_numTextures);
 
-            //qDebug()<<"jScale"<<tj[j];
-            //qDebug()<<"kScale"<<tk[j];
+        // Per volume transforms and factors come from the volumeParams buffer
+        for (int i = 0; i < kMaxDenseTextures; ++i) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_3D, m_textures[i]);
         }
 
-        int loc_trans = prog.uniformLocation("texture_transform");
-        prog.setUniformValueArray(loc_trans, trans, 10);
-
-        int loc_itrans = prog.uniformLocation("texture_iTransform");
-        prog.setUniformValueArray(loc_itrans, itrans, 10);
-
-        int loc_tj = prog.uniformLocation("texture_jscale");
-        prog.setUniformValueArray(loc_tj, tj, 10, 1);
-
-        int loc_tk = prog.uniformLocation("texture_kscale");
-        prog.setUniformValueArray(loc_tk, tk, 10, 1);
-
-        int loc_tb = prog.uniformLocation("texture_blend");
-        prog.setUniformValueArray(loc_tb, tb, 10, 1);
-
-        int loc_tr = prog.uniformLocation("texture_replace");
-        prog.setUniformValueArray(loc_tr, tr, 10);
-
         // Set normalization uniforms based on first texture
         int normalize = 0;
         float norm_grey = 1.0f;
@@ -256,7 +533,7 @@ void OneRenderer::paintGL() {
         /*if (m_numTextures > 0) {
             for (int j = 4; j < m_numTextures; ++j) { // Her texture için, ama uniform global, max al veya first
                 int idx = m_sortedVolumeIndices[j];
-                auto* tex = m_reader->getTextureForVolume(m_reader->volumes[idx]);
+                auto* tex = m_scene->getTextureForVolume(m_scene->volumes[idx]);
                 if (tex && tex->isFloat) {
                     normalize = 1;
                     norm_grey = std::max(norm_grey, tex->params.value("MAX_GREY", "1.0").toFloat());
@@ -276,69 +553,530 @@ void OneRenderer::paintGL() {
         prog.setUniformValue("texture_norm_alpha", norm_alpha);
         prog.setUniformValue("texture_norm_exp", norm_exp);
 
+        setBrickUniforms(prog);
+
+        bool culling = m_volumeCulling && uploadTileVolumes(projection * m_viewMatrix, target);
+        prog.setUniformValue("volumeCulling", culling ? 1 : 0);
+        if (culling) {
+            glActiveTexture(GL_TEXTURE0 + 14);
+            glBindTexture(GL_TEXTURE_BUFFER, m_tileVolumeTexture);
+            glActiveTexture(GL_TEXTURE0);
+            glUniform2iv(prog.uniformLocation("tileCount"), 1, m_tileCount);
+        }
+
         prog.setUniformValue("numEmitters", 0);
         prog.setUniformValue("star_brightness", 0.0f);
         prog.setUniformValue("backgroundColor", m_backgroundColor);
 
-        float exposure = m_reader->scene.params.value("EXPOSURE").toFloat() / 2.0;
-        prog.setUniformValue("exposure", exposure);
+        prog.setUniformValue("exposure", m_scene->scene.exposure / 2.0f);
     }
     else {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_3D, m_textures[0]);
-        prog.setUniformValue("tex", 0);
+        setBrickUniforms(prog);
+
+        prog.setUniformValue("jScale", m_singleEmission);
+        prog.setUniformValue("kScale", m_singleOpacity);
+    }
+    m_setupNs += setupTimer.nsecsElapsed();
+
+    glBindVertexArray(m_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(0);
+    prog.release();
+}
 
-        if (!m_reader->volumes.isEmpty()) {
-            const auto& vol = m_reader->volumes[0];
-            const auto& params = vol.params;
+// Halton low-discrepancy sequence, in [0, 1)
+static float halton(int index, int base) {
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= base;
+        result += fraction * (index % base);
+        index /= base;
+    }
+    return result;
+}
 
-            float jScaleVol = params.value("EMISSION", QString::number(globalJScale)).toFloat();
-            float kScaleVol = params.value("OPACITY", QString::number(globalKScale)).toFloat();
-            prog.setUniformValue("jScale", jScaleVol);
-            prog.setUniformValue("kScale", kScaleVol);
+// Draws the volume through offscreen buffers. While the camera moves it is
+// drawn at reduced resolution and scaled up. Once input stops, full resolution
+// frames with jittered pixel and ray offsets are averaged, one per paint,
+// until m_refineFrames are in.
+void OneRenderer::renderProgressive() {
+    const QSize full = framebufferSize();
+    const GLuint screen = defaultFramebufferObject();
+
+    if (m_interacting) {
+        const QSize reduced((full.width() + m_interactiveScale - 1) / m_interactiveScale,
+                            (full.height() + m_interactiveScale - 1) / m_interactiveScale);
+        if (!ensureFramebuffer(m_interactiveFbo, reduced)) {
+            drawVolume(m_projMatrix, 0.0f, full);
+            return;
+        }
+        m_interactiveFbo->bind();
+        glViewport(0, 0, reduced.width(), reduced.height());
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawVolume(m_projMatrix, 0.0f, reduced);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, screen);
+        glViewport(0, 0, full.width(), full.height());
+        drawScreenTexture(m_interactiveFbo->texture());
+        m_refineFrame = 0;
+        return;
+    }
 
-            float sx = 1.0 / params.value("SCALE_X", "1.0").toFloat();
-            float sy = 1.0 / params.value("SCALE_Y", "1.0").toFloat();
-            float sz = 1.0 / params.value("SCALE_Z", "1.0").toFloat();
-            float ox = -0.5 * params.value("OFFSET_X", "0.0").toFloat();
-            float oy = -0.5 * params.value("OFFSET_Y", "0.0").toFloat();
-            float oz = -0.5 * params.value("OFFSET_Z", "0.0").toFloat();
-            float rx = params.value("ROT_X", "0.0").toFloat();
-            float ry = params.value("ROT_Y", "0.0").toFloat();
-            float rz = params.value("ROT_Z", "0.0").toFloat();
+    if (!ensureFramebuffer(m_frameFbo, full) || !ensureFramebuffer(m_accumFbo, full)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, screen);
+        drawVolume(m_projMatrix, 0.0f, full);
+        return;
+    }
 
-            outerModel.scale(sx, sy, sz);
-            outerModel.rotate(rx, 1.0f, 0.0f, 0.0f);
-            outerModel.rotate(ry, 0.0f, 1.0f, 0.0f);
-            outerModel.rotate(rz, 0.0f, 0.0f, 1.0f);
-            outerModel.translate(ox, oy, oz);
+    if (m_refineFrame < m_refineFrames) {
+        // The first frame is the plain render; later ones move the pixel centre
+        // within the pixel and the first sample along the ray
+        QMatrix4x4 projection = m_projMatrix;
+        float rayJitter = 0.0f;
+        if (m_refineFrame > 0) {
+            QMatrix4x4 pixelJitter;
+            pixelJitter.translate(2.0f * (halton(m_refineFrame, 2) - 0.5f) / full.width(),
+                                  2.0f * (halton(m_refineFrame, 3) - 0.5f) / full.height(), 0.0f);
+            projection = pixelJitter * m_projMatrix;
+            rayJitter = halton(m_refineFrame, 5);
+        }
 
+        m_frameFbo->bind();
+        glViewport(0, 0, full.width(), full.height());
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawVolume(projection, rayJitter, full);
+
+        // Running average: frame n goes in with weight 1/(n+1)
+        m_accumFbo->bind();
+        glEnable(GL_BLEND);
+        glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / (m_refineFrame + 1));
+        glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        drawScreenTexture(m_frameFbo->texture());
+        glDisable(GL_BLEND);
+
+        if (++m_refineFrame < m_refineFrames) {
+            update();
         }
     }
 
-    glBindVertexArray(m_vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    prog.release();
+    glBindFramebuffer(GL_FRAMEBUFFER, screen);
+    glViewport(0, 0, full.width(), full.height());
+    drawScreenTexture(m_accumFbo->texture());
+}
 
-    if (m_drawBounds) {
-        m_lineProgram.bind();
-        m_lineProgram.setUniformValue("viewProjectionMatrix", vp);
-        for (int j = 0; j < m_numTextures; ++j) {
-            QMatrix4x4 model;
-            if (m_nestedMode) {
-                model = itrans[j];
-            } else {
-                model = outerModel;
+void OneRenderer::reportPrecisionError() {
+    if (!m_scene || m_scene->volumes.isEmpty()) return;
+    makeCurrent();
+
+    const QSize size = framebufferSize();
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    QOpenGLFramebufferObject fbo(size, format);
+    if (!fbo.isValid()) {
+        qDebug() << "Precision report needs a float framebuffer";
+        return;
+    }
+
+    auto render = [&](bool fullPrecision, std::vector<float>& pixels) {
+        if (fullPrecision != m_fullPrecision) {
+            m_fullPrecision = fullPrecision;
+            createTextures(); // Uploads the float textures again at the other precision
+        }
+        finishUploads();
+        fbo.bind();
+        glViewport(0, 0, size.width(), size.height());
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        drawVolume(m_projMatrix, 0.0f, size);
+        pixels.resize(static_cast<size_t>(size.width()) * size.height() * 4);
+        glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_FLOAT, pixels.data());
+    };
+
+    std::vector<float> image;
+    std::vector<float> reference;
+    render(false, image);
+    render(true, reference);
+    m_fullPrecision = false;
+    createTextures();
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    double sumSquares = 0.0;
+    float maxError = 0.0f;
+    float peak = 0.0f;
+    for (size_t i = 0; i < image.size(); ++i) {
+        if (i % 4 == 3) continue;
+        float error = std::abs(image[i] - reference[i]);
+        maxError = std::max(maxError, error);
+        peak = std::max(peak, std::abs(reference[i]));
+        sumSquares += double(error) * error;
+    }
+    double rms = std::sqrt(sumSquares / std::max<size_t>(1, image.size() / 4 * 3));
+    qDebug() << "Texture precision vs RGBA32F at" << size << ": max error" << maxError << "RMS" << rms
+             << "PSNR" << (rms > 0.0 && peak > 0.0f ? 20.0 * std::log10(peak / rms) : INFINITY) << "dB";
+    restartRefinement();
+}
+
+void OneRenderer::reportCpuRenderError() {
+    if (!m_scene || m_scene->volumes.isEmpty()) return;
+    if (!m_sceneComplete) {
+        qDebug() << "CPU renderer comparison needs a fully loaded scene";
+        return;
+    }
+    makeCurrent();
+
+    const QSize size = framebufferSize();
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    QOpenGLFramebufferObject fbo(size, format);
+    if (!fbo.isValid()) {
+        qDebug() << "CPU renderer comparison needs a float framebuffer";
+        return;
+    }
+
+    // The CPU renderer reads the 32-bit float data and tests every volume per
+    // ray, so the GL side does the same for a like for like comparison
+    const bool culling = m_volumeCulling;
+    m_volumeCulling = false;
+    m_fullPrecision = true;
+    createTextures();
+    finishUploads();
+    m_viewMatrix = OneView::viewMatrix(m_rotation, m_distance);
+    const QMatrix4x4 projection = OneView::projectionMatrix(size);
+
+    QElapsedTimer glTimer;
+    glTimer.start();
+    fbo.bind();
+    glViewport(0, 0, size.width(), size.height());
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    drawVolume(projection, 0.0f, size);
+    std::vector<float> reference(static_cast<size_t>(size.width()) * size.height() * 4);
+    glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_FLOAT, reference.data());
+    const qint64 glNsecs = glTimer.nsecsElapsed();
+
+    m_volumeCulling = culling;
+    m_fullPrecision = false;
+    createTextures();
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    OneCpuRenderer cpu;
+    OneCpuRenderer::Settings settings;
+    settings.size = size;
+    settings.viewMatrix = m_viewMatrix;
+    settings.projectionMatrix = projection;
+    settings.frontToBack = m_frontToBack;
+    settings.terminationThreshold = m_terminationThreshold;
+    settings.emptySpaceSkipping = m_emptySpaceSkipping;
+    settings.adaptiveSampling = m_adaptiveSampling;
+    settings.samplingQuality = m_samplingQuality;
+    settings.mipmapping = m_mipmapping;
+    settings.backgroundColor = m_backgroundColor;
+    settings.nestedMode = m_nestedMode;
+    std::vector<float> image;
+    cpu.render(*m_scene, settings, image);
+
+    // The readback is bottom row first, the CPU image top row first
+    double sumSquares = 0.0;
+    float maxError = 0.0f;
+    float peak = 0.0f;
+    const size_t rowValues = static_cast<size_t>(size.width()) * 4;
+    for (int y = 0; y < size.height(); ++y) {
+        const float* cpuRow = image.data() + static_cast<size_t>(size.height() - 1 - y) * rowValues;
+        const float* glRow = reference.data() + static_cast<size_t>(y) * rowValues;
+        for (size_t i = 0; i < rowValues; ++i) {
+            if (i % 4 == 3) continue;
+            float error = std::abs(cpuRow[i] - glRow[i]);
+            maxError = std::max(maxError, error);
+            peak = std::max(peak, std::abs(glRow[i]));
+            sumSquares += double(error) * error;
+        }
+    }
+    double rms = std::sqrt(sumSquares / std::max<size_t>(1, image.size() / 4 * 3));
+    qDebug() << "CPU renderer vs GL at" << size << ": max error" << maxError << "RMS" << rms
+             << "PSNR" << (rms > 0.0 && peak > 0.0f ? 20.0 * std::log10(peak / rms) : INFINITY) << "dB;"
+             << cpu.lastStats().raysPerSecond() / 1e6 << "Mrays/s on" << cpu.lastStats().threads << "threads,"
+             << cpu.lastStats().nsecs / 1e6 << "ms vs" << glNsecs / 1e6 << "ms on the GPU";
+    restartRefinement();
+}
+
+void OneRenderer::reportCullingError() {
+    if (!m_scene || m_scene->volumes.isEmpty()) return;
+    if (!m_nestedMode || !m_sceneComplete) {
+        qDebug() << "Culling comparison needs a fully loaded scene in nested mode";
+        return;
+    }
+    makeCurrent();
+
+    const QSize size = framebufferSize();
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    QOpenGLFramebufferObject fbo(size, format);
+    if (!fbo.isValid()) {
+        qDebug() << "Culling comparison needs a float framebuffer";
+        return;
+    }
+
+    finishUploads();
+    const QMatrix4x4 projection = OneView::projectionMatrix(size);
+    auto render = [&](bool culling, std::vector<float>& pixels) {
+        m_volumeCulling = culling;
+        fbo.bind();
+        glViewport(0, 0, size.width(), size.height());
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        drawVolume(projection, 0.0f, size);
+        pixels.resize(static_cast<size_t>(size.width()) * size.height() * 4);
+        glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_FLOAT, pixels.data());
+    };
+
+    // The current view and the six axis views around it, so volumes away from
+    // the centre land in different tiles
+    const bool culling = m_volumeCulling;
+    const QMatrix4x4 viewMatrix = m_viewMatrix;
+    const QQuaternion views[7] = {
+        QQuaternion(),
+        QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 90.0f),
+        QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 180.0f),
+        QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 270.0f),
+        QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, 90.0f),
+        QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, -90.0f),
+        QQuaternion::fromAxisAndAngle(1.0f, 1.0f, 0.0f, 45.0f),
+    };
+    float maxError = 0.0f;
+    size_t changedPixels = 0;
+    std::vector<float> culled;
+    std::vector<float> reference;
+    for (const QQuaternion& view : views) {
+        m_viewMatrix = OneView::viewMatrix(m_rotation * view, m_distance);
+        render(true, culled);
+        render(false, reference);
+        for (size_t i = 0; i < culled.size(); i += 4) {
+            float error = 0.0f;
+            for (size_t c = 0; c < 3; ++c) {
+                error = std::max(error, std::abs(culled[i + c] - reference[i + c]));
             }
-            m_lineProgram.setUniformValue("modelMatrix", model);
-            glBindVertexArray(m_boundVAO);
-            glDrawArrays(GL_LINES, 0, 24);
+            maxError = std::max(maxError, error);
+            changedPixels += error > 0.0f ? 1 : 0;
         }
-        glBindVertexArray(0);
-        m_lineProgram.release();
     }
+    m_volumeCulling = culling;
+    m_viewMatrix = viewMatrix;
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    qDebug() << "Volume culling vs all volumes over" << int(sizeof(views) / sizeof(views[0])) << "views at" << size
+             << ": max error" << maxError << "in" << changedPixels << "differing pixels";
+    restartRefinement();
+}
+
+std::vector<double> OneRenderer::timeViews(const QVector<QMatrix4x4>& views, const QSize& size) {
+    std::vector<double> times;
+    if (!m_scene || m_scene->volumes.isEmpty() || !m_sceneComplete) return times;
+    makeCurrent();
+
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    QOpenGLFramebufferObject fbo(size, format);
+    if (!fbo.isValid()) return times;
+
+    finishUploads();
+    const QMatrix4x4 projection = OneView::projectionMatrix(size);
+    const QMatrix4x4 viewMatrix = m_viewMatrix;
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    fbo.bind();
+    glViewport(0, 0, size.width(), size.height());
+    glDisable(GL_DEPTH_TEST);
+    for (const QMatrix4x4& view : views) {
+        m_viewMatrix = view;
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        drawVolume(projection, 0.0f, size);
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 nsecs = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nsecs); // Waits for the draw
+        times.push_back(nsecs / 1e6);
+    }
+    glDeleteQueries(1, &query);
+    m_viewMatrix = viewMatrix;
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    restartRefinement();
+    return times;
+}
+
+// Value below which the given fraction of the values lie; -1 for no values
+static double percentile(std::vector<float> values, double fraction) {
+    if (values.empty()) return -1.0;
+    const size_t rank = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+OneRenderer::FrameStats OneRenderer::frameStats() const {
+    FrameStats stats;
+    stats.frames = static_cast<int>(std::min<qint64>(m_sampledFrames, kStatsFrames));
+    std::vector<float> paint, setup, volumeGpu, boundsGpu;
+    qint64 uploadBytes = 0;
+    for (int i = 0; i < stats.frames; ++i) {
+        const FrameSample& sample = m_samples[i];
+        paint.push_back(sample.paintMs);
+        setup.push_back(sample.setupMs);
+        if (sample.volumeGpuMs >= 0.0f) volumeGpu.push_back(sample.volumeGpuMs);
+        if (sample.boundsGpuMs >= 0.0f) boundsGpu.push_back(sample.boundsGpuMs);
+        uploadBytes += sample.uploadBytes;
+        stats.uploadMs += sample.uploadMs;
+    }
+    stats.paintP50Ms = std::max(0.0, percentile(paint, 0.5));
+    stats.paintP95Ms = std::max(0.0, percentile(paint, 0.95));
+    stats.setupP50Ms = std::max(0.0, percentile(setup, 0.5));
+    stats.setupP95Ms = std::max(0.0, percentile(setup, 0.95));
+    stats.volumeGpuP50Ms = percentile(volumeGpu, 0.5);
+    stats.volumeGpuP95Ms = percentile(volumeGpu, 0.95);
+    stats.boundsGpuP50Ms = percentile(boundsGpu, 0.5);
+    stats.boundsGpuP95Ms = percentile(boundsGpu, 0.95);
+    stats.uploadMB = uploadBytes / 1048576.0;
+
+    size_t residentBytes = m_atlasBytes + m_macroCellBytes;
+    for (const TextureResidency& texture : textureResidency()) {
+        residentBytes += texture.bytes;
+        ++stats.residentTextures;
+    }
+    stats.residentMB = residentBytes / 1048576.0;
+    return stats;
+}
 
+QVector<OneRenderer::TextureResidency> OneRenderer::textureResidency() const {
+    QVector<TextureResidency> textures;
+    auto add = [&textures](const QMap<qint64, ResidentTexture>& resident, bool pending) {
+        for (auto it = resident.begin(); it != resident.end(); ++it) {
+            TextureResidency texture;
+            texture.id = it.key();
+            texture.bytes = it->bytes;
+            texture.precision = it->precision;
+            texture.levels = it->levels;
+            texture.baseLevel = it->baseLevel;
+            texture.streaming = it->streaming;
+            texture.pending = pending;
+            textures << texture;
+        }
+    };
+    add(m_denseTextures, false);
+    add(m_pendingTextures, true);
+    return textures;
+}
+
+// Reads back the timer queries that have finished into their frames' samples.
+// Results arrive in issue order, so a set is done once its last query is.
+void OneRenderer::collectTimerQueries() {
+    for (TimerQuery& timer : m_timerQueries) {
+        if (timer.frame < 0) continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(timer.boundsUsed ? timer.bounds : timer.volume, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 volumeNs = 0;
+        GLuint64 boundsNs = 0;
+        glGetQueryObjectui64v(timer.volume, GL_QUERY_RESULT, &volumeNs);
+        if (timer.boundsUsed) {
+            glGetQueryObjectui64v(timer.bounds, GL_QUERY_RESULT, &boundsNs);
+        }
+        // A sample already overwritten by a newer frame keeps that frame's values
+        if (m_sampledFrames - timer.frame < kStatsFrames) {
+            FrameSample& sample = m_samples[timer.frame % kStatsFrames];
+            sample.volumeGpuMs = volumeNs / 1e6f;
+            sample.boundsGpuMs = timer.boundsUsed ? boundsNs / 1e6f : -1.0f;
+        }
+        timer.frame = -1;
+    }
+}
+
+void OneRenderer::updateOverlay() {
+    m_overlayTimer.restart();
+    const FrameStats stats = frameStats();
+    auto times = [](double p50, double p95) {
+        return p50 < 0.0 ? QString("n/a") : QString("%1 / %2 ms").arg(p50, 0, 'f', 2).arg(p95, 0, 'f', 2);
+    };
+    int streaming = 0;
+    for (const TextureResidency& texture : textureResidency()) {
+        streaming += texture.streaming ? 1 : 0;
+    }
+    QString text = QString("p50 / p95 over %1 frames\n"
+                           "paint CPU   %2\n"
+                           "setup CPU   %3\n"
+                           "volume GPU  %4\n"
+                           "bounds GPU  %5\n"
+                           "upload      %6 MB in %7 ms\n"
+                           "resident    %8 textures, %9 MB (%10 streaming)")
+                       .arg(stats.frames)
+                       .arg(times(stats.paintP50Ms, stats.paintP95Ms))
+                       .arg(times(stats.setupP50Ms, stats.setupP95Ms))
+                       .arg(times(stats.volumeGpuP50Ms, stats.volumeGpuP95Ms))
+                       .arg(m_drawBounds ? times(stats.boundsGpuP50Ms, stats.boundsGpuP95Ms) : QString("off"))
+                       .arg(stats.uploadMB, 0, 'f', 1)
+                       .arg(stats.uploadMs, 0, 'f', 1)
+                       .arg(stats.residentTextures)
+                       .arg(stats.residentMB, 0, 'f', 1)
+                       .arg(streaming);
+    if (!m_atlasWarning.isEmpty()) {
+        text += "\n" + m_atlasWarning;
+    }
+    m_overlay->setText(text);
+    m_overlay->adjustSize();
+}
+
+bool OneRenderer::ensureFramebuffer(std::unique_ptr<QOpenGLFramebufferObject>& fbo, const QSize& size) {
+    if (!fbo || fbo->size() != size) {
+        QOpenGLFramebufferObjectFormat format;
+        format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+        format.setInternalTextureFormat(GL_RGBA16F); // Keeps the running average and HDR values
+        fbo.reset(new QOpenGLFramebufferObject(size, format));
+        if (!fbo->isValid()) {
+            qDebug() << "Offscreen framebuffer unavailable, progressive refinement off";
+            m_progressiveRefinement = false;
+            return false;
+        }
+        glBindTexture(GL_TEXTURE_2D, fbo->texture());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    return true;
+}
+
+// Covers the bound framebuffer with the texture, filtered linearly
+void OneRenderer::drawScreenTexture(GLuint texture) {
+    m_screenProgram.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindVertexArray(m_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_screenProgram.release();
+}
+
+QSize OneRenderer::framebufferSize() const {
+    return QSize(std::max(1, qRound(width() * devicePixelRatioF())), std::max(1, qRound(height() * devicePixelRatioF())));
+}
+
+void OneRenderer::beginInteraction() {
+    m_interacting = true;
+    m_refineFrame = 0;
+    m_idleTimer.start();
+}
+
+void OneRenderer::restartRefinement() {
+    m_refineFrame = 0;
+    update();
 }
 
 void OneRenderer::mousePressEvent(QMouseEvent *event) {
@@ -377,6 +1115,7 @@ void OneRenderer::mouseMoveEvent(QMouseEvent *event) {
         }
 
         m_lastMousePos = event->pos();
+        beginInteraction();
         update();
     }
 }
@@ -384,121 +1123,1046 @@ void OneRenderer::mouseMoveEvent(QMouseEvent *event) {
 void OneRenderer::wheelEvent(QWheelEvent *event) {
     m_distance *= std::pow(1.001f, -event->angleDelta().y());
     m_distance = std::clamp(m_distance, 0.1f, 10.0f);
+    beginInteraction();
     update();
 }
 
 void OneRenderer::createTextures() {
+    QElapsedTimer timer;
+    timer.start();
     m_numTextures = 0;
+    m_nestedVariant = nestedVariantKey(0);
     m_sortedVolumeIndices.clear();
 
-    for (int i = 0; i < 10; ++i) {
-        if (m_textures[i]) {
-            glDeleteTextures(1, &m_textures[i]);
-            m_textures[i] = 0;
-        }
+    for (int i = 0; i < kMaxDenseTextures; ++i) {
+        m_textures[i] = 0;
+    }
+    m_brickInfo.clear();
+    // The atlas and macro cells outlive mode switches; only a new scene drops them
+    if (m_scene.get() != m_residentScene) {
+        releaseBrickAtlas();
+        releaseMacroCells();
+        m_residentScene = m_scene.get();
     }
 
-    if (!m_reader || m_reader->volumes.isEmpty()) return;
+    if (!m_scene || m_scene->volumes.isEmpty()) {
+        updateSlotParams();
+        uploadVolumeParams();
+        m_uploadNs += timer.nsecsElapsed();
+        return;
+    }
 
     m_sortedVolumeIndices.clear();
+    QVector<const OneReader::Texture*> slotTextures;
 
     if (m_nestedMode) {
         std::vector<std::pair<int, int>> order_indices;
-        for (int i = 0; i < m_reader->volumes.size(); ++i) {
-            int order = m_reader->volumes[i].params.value("ORDER", "0").toInt();
+        for (int i = 0; i < m_scene->volumes.size(); ++i) {
+            int order = m_scene->volumes[i].order;
             order_indices.push_back({order, i});
         }
         // Sabit: Artan sıralama (düşük order dıştan içe)
         std::sort(order_indices.begin(), order_indices.end());
 
-        int num = qMin(10, static_cast<int>(order_indices.size()));
+        // Every volume gets a slot. The first kMaxDenseTextures dense textures
+        // get a sampler of their own; bricked textures and any further dense
+        // ones are sampled from the shared atlas instead. A dense texture still
+        // streaming to the GPU keeps its slot and unit, and reads as empty until
+        // updateResidency() binds it.
+        int denseUnits = 0;
+        int sceneSlots = 0; // Slots once every texture is ready
         m_numTextures = 0;
-        for (int j = 0; j < num; ++j) {
-            int idx = order_indices[j].second;
-            auto* tex = m_reader->getTextureForVolume(m_reader->volumes[idx]);
-            if (!tex) continue;
-
-            glGenTextures(1, &m_textures[m_numTextures]);
-            glBindTexture(GL_TEXTURE_3D, m_textures[m_numTextures]);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-            // PBO ile yükleme
-            GLuint pbo;
-            glGenBuffers(1, &pbo);
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-
-            if (tex->isFloat) {
-                size_t dataSize = tex->data.size() * sizeof(float);
-                glBufferData(GL_PIXEL_UNPACK_BUFFER, dataSize, nullptr, GL_STREAM_DRAW);
-                void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-                if (mapped) {
-                    memcpy(mapped, tex->data.data(), dataSize);
-                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-                }
-                glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, tex->sizeX, tex->sizeY, tex->sizeZ, 0, GL_RGBA, GL_FLOAT, nullptr);
-            } else {
-                size_t dataSize = tex->byteData.size() * sizeof(unsigned char);
-                glBufferData(GL_PIXEL_UNPACK_BUFFER, dataSize, nullptr, GL_STREAM_DRAW);
-                void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-                if (mapped) {
-                    memcpy(mapped, tex->byteData.data(), dataSize);
-                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-                }
-                glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, tex->sizeX, tex->sizeY, tex->sizeZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        for (const auto& entry : order_indices) {
+            int idx = entry.second;
+            int texIndex = m_scene->textureIndexForVolume(m_scene->volumes[idx]);
+            if (texIndex < 0) continue;
+            ++sceneSlots;
+            if (!m_readyTextures.contains(texIndex)) continue;
+            const OneReader::Texture* tex = &m_scene->textures.at(texIndex);
+
+            BrickInfo info;
+            if (!tex->isBricked && denseUnits < kMaxDenseTextures) {
+                GLuint texture = denseTexture(texIndex);
+                info.denseUnit = denseUnits;
+                info.bricked = texture ? 0 : -1;
+                m_textures[denseUnits++] = texture;
+                setChannelDecode(info, tex, !m_fullPrecision);
             }
-
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-            glDeleteBuffers(1, &pbo);
+            m_brickInfo << info;
+            slotTextures << tex;
 
             m_sortedVolumeIndices << idx;
             m_numTextures++;
         }
+
+        // The exact count variant only once all slots are in. Its program is
+        // built now, with the scene swap, rather than in the frame where the
+        // last texture finishes streaming.
+        const bool allSlots = m_sceneComplete && m_numTextures == sceneSlots;
+        m_nestedVariant = nestedVariantKey(allSlots ? m_numTextures : 0);
+        if (m_sceneComplete) {
+            nestedProgram(nestedVariantKey(sceneSlots));
+        }
     } else {
         m_numTextures = 1;
-        auto* tex = m_reader->getTextureForVolume(m_reader->volumes[0]);
-        if (tex) {
-            glGenTextures(1, &m_textures[0]);
-            glBindTexture(GL_TEXTURE_3D, m_textures[0]);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-            // PBO ile yükleme
-            GLuint pbo;
-            glGenBuffers(1, &pbo);
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-
-            if (tex->isFloat) {
-                size_t dataSize = tex->data.size() * sizeof(float);
-                glBufferData(GL_PIXEL_UNPACK_BUFFER, dataSize, nullptr, GL_STREAM_DRAW);
-                void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-                if (mapped) {
-                    memcpy(mapped, tex->data.data(), dataSize);
-                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-                }
-                glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, tex->sizeX, tex->sizeY, tex->sizeZ, 0, GL_RGBA, GL_FLOAT, nullptr);
+        int texIndex = m_scene->textureIndexForVolume(m_scene->volumes[0]);
+        if (texIndex >= 0 && m_readyTextures.contains(texIndex)) {
+            const OneReader::Texture* tex = &m_scene->textures.at(texIndex);
+            BrickInfo info;
+            if (!tex->isBricked) {
+                GLuint texture = denseTexture(texIndex);
+                info.denseUnit = 0;
+                info.bricked = texture ? 0 : -1;
+                m_textures[0] = texture;
+                setChannelDecode(info, tex, !m_fullPrecision);
+            }
+            m_brickInfo << info;
+            slotTextures << tex;
+            m_sortedVolumeIndices << 0;
+        }
+    }
+
+    createBrickAtlas(slotTextures);
+    createMacroCells(slotTextures);
+    updateSlotParams();
+    uploadVolumeParams();
+    m_uploadNs += timer.nsecsElapsed();
+}
+
+// Binds the dense textures whose coarsest level has streamed in since their
+// slot was made. Slots, atlas and macro cells stay as they are; only the
+// storage texel of each newly bound slot is rewritten.
+void OneRenderer::updateResidency() {
+    if (!m_scene) return;
+    for (int j = 0; j < m_brickInfo.size(); ++j) {
+        BrickInfo& info = m_brickInfo[j];
+        if (info.bricked >= 0 || info.denseUnit < 0) continue; // Only dense slots wait for a stream
+        const int texIndex = m_scene->textureIndexForVolume(m_scene->volumes[m_sortedVolumeIndices[j]]);
+        GLuint texture = denseTexture(texIndex);
+        if (!texture) continue;
+        info.bricked = 0;
+        m_textures[info.denseUnit] = texture;
+        if (m_volumeParamBuffer) {
+            GLfloat texel[4];
+            storageTexel(info, texel);
+            glBindBuffer(GL_TEXTURE_BUFFER, m_volumeParamBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, (static_cast<size_t>(j) * kVolumeTexels + 9) * sizeof(texel), sizeof(texel),
+                            texel);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+}
+
+void OneRenderer::updateSlotParams() {
+    m_slotParams.clear();
+    m_singleModel.setToIdentity();
+    m_singleEmission = 1.0f;
+    m_singleOpacity = 1.0f;
+
+    if (!m_scene || m_scene->volumes.isEmpty()) return;
+
+    for (int idx : m_sortedVolumeIndices) {
+        const OneReader::Volume& vol = m_scene->volumes[idx];
+        SlotParams slot;
+        slot.model = OneView::volumeModel(vol);
+        slot.inverseModel = slot.model.inverted();
+        slot.emission = vol.emission;
+        slot.opacity = vol.opacity;
+        slot.blend = vol.blend;
+        slot.replace = vol.replace;
+        m_slotParams << slot;
+    }
+
+    // Single mode shows the first volume, with the scene values as fallback
+    const OneReader::Volume& first = m_scene->volumes[0];
+    m_singleModel = OneView::volumeModel(first);
+    m_singleEmission = first.hasEmission ? first.emission : m_scene->scene.emission;
+    m_singleOpacity = first.hasOpacity ? first.opacity : m_scene->scene.opacity;
+}
+
+void OneRenderer::releaseTextures() {
+    deleteTextures(m_denseTextures);
+    deleteTextures(m_pendingTextures);
+    for (int i = 0; i < kMaxDenseTextures; ++i) {
+        m_textures[i] = 0;
+    }
+    releaseBrickAtlas();
+    releaseMacroCells();
+    releaseVolumeParams();
+    releaseTileVolumes();
+    releaseUploadBuffers();
+}
+
+void OneRenderer::deleteTextures(QMap<qint64, ResidentTexture>& textures) {
+    for (const ResidentTexture& resident : textures) {
+        cancelUploads(resident.texture);
+        glDeleteTextures(1, &resident.texture);
+    }
+    textures.clear();
+}
+
+// Precision a texture is uploaded at: what the loader converted float
+// textures to, unless full precision is forced
+OneReader::TexturePrecision OneRenderer::uploadPrecision(const OneReader::Texture* tex) const {
+    return (tex->isFloat && !m_fullPrecision) ? tex->gpuPrecision : OneReader::Float32Precision;
+}
+
+// The resident texture of m_scene, uploaded only if missing or held at another
+// precision. 0 until at least its coarsest level has streamed in.
+GLuint OneRenderer::denseTexture(int textureIndex) {
+    const OneReader::Texture* tex = &m_scene->textures.at(textureIndex);
+    auto it = m_denseTextures.find(tex->id);
+    if (it != m_denseTextures.end()) {
+        if (it->precision == uploadPrecision(tex)) {
+            return it->baseLevel >= 0 ? it->texture : 0;
+        }
+        cancelUploads(it->texture);
+        glDeleteTextures(1, &it->texture);
+        m_denseTextures.erase(it);
+    }
+    m_denseTextures.insert(tex->id, uploadDenseTexture(m_scene, tex));
+    return 0;
+}
+
+// Allocates the texture and queues its texels to stream in; the scene handle
+// keeps them alive until the last chunk is copied
+OneRenderer::ResidentTexture OneRenderer::uploadDenseTexture(const OneReader::SceneHandle& scene,
+                                                             const OneReader::Texture* tex) {
+    ResidentTexture resident;
+    resident.precision = uploadPrecision(tex);
+    resident.levels = static_cast<int>(tex->mips.size());
+    glGenTextures(1, &resident.texture);
+    glBindTexture(GL_TEXTURE_3D, resident.texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, resident.levels > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, resident.levels);
+
+    // Float textures go up at the precision the loader converted them to
+    GLenum internalFormat = GL_RGBA8;
+    GLenum type = GL_UNSIGNED_BYTE;
+    if (tex->isFloat && resident.precision == OneReader::Float16Precision) {
+        internalFormat = GL_RGBA16F;
+        type = GL_HALF_FLOAT;
+    } else if (tex->isFloat && resident.precision == OneReader::Float32Precision) {
+        internalFormat = GL_RGBA32F;
+        type = GL_FLOAT;
+    }
+
+    // Every level is allocated now; they stream coarsest first, so the volume
+    // shows blurred early and sharpens as finer levels arrive
+    for (int level = resident.levels; level >= 0; --level) {
+        const OneReader::Texture::MipLevel* mip = level > 0 ? &tex->mips[level - 1] : nullptr;
+        const void* texels = mip ? mip->byteData.data() : tex->byteTexels();
+        size_t dataSize = mip ? mip->byteData.size() : tex->valueCount();
+        if (tex->isFloat) {
+            if (resident.precision == OneReader::Float16Precision) {
+                texels = mip ? mip->halfTexels.data() : tex->halfTexels.data();
+                dataSize = (mip ? mip->halfTexels.size() : tex->halfTexels.size()) * sizeof(quint16);
+            } else if (resident.precision == OneReader::Scaled8Precision) {
+                texels = mip ? mip->scaledTexels.data() : tex->scaledTexels.data();
+                dataSize = mip ? mip->scaledTexels.size() : tex->scaledTexels.size();
             } else {
-                size_t dataSize = tex->byteData.size() * sizeof(unsigned char);
-                glBufferData(GL_PIXEL_UNPACK_BUFFER, dataSize, nullptr, GL_STREAM_DRAW);
-                void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-                if (mapped) {
-                    memcpy(mapped, tex->byteData.data(), dataSize);
-                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-                }
-                glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, tex->sizeX, tex->sizeY, tex->sizeZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                texels = mip ? mip->data.data() : tex->floatTexels(); // Straight from the .onec mapping when pre-baked
+                dataSize = (mip ? mip->data.size() : tex->valueCount()) * sizeof(float);
             }
+        }
 
+        UploadJob job;
+        job.texture = resident.texture;
+        job.level = level;
+        job.owner = scene;
+        job.texels = static_cast<const uchar*>(texels);
+        job.type = type;
+        job.sizeX = mip ? mip->sizeX : tex->sizeX;
+        job.sizeY = mip ? mip->sizeY : tex->sizeY;
+        job.sizeZ = mip ? mip->sizeZ : tex->sizeZ;
+        job.sliceBytes = dataSize / std::max(1, job.sizeZ);
+        glTexImage3D(GL_TEXTURE_3D, level, internalFormat, job.sizeX, job.sizeY, job.sizeZ, 0, GL_RGBA, type, nullptr);
+        m_uploadJobs << job;
+        resident.bytes += dataSize;
+    }
+    resident.streaming = true;
+    m_uploadSummaryPending = true;
+    update(); // paintGL() drives the upload
+    return resident;
+}
+
+// Allocates the bound 3D texture and fills it through the upload ring before returning
+void OneRenderer::uploadTexture3D(GLenum internalFormat, int sizeX, int sizeY, int sizeZ, GLenum type,
+                                  const void* texels) {
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_3D, &texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, sizeX, sizeY, sizeZ, 0, GL_RGBA, type, nullptr);
+
+    const size_t texelBytes = (type == GL_FLOAT ? 4 : type == GL_HALF_FLOAT ? 2 : 1) * 4;
+    UploadJob job;
+    job.texture = static_cast<GLuint>(texture);
+    job.texels = static_cast<const uchar*>(texels);
+    job.type = type;
+    job.sizeX = sizeX;
+    job.sizeY = sizeY;
+    job.sizeZ = sizeZ;
+    job.sliceBytes = static_cast<size_t>(sizeX) * sizeY * texelBytes;
+    while (job.nextZ < job.sizeZ) {
+        uploadNextChunk(job, true); // Copies on this thread, so texels are free on return
+    }
+    glBindTexture(GL_TEXTURE_3D, static_cast<GLuint>(texture));
+}
+
+// Hands the next slab of the job's slices to the next ring buffer. With wait
+// false it gives up, returning false, while that buffer is still busy; the
+// copy into the buffer then runs on a worker thread.
+bool OneRenderer::uploadNextChunk(UploadJob& job, bool wait) {
+    UploadSlot& slot = m_uploadSlots[m_nextUploadBuffer];
+    if (!acquireUploadSlot(slot, wait)) return false;
+    m_nextUploadBuffer = (m_nextUploadBuffer + 1) % kUploadBuffers;
+
+    const int depth = static_cast<int>(qBound<size_t>(1, kUploadChunkBytes / std::max<size_t>(1, job.sliceBytes),
+                                                      static_cast<size_t>(job.sizeZ - job.nextZ)));
+    const size_t bytes = job.sliceBytes * depth;
+    const uchar* source = job.texels + job.sliceBytes * job.nextZ;
+
+    if (!slot.buffer) {
+        glGenBuffers(1, &slot.buffer);
+    }
+    // PBO ile yükleme
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+    if (bytes > slot.bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        slot.bytes = bytes;
+    }
+    // The fence has signalled, so the GPU is done with the previous contents
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    slot.texture = job.texture;
+    slot.level = job.level;
+    slot.owner = job.owner;
+    slot.type = job.type;
+    slot.sizeX = job.sizeX;
+    slot.sizeY = job.sizeY;
+    slot.z = job.nextZ;
+    slot.depth = depth;
+    job.nextZ += depth;
+    m_uploadedBytes += bytes;
+
+    if (!mapped) {
+        // No mapping: straight from client memory
+        glBindTexture(GL_TEXTURE_3D, slot.texture);
+        glTexSubImage3D(GL_TEXTURE_3D, slot.level, 0, 0, slot.z, slot.sizeX, slot.sizeY, slot.depth, GL_RGBA, slot.type, source);
+        slot.owner.reset();
+        return true;
+    }
+    slot.mapped = mapped;
+    if (wait) {
+        memcpy(mapped, source, bytes);
+        submitUploadSlot(slot);
+    } else {
+        slot.copy = QtConcurrent::run([mapped, source, bytes]() {
+            memcpy(mapped, source, bytes);
+        });
+    }
+    return true;
+}
+
+// True once the slot's buffer may be written. A finished copy is submitted
+// first; with wait the pending copy and GPU read are waited for.
+bool OneRenderer::acquireUploadSlot(UploadSlot& slot, bool wait) {
+    if (slot.mapped) {
+        if (!wait && !slot.copy.isFinished()) return false;
+        slot.copy.waitForFinished();
+        submitUploadSlot(slot);
+    }
+    if (slot.fence) {
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        if (status == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+    return true;
+}
+
+// Unmaps a filled slot, copies it into its texture and fences the buffer
+void OneRenderer::submitUploadSlot(UploadSlot& slot) {
+    // Buffers grown past this are given back after the upload instead of kept
+    const size_t kMaxRetainedBytes = size_t(64) << 20;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        qDebug() << "Upload buffer lost its contents, slices" << slot.z << "to" << slot.z + slot.depth - 1 << "may be wrong";
+    }
+    if (slot.texture) {
+        glBindTexture(GL_TEXTURE_3D, slot.texture);
+        glTexSubImage3D(GL_TEXTURE_3D, slot.level, 0, 0, slot.z, slot.sizeX, slot.sizeY, slot.depth, GL_RGBA, slot.type, nullptr);
+    }
+    if (slot.bytes > kMaxRetainedBytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+        slot.bytes = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.mapped = nullptr;
+    slot.owner.reset();
+}
+
+// Streams queued textures, at most budget bytes. Returns true if a texture of
+// the scene on screen can now be drawn from a finer level than before.
+bool OneRenderer::pumpUploads(qint64 budget, bool wait) {
+    for (UploadSlot& slot : m_uploadSlots) {
+        if (slot.mapped && (wait || slot.copy.isFinished())) {
+            slot.copy.waitForFinished();
+            submitUploadSlot(slot);
+        }
+    }
+    while (!m_uploadJobs.isEmpty() && budget > 0) {
+        UploadJob& job = m_uploadJobs.first();
+        const int firstZ = job.nextZ;
+        if (!uploadNextChunk(job, wait)) break;
+        budget -= static_cast<qint64>(job.sliceBytes) * (job.nextZ - firstZ);
+        if (job.nextZ >= job.sizeZ) {
+            m_uploadJobs.removeFirst();
+        }
+    }
+    if (wait) {
+        for (UploadSlot& slot : m_uploadSlots) {
+            if (slot.mapped) {
+                slot.copy.waitForFinished();
+                submitUploadSlot(slot);
+            }
+        }
+    }
+
+    // Sampling starts at the finest level whose coarser levels are all in
+    auto advance = [this](ResidentTexture& resident) {
+        if (!resident.streaming) return false;
+        int level = resident.baseLevel >= 0 ? resident.baseLevel : resident.levels + 1;
+        while (level > 0 && !isUploading(resident.texture, level - 1)) {
+            --level;
+        }
+        if (level > resident.levels || level == resident.baseLevel) return false;
+        glBindTexture(GL_TEXTURE_3D, resident.texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, level);
+        resident.baseLevel = level;
+        resident.streaming = level > 0;
+        return true;
+    };
+    bool finished = false;
+    for (ResidentTexture& resident : m_denseTextures) {
+        finished = advance(resident) || finished;
+    }
+    for (ResidentTexture& resident : m_pendingTextures) {
+        advance(resident);
+    }
+    return finished;
+}
+
+// Completes every queued upload now, for renders that need all textures
+void OneRenderer::finishUploads() {
+    if (pumpUploads(std::numeric_limits<qint64>::max(), true)) {
+        updateResidency();
+    }
+}
+
+bool OneRenderer::isUploading(GLuint texture, int level) const {
+    for (const UploadJob& job : m_uploadJobs) {
+        if (job.texture == texture && job.level == level) return true;
+    }
+    for (const UploadSlot& slot : m_uploadSlots) {
+        if (slot.mapped && slot.texture == texture && slot.level == level) return true;
+    }
+    return false;
+}
+
+// Drops what is left of a texture's upload before the texture is deleted
+void OneRenderer::cancelUploads(GLuint texture) {
+    for (int i = m_uploadJobs.size() - 1; i >= 0; --i) {
+        if (m_uploadJobs[i].texture == texture) {
+            m_uploadJobs.removeAt(i);
+        }
+    }
+    for (UploadSlot& slot : m_uploadSlots) {
+        if (slot.texture == texture) {
+            slot.texture = 0; // The copy finishes, but into no texture
+        }
+    }
+}
+
+void OneRenderer::releaseUploadBuffers() {
+    m_uploadJobs.clear();
+    for (UploadSlot& slot : m_uploadSlots) {
+        if (slot.mapped) {
+            slot.copy.waitForFinished();
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
             glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-            glDeleteBuffers(1, &pbo);
+        }
+        if (slot.fence) {
+            glDeleteSync(slot.fence);
+        }
+        if (slot.buffer) {
+            glDeleteBuffers(1, &slot.buffer);
+        }
+        slot = UploadSlot();
+    }
+}
 
-            m_sortedVolumeIndices << 0;
+void OneRenderer::createBrickAtlas(const QVector<const OneReader::Texture*>& slotTextures) {
+    const int brick = OneReader::Texture::kBrickSize;
+    const int padded = brick + 2; // One texel apron on each side keeps linear filtering seamless
+
+    struct AtlasBrick {
+        const OneReader::Texture* tex;
+        int bx, by, bz;
+    };
+
+    // An empty brick still needs an atlas slot when filtering at its border
+    // reaches non-zero texels of a neighbouring brick.
+    auto apronHasData = [&](const OneReader::Texture* tex, int bx, int by, int bz) {
+        bool neighbour = false;
+        for (int dz = -1; dz <= 1 && !neighbour; ++dz)
+            for (int dy = -1; dy <= 1 && !neighbour; ++dy)
+                for (int dx = -1; dx <= 1 && !neighbour; ++dx)
+                    neighbour = tex->isBrickOccupied(bx + dx, by + dy, bz + dz);
+        if (!neighbour) return false;
+
+        float rgba[4];
+        for (int z = bz * brick - 1; z <= (bz + 1) * brick; ++z)
+            for (int y = by * brick - 1; y <= (by + 1) * brick; ++y)
+                for (int x = bx * brick - 1; x <= (bx + 1) * brick; ++x) {
+                    tex->texel(x, y, z, rgba);
+                    if (rgba[0] != 0.0f || rgba[1] != 0.0f || rgba[2] != 0.0f || rgba[3] != 0.0f) return true;
+                }
+        return false;
+    };
+
+    // A dense texture without a sampler of its own is cut into bricks here,
+    // which the reader's dense texture limit normally does while loading.
+    // Macro cells are dilated by the filter footprint, so a brick plus its
+    // apron holds data exactly when one of its macro cells is marked.
+    auto denseBrickHasData = [&](const OneReader::Texture* tex, int bx, int by, int bz) {
+        if (tex->macroCells.empty()) return true;
+        const int cellsPerBrick = brick / OneReader::Texture::kMacroCellSize;
+        for (int cz = bz * cellsPerBrick; cz < std::min(tex->macroZ, (bz + 1) * cellsPerBrick); ++cz)
+            for (int cy = by * cellsPerBrick; cy < std::min(tex->macroY, (by + 1) * cellsPerBrick); ++cy)
+                for (int cx = bx * cellsPerBrick; cx < std::min(tex->macroX, (bx + 1) * cellsPerBrick); ++cx)
+                    if (tex->macroCells[(static_cast<size_t>(cz) * tex->macroY + cy) * tex->macroX + cx]) return true;
+        return false;
+    };
+
+    // The atlas takes the widest precision of the float textures in it; byte
+    // textures fit any of them. Scaled bytes keep each texture's own decode.
+    QVector<int> atlasSlots;
+    OneReader::TexturePrecision precision = OneReader::Scaled8Precision;
+    for (int j = 0; j < slotTextures.size(); ++j) {
+        const OneReader::Texture* tex = slotTextures[j];
+        if (!tex || (!tex->isBricked && m_brickInfo[j].denseUnit >= 0)) continue;
+
+        atlasSlots << j;
+        if (tex->isFloat) {
+            precision = std::min(precision, uploadPrecision(tex));
+        }
+    }
+    if (atlasSlots.isEmpty()) return;
+
+    auto useLayout = [&](int j) {
+        const BrickInfo& layout = m_atlasLayout[slotTextures[j]->id];
+        BrickInfo& info = m_brickInfo[j];
+        info.bricked = layout.bricked;
+        info.base = layout.base;
+        std::copy(layout.count, layout.count + 3, info.count);
+        std::copy(layout.size, layout.size + 3, info.size);
+        setChannelDecode(info, slotTextures[j], precision == OneReader::Scaled8Precision);
+    };
+
+    // The resident atlas still serves if it holds every texture at this precision
+    bool resident = m_brickAtlas && precision == m_atlasPrecision;
+    for (int j : atlasSlots) {
+        resident = resident && m_atlasLayout.contains(slotTextures[j]->id);
+    }
+    if (resident) {
+        for (int j : atlasSlots) {
+            useLayout(j);
+        }
+        return;
+    }
+    const bool warned = !m_atlasWarning.isEmpty(); // Once per scene, not per arriving texture
+    releaseBrickAtlas();
+
+    std::vector<GLint> index;
+    std::vector<AtlasBrick> bricks;
+    std::vector<std::pair<qint64, size_t>> firstBricks; // Per texture in the atlas, in slot order
+    int denseBricked = 0;
+    for (int j : atlasSlots) {
+        const OneReader::Texture* tex = slotTextures[j];
+        if (m_atlasLayout.contains(tex->id)) continue; // Another volume shares the texture
+        firstBricks.push_back({tex->id, bricks.size()});
+        denseBricked += tex->isBricked ? 0 : 1;
+
+        BrickInfo info;
+        info.bricked = 1;
+        info.base = static_cast<GLint>(index.size());
+        info.count[0] = tex->isBricked ? tex->bricksX : (tex->sizeX + brick - 1) / brick;
+        info.count[1] = tex->isBricked ? tex->bricksY : (tex->sizeY + brick - 1) / brick;
+        info.count[2] = tex->isBricked ? tex->bricksZ : (tex->sizeZ + brick - 1) / brick;
+        info.size[0] = tex->sizeX;
+        info.size[1] = tex->sizeY;
+        info.size[2] = tex->sizeZ;
+
+        for (int bz = 0; bz < info.count[2]; ++bz) {
+            for (int by = 0; by < info.count[1]; ++by) {
+                for (int bx = 0; bx < info.count[0]; ++bx) {
+                    bool hasData = tex->isBricked
+                        ? tex->isBrickOccupied(bx, by, bz) || apronHasData(tex, bx, by, bz)
+                        : denseBrickHasData(tex, bx, by, bz);
+                    if (hasData) {
+                        index.push_back(static_cast<GLint>(bricks.size()));
+                        bricks.push_back({tex, bx, by, bz});
+                    } else {
+                        index.push_back(-1);
+                    }
+                }
+            }
+        }
+        m_atlasLayout.insert(tex->id, info);
+    }
+    if (denseBricked > 0) {
+        qDebug() << "Bricking" << denseBricked << "dense textures for the atlas on the GUI thread";
+    }
+
+    // More bricks than the 3D texture size limit holds: whole textures are left
+    // out, the last slots first, so the rest draw complete instead of every
+    // texture losing bricks. Their slots read as empty, and the user is told.
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+    const int perAxis = std::max(1, maxSize / padded);
+    const size_t capacity = static_cast<size_t>(perAxis) * perAxis * perAxis;
+    if (bricks.size() > capacity) {
+        const size_t needed = bricks.size();
+        QStringList dropped;
+        while (bricks.size() > capacity) {
+            const qint64 id = firstBricks.back().first;
+            BrickInfo& layout = m_atlasLayout[id];
+            const size_t entries = static_cast<size_t>(layout.count[0]) * layout.count[1] * layout.count[2];
+            std::fill(index.begin() + layout.base, index.begin() + layout.base + entries, -1);
+            layout.bricked = -1;
+            bricks.resize(firstBricks.back().second);
+            firstBricks.pop_back();
+            dropped.prepend(QString::number(id));
+        }
+        m_atlasWarning = QString("Brick atlas full: %1 bricks needed, %2 fit. Textures %3 are not drawn.")
+                             .arg(needed)
+                             .arg(capacity)
+                             .arg(dropped.join(", "));
+        qDebug() << m_atlasWarning;
+        if (!warned) {
+            emit renderWarning(m_atlasWarning);
+        }
+    }
+    for (int j : atlasSlots) {
+        useLayout(j);
+    }
+
+    // Lay the slots out as a roughly cubic grid within the 3D texture size limit
+    const int count = std::max<int>(1, static_cast<int>(bricks.size()));
+    int sx = std::min(perAxis, static_cast<int>(std::ceil(std::cbrt(static_cast<double>(count)))));
+    int sy = std::min(perAxis, (count + sx - 1) / sx);
+    int sz = (count + sx * sy - 1) / (sx * sy);
+    m_brickAtlasSlots[0] = sx;
+    m_brickAtlasSlots[1] = sy;
+    m_brickAtlasSlots[2] = sz;
+
+    const size_t atlasX = static_cast<size_t>(sx) * padded;
+    const size_t atlasY = static_cast<size_t>(sy) * padded;
+    const size_t atlasZ = static_cast<size_t>(sz) * padded;
+    const size_t texelCount = atlasX * atlasY * atlasZ;
+    std::vector<float> atlasFloat;
+    std::vector<qfloat16> atlasHalf;
+    std::vector<unsigned char> atlasByte;
+    size_t texelBytes = 4;
+    if (precision == OneReader::Float32Precision) {
+        atlasFloat.assign(texelCount * 4, 0.0f);
+        texelBytes = 16;
+    } else if (precision == OneReader::Float16Precision) {
+        atlasHalf.assign(texelCount * 4, qfloat16(0.0f));
+        texelBytes = 8;
+    } else {
+        atlasByte.assign(texelCount * 4, 0);
+    }
+
+    // Copy every brick plus its apron, clamping at the volume edges like GL_CLAMP_TO_EDGE
+    QVector<int> brickIds(static_cast<int>(bricks.size()));
+    std::iota(brickIds.begin(), brickIds.end(), 0);
+    QtConcurrent::blockingMap(brickIds, [&](int& slot) {
+        const AtlasBrick& b = bricks[slot];
+        const size_t ox = static_cast<size_t>(slot % sx) * padded;
+        const size_t oy = static_cast<size_t>((slot / sx) % sy) * padded;
+        const size_t oz = static_cast<size_t>(slot / (sx * sy)) * padded;
+        float rgba[4];
+        for (int pz = 0; pz < padded; ++pz) {
+            int z = qBound(0, b.bz * brick + pz - 1, b.tex->sizeZ - 1);
+            for (int py = 0; py < padded; ++py) {
+                int y = qBound(0, b.by * brick + py - 1, b.tex->sizeY - 1);
+                for (int px = 0; px < padded; ++px) {
+                    int x = qBound(0, b.bx * brick + px - 1, b.tex->sizeX - 1);
+                    b.tex->texel(x, y, z, rgba);
+                    size_t dst = (((oz + pz) * atlasY + (oy + py)) * atlasX + (ox + px)) * 4;
+                    if (precision == OneReader::Float32Precision) {
+                        std::copy(rgba, rgba + 4, &atlasFloat[dst]);
+                    } else if (precision == OneReader::Float16Precision) {
+                        qFloatToFloat16(&atlasHalf[dst], rgba, 4);
+                    } else {
+                        // Identity decode for byte textures
+                        for (int c = 0; c < 4; ++c) {
+                            float q = (rgba[c] - b.tex->channelBias[c]) / b.tex->channelScale[c] * 255.0f;
+                            atlasByte[dst + c] = static_cast<unsigned char>(qBound(0L, std::lround(q), 255L));
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    glGenTextures(1, &m_brickAtlas);
+    glBindTexture(GL_TEXTURE_3D, m_brickAtlas);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    if (precision == OneReader::Float32Precision) {
+        uploadTexture3D(GL_RGBA32F, atlasX, atlasY, atlasZ, GL_FLOAT, atlasFloat.data());
+    } else if (precision == OneReader::Float16Precision) {
+        uploadTexture3D(GL_RGBA16F, atlasX, atlasY, atlasZ, GL_HALF_FLOAT, atlasHalf.data());
+    } else {
+        uploadTexture3D(GL_RGBA8, atlasX, atlasY, atlasZ, GL_UNSIGNED_BYTE, atlasByte.data());
+    }
+    m_atlasPrecision = precision;
+
+    // Brick index as a buffer texture: atlas slot per brick, -1 when empty
+    glGenBuffers(1, &m_brickIndexBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_brickIndexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, index.size() * sizeof(GLint), index.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    m_uploadedBytes += index.size() * sizeof(GLint);
+    glGenTextures(1, &m_brickIndexTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_brickIndexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_brickIndexBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    m_atlasBytes = texelCount * texelBytes + index.size() * sizeof(GLint);
+    qDebug() << "Brick atlas:" << bricks.size() << "bricks in" << atlasX << "x" << atlasY << "x" << atlasZ
+             << "VRAM" << m_atlasBytes / 1048576.0 << "MB";
+}
+
+// Decode of a slot's texels in the shader: the texture's scale and bias when
+// they are stored as scaled bytes, identity otherwise
+void OneRenderer::setChannelDecode(BrickInfo& info, const OneReader::Texture* tex, bool scaled) {
+    for (int c = 0; c < 4; ++c) {
+        info.channelScale[c] = scaled ? tex->channelScale[c] : 1.0f;
+        info.channelBias[c] = scaled ? tex->channelBias[c] : 0.0f;
+    }
+}
+
+void OneRenderer::releaseBrickAtlas() {
+    if (m_brickAtlas) {
+        glDeleteTextures(1, &m_brickAtlas);
+        m_brickAtlas = 0;
+    }
+    if (m_brickIndexTexture) {
+        glDeleteTextures(1, &m_brickIndexTexture);
+        m_brickIndexTexture = 0;
+    }
+    if (m_brickIndexBuffer) {
+        glDeleteBuffers(1, &m_brickIndexBuffer);
+        m_brickIndexBuffer = 0;
+    }
+    m_atlasBytes = 0;
+    m_atlasLayout.clear();
+    m_atlasWarning.clear();
+}
+
+// Holds the grids of all ready textures of the scene, not just the slots in
+// use, so switching modes finds them resident
+void OneRenderer::createMacroCells(const QVector<const OneReader::Texture*>& slotTextures) {
+    auto useLayout = [&]() {
+        for (int j = 0; j < slotTextures.size(); ++j) {
+            if (!slotTextures[j]) continue;
+            const BrickInfo& layout = m_macroLayout[slotTextures[j]->id];
+            BrickInfo& info = m_brickInfo[j];
+            std::copy(layout.size, layout.size + 3, info.size);
+            info.macroBase = layout.macroBase;
+            std::copy(layout.macroCount, layout.macroCount + 3, info.macroCount);
+        }
+    };
+
+    bool resident = m_macroCellTexture != 0;
+    for (const OneReader::Texture* tex : slotTextures) {
+        resident = resident && (!tex || m_macroLayout.contains(tex->id));
+    }
+    if (resident) {
+        useLayout();
+        return;
+    }
+    releaseMacroCells();
+
+    std::vector<GLubyte> cells;
+    for (int i : m_readyTextures) {
+        const OneReader::Texture& tex = m_scene->textures.at(i);
+        if (m_macroLayout.contains(tex.id)) continue;
+
+        BrickInfo layout;
+        layout.size[0] = tex.sizeX;
+        layout.size[1] = tex.sizeY;
+        layout.size[2] = tex.sizeZ;
+        layout.macroBase = static_cast<GLint>(cells.size());
+        layout.macroCount[0] = tex.macroX;
+        layout.macroCount[1] = tex.macroY;
+        layout.macroCount[2] = tex.macroZ;
+        cells.insert(cells.end(), tex.macroCells.begin(), tex.macroCells.end());
+        m_macroLayout.insert(tex.id, layout);
+    }
+
+    // A one byte buffer still gives the sampler something valid to point at
+    if (cells.empty()) {
+        cells.push_back(1);
+    }
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if (cells.size() > static_cast<size_t>(std::max(maxTexels, 0))) {
+        qDebug() << "Macro-cell grid too large for a buffer texture:" << cells.size() << "cells, skipping disabled";
+        for (BrickInfo& layout : m_macroLayout) {
+            layout.macroCount[0] = layout.macroCount[1] = layout.macroCount[2] = 0;
         }
+        cells.assign(1, 1);
+    }
+    useLayout();
+
+    glGenBuffers(1, &m_macroCellBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_macroCellBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, cells.size(), cells.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    m_uploadedBytes += cells.size();
+    m_macroCellBytes = cells.size();
+    glGenTextures(1, &m_macroCellTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_macroCellTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, m_macroCellBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void OneRenderer::releaseMacroCells() {
+    if (m_macroCellTexture) {
+        glDeleteTextures(1, &m_macroCellTexture);
+        m_macroCellTexture = 0;
+    }
+    if (m_macroCellBuffer) {
+        glDeleteBuffers(1, &m_macroCellBuffer);
+        m_macroCellBuffer = 0;
+    }
+    m_macroCellBytes = 0;
+    m_macroLayout.clear();
+}
+
+// Packs the per slot values nested.frag needs into an RGBA32F buffer texture,
+// kVolumeTexels texels per slot, so the volume count is not bound by uniform
+// array sizes. The layout is documented next to volumeParams in nested.frag.
+void OneRenderer::uploadVolumeParams() {
+    std::vector<GLfloat> params(static_cast<size_t>(std::max(1, m_numTextures)) * kVolumeTexels * 4, 0.0f);
+    for (int j = 0; j < m_numTextures && j < m_slotParams.size() && j < m_brickInfo.size(); ++j) {
+        const SlotParams& slot = m_slotParams[j];
+        const BrickInfo& info = m_brickInfo[j];
+        GLfloat* p = params.data() + static_cast<size_t>(j) * kVolumeTexels * 4;
+        memcpy(p, slot.model.constData(), 16 * sizeof(GLfloat)); // Column-major, a column per texel
+        memcpy(p + 16, slot.inverseModel.constData(), 16 * sizeof(GLfloat));
+        p[32] = slot.emission;
+        p[33] = slot.opacity;
+        p[34] = slot.blend;
+        p[35] = slot.replace ? 1.0f : 0.0f;
+        storageTexel(info, p + 36);
+        for (int c = 0; c < 3; ++c) {
+            p[40 + c] = info.size[c];
+            p[44 + c] = info.count[c];
+            p[48 + c] = info.macroCount[c];
+            // Texels per unit length along the most finely sampled axis, for the mip level
+            const float axis = QVector3D(slot.model(c, 0), slot.model(c, 1), slot.model(c, 2)).length();
+            p[43] = std::max(p[43], info.size[c] * axis);
+        }
+        std::copy(info.channelScale, info.channelScale + 4, p + 52);
+        std::copy(info.channelBias, info.channelBias + 4, p + 56);
+    }
+
+    // The buffer is kept and refilled; the texture follows its new storage
+    if (!m_volumeParamBuffer) {
+        glGenBuffers(1, &m_volumeParamBuffer);
+        glGenTextures(1, &m_volumeParamTexture);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, m_volumeParamBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, params.size() * sizeof(GLfloat), params.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    m_uploadedBytes += params.size() * sizeof(GLfloat);
+    glBindTexture(GL_TEXTURE_BUFFER, m_volumeParamTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_volumeParamBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Texel 9 of a slot: bricked, brickBase, macroBase, dense texture unit
+void OneRenderer::storageTexel(const BrickInfo& info, GLfloat* texel) {
+    texel[0] = info.bricked;
+    texel[1] = info.base;
+    texel[2] = info.macroBase;
+    texel[3] = std::max(0, info.denseUnit);
+}
+
+void OneRenderer::releaseVolumeParams() {
+    if (m_volumeParamTexture) {
+        glDeleteTextures(1, &m_volumeParamTexture);
+        m_volumeParamTexture = 0;
+    }
+    if (m_volumeParamBuffer) {
+        glDeleteBuffers(1, &m_volumeParamBuffer);
+        m_volumeParamBuffer = 0;
+    }
+}
+
+// Screen-space volume culling for nested.frag: projects the corners of every
+// slot's texture box and lists, per kTileSize tile of the target, the slots
+// whose projected bounds touch it. The R32I buffer texture holds a (first
+// entry, count) pair per tile followed by the lists, slots in ascending order.
+// Returns false if culling cannot be used for this frame.
+bool OneRenderer::uploadTileVolumes(const QMatrix4x4& viewProjection, const QSize& target) {
+    const int tilesX = (target.width() + kTileSize - 1) / kTileSize;
+    const int tilesY = (target.height() + kTileSize - 1) / kTileSize;
+    const int numTiles = tilesX * tilesY;
+
+    // Tile rectangle per slot, empty when off screen
+    QVector<QRect> covered(m_slotParams.size());
+    for (int j = 0; j < m_slotParams.size(); ++j) {
+        float minX = std::numeric_limits<float>::max();
+        float minY = minX;
+        float maxX = -minX;
+        float maxY = -minX;
+        bool behind = false;
+        for (int c = 0; c < 8; ++c) {
+            QVector4D corner((c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f, 1.0f);
+            // The box maps into shader space, which is world space at half scale
+            QVector4D clip = viewProjection * QVector4D(2.0f * (m_slotParams[j].inverseModel * corner).toVector3D(), 1.0f);
+            if (clip.w() <= 1e-5f) {
+                behind = true; // Crosses the camera plane, so it may cover any pixel
+                break;
+            }
+            float x = (clip.x() / clip.w() * 0.5f + 0.5f) * target.width();
+            float y = (clip.y() / clip.w() * 0.5f + 0.5f) * target.height();
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+        }
+        if (behind) {
+            covered[j] = QRect(0, 0, tilesX, tilesY);
+            continue;
+        }
+        // One pixel of margin for the sub-pixel jitter of refinement frames
+        int x0 = std::max(0, static_cast<int>(std::floor((minX - 1.0f) / kTileSize)));
+        int y0 = std::max(0, static_cast<int>(std::floor((minY - 1.0f) / kTileSize)));
+        int x1 = std::min(tilesX - 1, static_cast<int>(std::floor((maxX + 1.0f) / kTileSize)));
+        int y1 = std::min(tilesY - 1, static_cast<int>(std::floor((maxY + 1.0f) / kTileSize)));
+        covered[j] = QRect(QPoint(x0, y0), QPoint(x1, y1)); // Invalid if it misses the target
+    }
+
+    std::vector<GLint> counts(numTiles, 0);
+    size_t entries = 0;
+    for (const QRect& rect : covered) {
+        if (!rect.isValid()) continue;
+        for (int ty = rect.top(); ty <= rect.bottom(); ++ty)
+            for (int tx = rect.left(); tx <= rect.right(); ++tx)
+                ++counts[ty * tilesX + tx];
+        entries += static_cast<size_t>(rect.width()) * rect.height();
+    }
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    const size_t total = static_cast<size_t>(numTiles) * 2 + entries;
+    if (total > static_cast<size_t>(std::max(maxTexels, 0))) {
+        qDebug() << "Tile volume lists too large for a buffer texture:" << total << "entries, culling skipped";
+        return false;
+    }
+
+    std::vector<GLint> lists(total);
+    GLint next = numTiles * 2;
+    for (int t = 0; t < numTiles; ++t) {
+        lists[t * 2] = next;
+        lists[t * 2 + 1] = 0;
+        next += counts[t];
+    }
+    for (int j = 0; j < covered.size(); ++j) {
+        const QRect& rect = covered[j];
+        if (!rect.isValid()) continue;
+        for (int ty = rect.top(); ty <= rect.bottom(); ++ty)
+            for (int tx = rect.left(); tx <= rect.right(); ++tx) {
+                GLint* tile = &lists[(ty * tilesX + tx) * 2];
+                lists[tile[0] + tile[1]++] = j;
+            }
+    }
+
+    if (!m_tileVolumeBuffer) {
+        glGenBuffers(1, &m_tileVolumeBuffer);
+        glGenTextures(1, &m_tileVolumeTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, m_tileVolumeTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_tileVolumeBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, m_tileVolumeBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, lists.size() * sizeof(GLint), lists.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    m_tileCount[0] = tilesX;
+    m_tileCount[1] = tilesY;
+    return true;
+}
+
+void OneRenderer::releaseTileVolumes() {
+    if (m_tileVolumeTexture) {
+        glDeleteTextures(1, &m_tileVolumeTexture);
+        m_tileVolumeTexture = 0;
+    }
+    if (m_tileVolumeBuffer) {
+        glDeleteBuffers(1, &m_tileVolumeBuffer);
+        m_tileVolumeBuffer = 0;
+    }
+}
+
+void OneRenderer::setBrickUniforms(QOpenGLShaderProgram& prog) {
+    glActiveTexture(GL_TEXTURE0 + 10);
+    glBindTexture(GL_TEXTURE_3D, m_brickAtlas);
+    glActiveTexture(GL_TEXTURE0 + 11);
+    glBindTexture(GL_TEXTURE_BUFFER, m_brickIndexTexture);
+    glActiveTexture(GL_TEXTURE0 + 12);
+    glBindTexture(GL_TEXTURE_BUFFER, m_macroCellTexture);
+    glActiveTexture(GL_TEXTURE0 + 13);
+    glBindTexture(GL_TEXTURE_BUFFER, m_volumeParamTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform3iv(prog.uniformLocation("brickAtlasSlots"), 1, m_brickAtlasSlots);
+    prog.setUniformValue("emptySpaceSkipping", m_emptySpaceSkipping ? 1 : 0);
+
+    // Nested mode reads the rest from volumeParams
+    if (!m_nestedMode) {
+        const BrickInfo info = m_brickInfo.value(0);
+        prog.setUniformValue("bricked", info.bricked);
+        prog.setUniformValue("brickBase", info.base);
+        glUniform3iv(prog.uniformLocation("brickCount"), 1, info.count);
+        glUniform3iv(prog.uniformLocation("texSize"), 1, info.size);
+        prog.setUniformValue("macroBase", info.macroBase);
+        glUniform3iv(prog.uniformLocation("macroCount"), 1, info.macroCount);
+        glUniform4fv(prog.uniformLocation("channelScale"), 1, info.channelScale);
+        glUniform4fv(prog.uniformLocation("channelBias"), 1, info.channelBias);
     }
 }
 
@@ -10,8 +10,18 @@
 #include <QVector3D>
 #include <QMouseEvent>
 #include <QWheelEvent>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QTimer>
+#include <QOpenGLFramebufferObject>
+#include <QFuture>
+#include <map>
+#include <memory>
+#include <vector>
 #include "onereader.h"
 
+class QLabel;
+
 class OneRenderer : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core {
     Q_OBJECT
 
@@ -19,10 +29,99 @@ public:
     OneRenderer(QWidget *parent = nullptr);
     ~OneRenderer();
 
-    void setOneReader(OneReader *reader);
+    // Dense textures with a sampler of their own (units 0..9). Volumes beyond
+    // that are sampled from the brick atlas like bricked textures; the reader's
+    // dense texture limit bricks their textures while loading.
+    static const int kMaxDenseTextures = 10;
+
+    // Shows a complete scene, or nothing for null. The previous scene's GPU
+    // resources are released once the new one is in place.
+    void setScene(OneReader::SceneHandle scene);
+    // Progressive display while a load is running. The scene on screen stays
+    // until setScene(); arriving textures are uploaded ahead of the swap. With
+    // nothing on screen, the new scene is shown texture by texture instead.
+    void beginProgressiveLoad();
+    void textureReady(OneReader::SceneHandle scene, int textureIndex);
     void toggleBounds(bool enable);
     void setNestedMode(bool enable);
     void setBackgroundColor(const QVector3D &color);
+    // Leap over macro cells that hold no data instead of sampling them (default on)
+    void setEmptySpaceSkipping(bool enable);
+    // Nested mode: rays only test the volumes whose screen bounds cover their
+    // tile, and samples only those the ray segment passes through (default on)
+    void setVolumeCulling(bool enable);
+    // Composite front to back and stop rays once their transmittance drops below
+    // the threshold. Matches back-to-front compositing to within the threshold.
+    void setFrontToBack(bool enable);
+    void setTerminationThreshold(float transmittance);
+    // Adaptive sampling: steps follow the voxel size of the finest texture at
+    // the sample, the pixel footprint and the local opacity gradient instead of
+    // the fixed ds0. Quality is samples per voxel (default 2).
+    void setAdaptiveSampling(bool enable);
+    void setSamplingQuality(float quality);
+    // Progressive refinement (default on): frames are drawn at 1/scale of the
+    // resolution while the camera moves, then refined to full quality over the
+    // next frames once input stops.
+    void setProgressiveRefinement(bool enable);
+    void setInteractiveScale(int scale);
+    // Sample dense textures from the mip level matching the pixel footprint
+    // instead of always the full resolution (default on; needs mip chains)
+    void setMipmapping(bool enable);
+    // Dense textures stream to the GPU in slabs of slices, at most this many
+    // megabytes per frame (default 64), coarsest mip level first. A texture
+    // shows once its coarsest level is in and sharpens as the rest arrive.
+    void setUploadBudget(int megabytes);
+    // Renders the current view with the textures as uploaded and again from
+    // their 32-bit float data, and logs how far the two images differ
+    void reportPrecisionError();
+    // Renders the current view with the GL path and with OneCpuRenderer
+    // from the same float data, and logs how far the two images differ
+    void reportCpuRenderError();
+    // Renders the current view and six axis views around it with and without
+    // per-tile volume culling, and logs how far the images differ
+    void reportCullingError();
+    // Draws the volume once per view matrix into an offscreen target of the
+    // given size, with the current settings and no progressive refinement, and
+    // returns each draw's GPU time in ms from GL_TIME_ELAPSED. Uploads still
+    // queued are finished first. Empty without a complete scene.
+    std::vector<double> timeViews(const QVector<QMatrix4x4>& views, const QSize& size);
+
+    // Rolling statistics over the last kStatsFrames painted frames, p50 and p95.
+    // GPU times come from GL_TIME_ELAPSED queries read back a few frames later,
+    // so measuring never stalls the pipeline; they are -1 until results arrive.
+    struct FrameStats {
+        int frames = 0;
+        double paintP50Ms = 0.0; // paintGL CPU time
+        double paintP95Ms = 0.0;
+        double setupP50Ms = 0.0; // Uniforms and tile lists of the volume draws
+        double setupP95Ms = 0.0;
+        double volumeGpuP50Ms = -1.0; // Volume pass, progressive blits included
+        double volumeGpuP95Ms = -1.0;
+        double boundsGpuP50Ms = -1.0;
+        double boundsGpuP95Ms = -1.0;
+        double uploadMB = 0.0; // Sent to the GPU over the window
+        double uploadMs = 0.0; // CPU time issuing those uploads
+        int residentTextures = 0;
+        double residentMB = 0.0; // Dense textures, brick atlas and macro cells
+    };
+    FrameStats frameStats() const;
+    // GPU memory held per dense texture, for the scene on screen and the one loading behind it
+    struct TextureResidency {
+        qint64 id = 0;
+        size_t bytes = 0;
+        OneReader::TexturePrecision precision = OneReader::Float32Precision;
+        int levels = 0; // Mip levels above level 0
+        int baseLevel = -1; // Finest level sampled from, -1 before the coarsest is in
+        bool streaming = false;
+        bool pending = false; // Belongs to the scene still loading
+    };
+    QVector<TextureResidency> textureResidency() const;
+    // Shows frameStats() over the view, refreshed a few times a second (default off)
+    void setStatsOverlay(bool enable);
+
+signals:
+    // Something the scene needs could not be put on the GPU, so part of it is not drawn
+    void renderWarning(const QString& message);
 
 protected:
     void initializeGL() override;
@@ -33,16 +132,78 @@ protected:
     void wheelEvent(QWheelEvent *event) override;
 
 private:
-    OneReader *m_reader = nullptr;
+    OneReader::SceneHandle m_scene; // Scene on screen
+    bool m_sceneComplete = false; // False while m_scene is shown part way through its load
     QOpenGLShaderProgram m_singleProgram;
-    QOpenGLShaderProgram m_nestedProgram;
     QOpenGLShaderProgram m_lineProgram;
+    QOpenGLShaderProgram m_screenProgram;
     GLuint m_vao = 0;
     QOpenGLBuffer m_vbo;
     QOpenGLBuffer m_boundVBO;
     GLuint m_boundVAO = 0;
-    GLuint m_textures[10] = {0};
-    int m_numTextures = 0;
+    GLuint m_textures[kMaxDenseTextures] = {0}; // Per sampler unit; owned by m_denseTextures
+    int m_numTextures = 0; // Volumes in the nested slots, any number
+
+    // GPU residency: uploaded textures stay alive across mode switches and are
+    // only uploaded again when what they hold changes. Keyed by texture ID.
+    struct ResidentTexture {
+        GLuint texture = 0;
+        size_t bytes = 0;
+        OneReader::TexturePrecision precision = OneReader::Float32Precision; // As uploaded
+        int levels = 0; // Mip levels above level 0
+        int baseLevel = -1; // Finest level streamed in and sampled from, -1 before the coarsest
+        bool streaming = false; // Upload still running
+    };
+    QMap<qint64, ResidentTexture> m_denseTextures; // Dense textures of m_scene
+    QSet<int> m_readyTextures; // Textures of m_scene that are safe to read
+    OneReader::SceneHandle m_pendingScene; // Scene being loaded behind the one on screen
+    QMap<qint64, ResidentTexture> m_pendingTextures; // Its textures uploaded so far
+    const OneReader::SceneData* m_residentScene = nullptr; // Scene the atlas and macro cells were built for
+
+    // Uploads go through a ring of persistent pixel buffers in z-slab chunks.
+    // A worker thread copies a chunk into a mapped buffer; once the copy is done
+    // the GUI thread issues glTexSubImage3D from it and fences the buffer, which
+    // is reused when the fence has signalled. paintGL() hands at most
+    // m_uploadBudget bytes per frame to the ring.
+    struct UploadJob {
+        GLuint texture = 0;
+        int level = 0;
+        std::shared_ptr<const void> owner; // Keeps the texels alive, null for synchronous uploads
+        const uchar* texels = nullptr;
+        GLenum type = GL_FLOAT;
+        int sizeX = 0;
+        int sizeY = 0;
+        int sizeZ = 0;
+        size_t sliceBytes = 0;
+        int nextZ = 0; // First slice not yet given to a buffer
+    };
+    struct UploadSlot {
+        GLuint buffer = 0;
+        size_t bytes = 0; // Allocated storage
+        GLsync fence = nullptr; // Set until the GPU has read the last chunk
+        void* mapped = nullptr; // Set while a chunk is being copied in
+        QFuture<void> copy;
+        GLuint texture = 0; // Target of the chunk, 0 if the texture went away meanwhile
+        int level = 0;
+        std::shared_ptr<const void> owner;
+        GLenum type = GL_FLOAT;
+        int sizeX = 0;
+        int sizeY = 0;
+        int z = 0;
+        int depth = 0;
+    };
+    static const int kUploadBuffers = 3;
+    static const size_t kUploadChunkBytes = size_t(16) << 20;
+    UploadSlot m_uploadSlots[kUploadBuffers];
+    int m_nextUploadBuffer = 0;
+    QList<UploadJob> m_uploadJobs; // Dense textures waiting to stream, oldest first
+    qint64 m_uploadBudget = qint64(64) << 20;
+    qint64 m_uploadedBytes = 0; // Sent to the GPU since the renderer was created
+    qint64 m_reportedUploadBytes = 0; // m_uploadedBytes at the last upload summary
+    bool m_uploadSummaryPending = false; // Dense textures queued since the last summary
+    bool m_progressiveLoad = false;
+    QElapsedTimer m_loadTimer;
+    bool m_firstPixelPending = false;
     QMatrix4x4 m_projMatrix;
     QMatrix4x4 m_viewMatrix;
     float m_distance = 1.5f;
@@ -53,7 +214,153 @@ private:
     QVector<int> m_sortedVolumeIndices;
     QVector3D m_backgroundColor = QVector3D(0.0,0.0,0.0);
 
+    // Where a slot's texture lives: its own sampler or the shared brick atlas,
+    // and its macro-cell grid
+    struct BrickInfo {
+        GLint denseUnit = -1; // Sampler unit of a dense texture, -1 if in the atlas
+        GLint bricked = 0; // 1 in the atlas, -1 while a dense texture is still streaming in
+        GLint base = 0; // First entry of the texture in the brick index
+        GLint count[3] = {0, 0, 0}; // Bricks along each axis
+        GLint size[3] = {0, 0, 0}; // Texels along each axis
+        GLint macroBase = 0; // First entry of the texture in the macro-cell buffer
+        GLint macroCount[3] = {0, 0, 0}; // Macro cells along each axis
+        GLfloat channelScale[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // Decode of scaled byte texels
+        GLfloat channelBias[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    };
+    QVector<BrickInfo> m_brickInfo; // Per nested slot
+    QMap<qint64, BrickInfo> m_atlasLayout; // Where each texture in the brick atlas lives
+    QMap<qint64, BrickInfo> m_macroLayout; // Where each texture's grid lives in the macro-cell buffer
+
+    // Shader values per nested slot, derived from the typed volume params.
+    // Rebuilt with the slots in createTextures(), not per frame, and handed to
+    // nested.frag as the volumeParams buffer texture.
+    struct SlotParams {
+        QMatrix4x4 model;
+        QMatrix4x4 inverseModel;
+        float emission = 1.0f;
+        float opacity = 1.0f;
+        float blend = 0.0f;
+        bool replace = false;
+    };
+    QVector<SlotParams> m_slotParams;
+    static const int kVolumeTexels = 15; // VOLUME_TEXELS in nested.frag
+    GLuint m_volumeParamBuffer = 0;
+    GLuint m_volumeParamTexture = 0;
+    // Nested shader variants: nested.frag compiled without the features no
+    // scene supplies, and with the exact volume count once every volume of a
+    // complete scene has its slot. Built on first use and kept for the session.
+    static const int kMaxSpecializedVolumes = 8; // Larger counts use the variant for any count
+    std::map<quint32, std::unique_ptr<QOpenGLShaderProgram>> m_nestedVariants; // Keyed by nestedVariantKey()
+    quint32 m_nestedVariant = 0; // Variant drawVolume() uses
+    QString m_vertSource;
+    QString m_nestedFragSource;
+    QMatrix4x4 m_singleModel;
+    float m_singleEmission = 1.0f;
+    float m_singleOpacity = 1.0f;
+
+    // Instrumentation: one sample per painted frame in a ring of kStatsFrames.
+    // Timer queries go round a ring of kTimerFrames and fill in the GPU times
+    // of their frame's sample once available; a frame finding its set still
+    // busy goes unmeasured instead of waiting.
+    static const int kStatsFrames = 240;
+    static const int kTimerFrames = 4;
+    struct FrameSample {
+        float paintMs = 0.0f;
+        float setupMs = 0.0f;
+        float volumeGpuMs = -1.0f;
+        float boundsGpuMs = -1.0f;
+        float uploadMs = 0.0f;
+        qint64 uploadBytes = 0;
+    };
+    struct TimerQuery {
+        GLuint volume = 0;
+        GLuint bounds = 0;
+        qint64 frame = -1; // Sample the results belong to, -1 while free
+        bool boundsUsed = false;
+    };
+    FrameSample m_samples[kStatsFrames];
+    qint64 m_sampledFrames = 0; // Samples taken so far; the next goes in m_samples[m_sampledFrames % kStatsFrames]
+    TimerQuery m_timerQueries[kTimerFrames];
+    int m_nextTimerQuery = 0;
+    qint64 m_setupNs = 0; // Volume draw setup in the frame being painted
+    qint64 m_uploadNs = 0; // Upload work since the last sample
+    qint64 m_sampledUploadBytes = 0; // m_uploadedBytes at the last sample
+    size_t m_atlasBytes = 0;
+    size_t m_macroCellBytes = 0;
+    QLabel* m_overlay = nullptr;
+    QElapsedTimer m_overlayTimer;
+    GLuint m_brickAtlas = 0;
+    OneReader::TexturePrecision m_atlasPrecision = OneReader::Float32Precision;
+    GLuint m_brickIndexBuffer = 0;
+    GLuint m_brickIndexTexture = 0;
+    GLint m_brickAtlasSlots[3] = {1, 1, 1};
+    QString m_atlasWarning; // Set while textures are left out of an overflowing atlas
+    bool m_fullPrecision = false; // Upload float textures as RGBA32F whatever their precision
+    GLuint m_macroCellBuffer = 0;
+    GLuint m_macroCellTexture = 0;
+    bool m_emptySpaceSkipping = true;
+    bool m_volumeCulling = true;
+    static const int kTileSize = 16; // Pixels per side of a culling tile
+    GLuint m_tileVolumeBuffer = 0;
+    GLuint m_tileVolumeTexture = 0;
+    GLint m_tileCount[2] = {1, 1};
+    bool m_frontToBack = false;
+    float m_terminationThreshold = 0.001f;
+    bool m_adaptiveSampling = false;
+    bool m_mipmapping = true;
+    float m_samplingQuality = 2.0f;
+
+    // Progressive refinement
+    bool m_progressiveRefinement = true;
+    bool m_interacting = false;
+    QTimer m_idleTimer; // Ends the interaction when input stops
+    int m_interactiveScale = 2;
+    int m_refineFrames = 8; // Jittered frames averaged once the camera is still
+    int m_refineFrame = 0; // Frames in m_accumFbo so far
+    std::unique_ptr<QOpenGLFramebufferObject> m_interactiveFbo;
+    std::unique_ptr<QOpenGLFramebufferObject> m_frameFbo;
+    std::unique_ptr<QOpenGLFramebufferObject> m_accumFbo;
+
     void createTextures();
+    void updateResidency();
+    void updateSlotParams();
+    void releaseTextures();
+    void deleteTextures(QMap<qint64, ResidentTexture>& textures);
+    void armFirstPixel();
+    OneReader::TexturePrecision uploadPrecision(const OneReader::Texture* tex) const;
+    GLuint denseTexture(int textureIndex);
+    ResidentTexture uploadDenseTexture(const OneReader::SceneHandle& scene, const OneReader::Texture* tex);
+    void uploadTexture3D(GLenum internalFormat, int sizeX, int sizeY, int sizeZ, GLenum type, const void* texels);
+    bool uploadNextChunk(UploadJob& job, bool wait);
+    bool acquireUploadSlot(UploadSlot& slot, bool wait);
+    void submitUploadSlot(UploadSlot& slot);
+    bool pumpUploads(qint64 budget, bool wait);
+    void finishUploads();
+    bool isUploading(GLuint texture, int level) const;
+    void cancelUploads(GLuint texture);
+    void releaseUploadBuffers();
+    void createBrickAtlas(const QVector<const OneReader::Texture*>& slotTextures);
+    void releaseBrickAtlas();
+    void setChannelDecode(BrickInfo& info, const OneReader::Texture* tex, bool scaled);
+    void createMacroCells(const QVector<const OneReader::Texture*>& slotTextures);
+    void releaseMacroCells();
+    void uploadVolumeParams();
+    static void storageTexel(const BrickInfo& info, GLfloat* texel);
+    void releaseVolumeParams();
+    void setBrickUniforms(QOpenGLShaderProgram& prog);
+    bool uploadTileVolumes(const QMatrix4x4& viewProjection, const QSize& target);
+    void releaseTileVolumes();
+    void drawVolume(const QMatrix4x4& projection, float rayJitter, const QSize& target);
+    void renderProgressive();
+    bool ensureFramebuffer(std::unique_ptr<QOpenGLFramebufferObject>& fbo, const QSize& size);
+    void drawScreenTexture(GLuint texture);
+    QSize framebufferSize() const;
+    void beginInteraction();
+    void restartRefinement();
+    quint32 nestedVariantKey(int volumeCount) const;
+    QOpenGLShaderProgram& nestedProgram(quint32 key);
+    void collectTimerQueries();
+    void updateOverlay();
     void setupCubeGeometry();
     void setupBoundLines();
 };
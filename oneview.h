@@ -0,0 +1,52 @@
+// oneview.h
+#ifndef ONEVIEW_H
+#define ONEVIEW_H
+
+#include "onereader.h"
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QSize>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+// Camera and volume transforms shared by the GL renderer and the CPU renderer,
+// so both look at a scene from the same place.
+namespace OneView {
+
+const float kFieldOfView = 45.0f; // Vertical, degrees
+
+// Volume-to-texture transform from the typed volume params
+inline QMatrix4x4 volumeModel(const OneReader::Volume& vol) {
+    QMatrix4x4 model;
+    model.setToIdentity();
+    model.scale(1.0 / vol.scale[0], 1.0 / vol.scale[1], 1.0 / vol.scale[2]);
+    model.rotate(vol.rotation[0], 1.0f, 0.0f, 0.0f);
+    model.rotate(vol.rotation[1], 0.0f, 1.0f, 0.0f);
+    model.rotate(vol.rotation[2], 0.0f, 0.0f, 1.0f);
+    model.translate(-0.5 * vol.offset[0], -0.5 * vol.offset[1], -0.5 * vol.offset[2]);
+    return model;
+}
+
+// Orbit camera: distance from the origin along the rotated -Z axis, looking at the origin
+inline QMatrix4x4 viewMatrix(const QQuaternion& rotation, float distance) {
+    QMatrix4x4 view;
+    view.lookAt(rotation.rotatedVector(QVector3D(0, 0, -distance)), QVector3D(0, 0, 0),
+                rotation.rotatedVector(QVector3D(0, 1, 0)));
+    return view;
+}
+
+inline QMatrix4x4 projectionMatrix(const QSize& size) {
+    QMatrix4x4 projection;
+    projection.perspective(kFieldOfView, static_cast<float>(size.width()) / std::max(1, size.height()), 0.1f, 100.0f);
+    return projection;
+}
+
+// Angle one pixel of a target this high spans, for the footprint of a sample
+inline float pixelAngle(int height) {
+    return 2.0f * std::tan(qDegreesToRadians(kFieldOfView) / 2.0f) / std::max(1, height);
+}
+
+} // namespace OneView
+
+#endif // ONEVIEW_H
@@ -1,16 +1,77 @@
 #version 330
 
-const int MAX_TEXTURES = 10; //maximum number of textures we can have
-
-uniform int numValidTextures = 1;
+//Features compiled into this variant. OneRenderer defines them after the version line when it builds a variant,
+//with the three optional features off as it loads none of their inputs; the defaults give the shader with every
+//feature decided at run time.
+#ifndef TEXTURE_NORMALIZE
+#define TEXTURE_NORMALIZE 1 //texture_normalize is honoured
+#endif
+#ifndef SCATTERING
+#define SCATTERING 1 //numEmitters scatter light from the shadow textures
+#endif
+#ifndef STARS
+#define STARS 1 //star_brightness lights the star textures
+#endif
+#ifndef VOLUME_COUNT
+#define VOLUME_COUNT 0 //exact number of volumes, or 0 to read numValidTextures
+#endif
+
+const int MAX_TEXTURES = 10; //textures bound to their own sampler, the others live in the brick atlas
+const int MAX_RAY_VOLUMES = 64; //volume boundaries a ray keeps apart, further ones are merged
+
+uniform int numValidTextures = 1; //number of volumes, any count
+
+int volumeCount()
+{
+#if VOLUME_COUNT > 0
+    return(VOLUME_COUNT);
+#else
+    return(numValidTextures);
+#endif
+}
 
-uniform sampler3D textures[MAX_TEXTURES]; //All of the nested textures
-uniform mat4 texture_transform[MAX_TEXTURES]; //For rotating and translating the nested volumes
-uniform mat4 texture_iTransform[MAX_TEXTURES]; //inverse transform
-uniform int texture_replace[MAX_TEXTURES]; //Should the texture replace any that are higher order,  or add to them
-uniform float texture_blend[MAX_TEXTURES]; //the amount of blending (0->1) with the textures of higher order
-uniform float texture_jscale[MAX_TEXTURES]; //scales the emission of the texture
-uniform float texture_kscale[MAX_TEXTURES]; //scales the absorption of the texture
+uniform sampler3D textures[MAX_TEXTURES]; //Dense nested textures
+
+//Per volume parameters, VOLUME_TEXELS RGBA32F texels each (see OneRenderer::uploadVolumeParams):
+// 0-3  transform (columns)       For rotating and translating the nested volumes
+// 4-7  inverse transform (columns)
+// 8    jscale, kscale, blend, replace
+// 9    bricked (1, or -1 while a dense texture is still streaming in), brickBase, macroBase, dense texture unit
+// 10   texel size, and in w the texels per unit length along the finest axis (for the mip level)
+// 11   number of bricks along each axis
+// 12   number of macro cells along each axis, 0 if there is no grid
+// 13   channel scale and 14 channel bias: stored texels decode as value * scale + bias, per stored channel
+const int VOLUME_TEXELS = 15;
+uniform samplerBuffer volumeParams;
+
+uniform sampler3D brickAtlas; //Occupied bricks with a one texel apron for filtering
+uniform isamplerBuffer brickIndex; //Atlas slot for every brick, -1 if empty
+uniform ivec3 brickAtlasSlots = ivec3(1); //number of brick slots along each atlas axis
+uniform int brickSize = 16; //texels along each side of a brick
+
+//Empty space skipping: a grid of macro cells per texture, non-zero where the cell may hold data
+uniform int emptySpaceSkipping = 1; //Leap over empty macro cells
+uniform usamplerBuffer macroCells; //All macro cell grids back to back
+uniform int macroCellSize = 8; //texels along each side of a macro cell
+
+//Volume culling: per screen tile, the volumes whose bounds cover the tile (see OneRenderer::uploadTileVolumes)
+uniform int volumeCulling = 0; //Only intersect the volumes listed for this pixel's tile
+uniform isamplerBuffer tileVolumes; //First entry and count per tile, followed by the lists of volume indices
+uniform int tileSize = 16; //pixels along each side of a tile
+uniform ivec2 tileCount = ivec2(1); //tiles across and up the render target
+
+//Compositing order
+uniform int frontToBack = 0; //March front to back and stop once the ray is close to opaque
+uniform float terminationThreshold = 0.001; //Transmittance below which the rest of the ray is ignored
+
+//Adaptive sampling: the step follows the data instead of ds0
+uniform int adaptiveSampling = 0; //Use adaptiveStep() instead of the fixed ds0 based steps
+uniform float samplingQuality = 2; //Samples per voxel of the finest texture covering the sample
+uniform float pixelAngle = 0.0017; //Angle covered by one pixel, for the footprint of a sample
+uniform float maxStepOpacityChange = 0.05; //Largest change of optical depth across one step at quality 1
+
+//Level of detail: dense textures carry mip chains, sampled at the level matching the pixel footprint
+uniform int mipmapping = 1; //Pick the mip level from sampleFootprint instead of always level 0
 
 //For normalization
 uniform int texture_normalize = 0; //Should we normalize the textures to 256
@@ -21,6 +82,7 @@ uniform float texture_norm_exp = 1; //exponent for normalization mapping
 uniform float jScale = 1;
 uniform float kScale = 1;
 uniform float ds0 = .01; //The step size
+uniform float rayJitter = 0; //Offset of the first sample as a fraction of a step, varied per frame when refining
 
 uniform vec3 backgroundColor = vec3(0,0,0);
 uniform float exposure = 0.0; // Exposure control (e.g., -2.0 to +2.0 for
@@ -31,6 +93,19 @@ in vec3 cameraPos;
 in vec3 rayDir;
 
 bool isOrtho = false;
+
+//Volumes the ray passes through, with where it enters and leaves each (filled in main)
+int rayVolumes[MAX_RAY_VOLUMES];
+vec2 rayVolumeSpans[MAX_RAY_VOLUMES];
+int numRayVolumes = 0;
+bool rayVolumesComplete = true; //false if the ray hit more volumes than rayVolumes holds
+
+//Volumes the current ray segment passes through, in slot order.  Samples only test these.
+int activeVolumes[MAX_RAY_VOLUMES];
+int numActiveVolumes = 0;
+bool allVolumesActive = true; //Test every volume, when the ray's volumes are not known
+
+float sampleFootprint = 0; //Width the current sample covers, the pixel footprint at its distance (set by the march loops)
 float boxSize = 0.5; //using slightly less than .5 removes dots from result when camera is very close in
 
 vec3 box_min0 = -vec3(boxSize);
@@ -278,9 +353,75 @@ float blendFactor(vec3 p, float transition_area)
     return(s);
 }
 
+vec4 volumeParam(int i, int k)
+{
+    return(texelFetch(volumeParams, i * VOLUME_TEXELS + k));
+}
+
+mat4 texture_transform(int i)
+{
+    return(mat4(volumeParam(i, 0), volumeParam(i, 1), volumeParam(i, 2), volumeParam(i, 3)));
+}
+
+mat4 texture_iTransform(int i)
+{
+    return(mat4(volumeParam(i, 4), volumeParam(i, 5), volumeParam(i, 6), volumeParam(i, 7)));
+}
+
+ivec3 texture_size(int i)
+{
+    return(ivec3(volumeParam(i, 10).xyz));
+}
+
+int activeVolumeCount()
+{
+    return(allVolumesActive ? volumeCount() : numActiveVolumes);
+}
+
+int activeVolume(int k)
+{
+    return(allVolumesActive ? k : activeVolumes[k]);
+}
+
+/**
+ * Samples a bricked texture through the brick index. Empty bricks read as 0.
+ */
+vec4 getBrickedTexture(int textureIndex, vec3 texPos)
+{
+    ivec3 count = ivec3(volumeParam(textureIndex, 11).xyz);
+    vec3 voxel = texPos * vec3(texture_size(textureIndex));
+    ivec3 brick = clamp(ivec3(voxel) / brickSize, ivec3(0), count - 1);
+
+    int slot = texelFetch(brickIndex, int(volumeParam(textureIndex, 9).y) + (brick.z * count.y + brick.y) * count.x + brick.x).r;
+    if(slot < 0)
+        return(vec4(0));
+
+    ivec3 slotPos = ivec3(slot % brickAtlasSlots.x, (slot / brickAtlasSlots.x) % brickAtlasSlots.y, slot / (brickAtlasSlots.x * brickAtlasSlots.y));
+    vec3 atlasVoxel = vec3(slotPos * (brickSize + 2) + 1) + (voxel - vec3(brick * brickSize));
+    return(textureLod(brickAtlas, atlasVoxel / vec3(textureSize(brickAtlas, 0)), 0) * volumeParam(textureIndex, 13) + volumeParam(textureIndex, 14));
+}
+
+/**
+ * Mip level whose texels match the footprint of the current sample, 0 where the texels are larger than the footprint
+ */
+float textureLevel(int textureIndex)
+{
+    if(mipmapping == 0)
+        return(0.0);
+    return(max(0.0, log2(max(sampleFootprint * volumeParam(textureIndex, 10).w, 1E-6))));
+}
+
 vec4 getTexture(int textureIndex, vec3 texPos)
 {
-    vec4 jE = texture(textures[textureIndex], texPos);
+    vec4 jE;
+    vec4 storage = volumeParam(textureIndex, 9); //bricked, brickBase, macroBase, dense texture unit
+    if(storage.x < 0)
+        return(vec4(0));
+    if(storage.x == 1)
+        jE = getBrickedTexture(textureIndex, texPos);
+    else
+        jE = textureLod(textures[int(storage.w)], texPos, textureLevel(textureIndex)) * volumeParam(textureIndex, 13) + volumeParam(textureIndex, 14);
+#if TEXTURE_NORMALIZE
     if(texture_normalize == 1)
     {
         jE.rgb /= texture_norm_grey;
@@ -294,6 +435,7 @@ vec4 getTexture(int textureIndex, vec3 texPos)
         jE = floor(jE);
         jE = clamp(jE, 0, 255.0);
     }
+#endif
 
 
     //the following is for debugging without interpolation
@@ -330,7 +472,7 @@ float phaseFunction(float theta)
 
 // Yeni: Yüzey normalini yaklaşık olarak hesapla (dokudan gradient ile)
 vec3 calculateNormal(vec3 pos, int textureIndex, float ds) {
-    vec3 texPos = (texture_transform[textureIndex] * vec4(pos, 1)).xyz + 0.5;
+    vec3 texPos = (texture_transform(textureIndex) * vec4(pos, 1)).xyz + 0.5;
     if (!isValidPosition(texPos)) return vec3(0.0);
 
     // Merkezi fark yöntemiyle normal hesaplama
@@ -398,6 +540,14 @@ vec3 scatter(vec3 position, vec4 jE)
     return(jP);
 }
 
+/**
+ * True if emitters or stars light this variant's space, including outside the volumes
+ */
+bool hasLights()
+{
+    return((SCATTERING != 0 && numEmitters > 0) || (STARS != 0 && star_brightness > 0));
+}
+
 /**
  Returns the RGBA values in the volume for the given position
  */
@@ -414,9 +564,11 @@ vec4 getJ(in vec3 position, inout float ds)
     vec4 jEUnscaled = vec4(0); //unscaled, to be passed to scattering
 
     //Texture are sorted from low order to high order.  We start at the highest order and go down.
-    for (int i = 0; i < numValidTextures; i++)
+    for (int a = 0; a < activeVolumeCount(); a++)
     {
-        mat4 matrix = texture_transform[i]; //Any rotations or translations of the texture.
+        int i = activeVolume(a);
+        mat4 matrix = texture_transform(i); //Any rotations or translations of the texture.
+        vec4 factors = volumeParam(i, 8); //jscale, kscale, blend, replace
         vec3 texPos = (matrix * vec4(position, 1)).xyz + 0.5; //Figure out where we need to sample the texture from
 
         //Find out if we should render it.  If the position is outside of the cube (after our transformation above)
@@ -428,15 +580,15 @@ vec4 getJ(in vec3 position, inout float ds)
         float scale = matrix[0][0]; //This will be the scale of the volume
 
         //Figure out the transparency of this point based on distance from edge of volume
-        float weight = blendFactor(texPos, texture_blend[i]) * totalWeight;
+        float weight = blendFactor(texPos, factors.z) * totalWeight;
 
         vec4 jETex = getTexture(i, texPos).brga;     //Get the texture value at this position
         jETex *= weight; //multiply by the transparency.
 
         jEUnscaled += jETex;
 
-        jETex.rgb *= texture_jscale[i]; //Scale by any emission factors
-        jETex.a *= texture_kscale[i]; //Scale by any absorption factors
+        jETex.rgb *= factors.x; //Scale by any emission factors
+        jETex.a *= factors.y; //Scale by any absorption factors
 
         jE += jETex;
 
@@ -445,7 +597,7 @@ vec4 getJ(in vec3 position, inout float ds)
 
         totalWeight -= weight;
 
-        if(texture_replace[i] == 1 && totalWeight <= 0)
+        if(factors.w == 1 && totalWeight <= 0)
         {
             break;
         }
@@ -454,9 +606,12 @@ vec4 getJ(in vec3 position, inout float ds)
     //Now calculate the new ray step size based on which textures we passed through.
     ds = ds * custom_min(1.0, 1.0 / maxScale)*0.5;
 
+#if SCATTERING
     //Add any scattering
     jE.rgb += scatter(position, jEUnscaled);
+#endif
 
+#if STARS
     //Now do the stars
      vec4 starjE = vec4(0);
 
@@ -466,11 +621,134 @@ vec4 getJ(in vec3 position, inout float ds)
         starjE += addStar(star, position, cameraPos);
 
     jE += starjE;
+#endif
 
     return (jE);
 }
 
+/**
+ * The factor getJ scales ds by at position, without sampling the textures
+ */
+float stepScale(vec3 position)
+{
+    float maxScale = 1.0;
+    float totalWeight = 1;
+    for (int a = 0; a < activeVolumeCount(); a++)
+    {
+        int i = activeVolume(a);
+        mat4 matrix = texture_transform(i);
+        vec4 factors = volumeParam(i, 8);
+        vec3 texPos = (matrix * vec4(position, 1)).xyz + 0.5;
+        if(!isValidPosition(texPos))
+            continue;
+
+        maxScale = custom_max(matrix[0][0], maxScale);
+        totalWeight -= blendFactor(texPos, factors.z) * totalWeight;
+        if(factors.w == 1 && totalWeight <= 0)
+            break;
+    }
+    return(custom_min(1.0, 1.0 / maxScale)*0.5);
+}
+
+
+
+/**
+ * Returns how far the ray can march from t through space that holds no data in any texture,
+ * or 0 if the position may hold data.  Only positions with no emitters or stars around can be skipped.
+ * marchDir is -1 when marching back from t1 to t0, +1 when marching forward.
+ */
+float emptySpan(vec3 ray_origin, vec3 ray_direction, float t, float marchDir)
+{
+    if(hasLights())
+        return(0.0);
 
+    vec3 position = getPosition(ray_origin, ray_direction, t);
+    float span = 1e30;
+
+    for (int a = 0; a < activeVolumeCount(); a++)
+    {
+        int i = activeVolume(a);
+        mat4 matrix = texture_transform(i);
+        vec3 texPos = (matrix * vec4(position, 1)).xyz + 0.5;
+        vec3 texDir = marchDir * (mat3(matrix) * ray_direction);
+        vec3 inv_dir = 1.0 / texDir;
+
+        if(!isValidPosition(texPos))
+        {
+            //Not inside this texture yet, but the ray may enter it further on
+            vec3 tA = (vec3(0) - texPos) * inv_dir;
+            vec3 tB = (vec3(1) - texPos) * inv_dir;
+            vec3 tNear = min(tA, tB);
+            vec3 tFar = max(tA, tB);
+            float enter = max(tNear.x, max(tNear.y, tNear.z));
+            float leave = min(tFar.x, min(tFar.y, tFar.z));
+            if(enter <= leave && leave > 0)
+                span = custom_min(span, max(enter, 0.0));
+            continue;
+        }
+
+        ivec3 count = ivec3(volumeParam(i, 12).xyz);
+        if(count.x == 0 || count.y == 0 || count.z == 0)
+            return(0.0);
+
+        vec3 cellSize = vec3(macroCellSize) / vec3(texture_size(i));
+        ivec3 cell = clamp(ivec3(texPos / cellSize), ivec3(0), count - 1);
+        if(texelFetch(macroCells, int(volumeParam(i, 9).z) + (cell.z * count.y + cell.y) * count.x + cell.x).r != 0u)
+            return(0.0);
+
+        //Distance to where the ray leaves this empty cell
+        vec3 cellMin = vec3(cell) * cellSize;
+        vec3 cellMax = min(cellMin + cellSize, vec3(1));
+        vec3 tFar = max((cellMin - texPos) * inv_dir, (cellMax - texPos) * inv_dir);
+        span = custom_min(span, min(tFar.x, min(tFar.y, tFar.z)));
+    }
+
+    return(span);
+}
+
+/**
+ * Step length for adaptive sampling at the given position.  It is one voxel of the finest texture covering the position
+ * (measured along the ray) divided by samplingQuality, but never shorter than the pixel footprint at that distance.
+ * Where the opacity changes quickly (kGradient, per unit length) the step is shortened so the optical depth does not
+ * change by more than maxStepOpacityChange / samplingQuality across it.
+ */
+float adaptiveStep(vec3 position, vec3 ray_direction, float t, float kGradient)
+{
+    float voxelStep = 1e30;
+    for (int a = 0; a < activeVolumeCount(); a++)
+    {
+        int i = activeVolume(a);
+        mat4 matrix = texture_transform(i);
+        vec3 texPos = (matrix * vec4(position, 1)).xyz + 0.5;
+        if(!isValidPosition(texPos))
+            continue;
+
+        //texels crossed per unit of ray length
+        float texelsPerUnit = length(vec3(texture_size(i)) * (mat3(matrix) * ray_direction));
+        voxelStep = custom_min(voxelStep, 1.0 / max(texelsPerUnit, 1E-6));
+    }
+
+    //Outside every texture: only empty space or stars, keep the plain step
+    if(voxelStep >= 1e30)
+        voxelStep = ds0;
+
+    float ds = max(voxelStep / samplingQuality, t * pixelAngle);
+
+    if(kGradient > 1E-6)
+        ds = custom_min(ds, sqrt(maxStepOpacityChange / (samplingQuality * kGradient)));
+
+    return(max(ds, 1E-4));
+}
+
+/**
+ * How far to move past an empty span, keeping the fixed step grid unless sampling adaptively
+ */
+float skipStep(float span, float dsInit)
+{
+    if(adaptiveSampling == 1)
+        return(span + 1E-4);
+    return(dsInit * max(1.0, floor(span / dsInit)));
+}
 
 vec3 transfer(vec3 I0, vec3 jE, float k, float ds)
 {
@@ -508,16 +786,42 @@ vec3 rayTransfer(vec3 ray_origin, vec3 ray_direction, vec3 I0, float t0, float t
     if(!isOrtho)
         dsInit *= (1+t0/0.5);
 
-    for(float t = t1; t >= t0; t -= ds)
+    //Previous sample, for the opacity gradient of adaptive sampling
+    float kPrev = 0;
+    float dsPrev = dsInit;
+
+    for(float t = t1 - rayJitter * dsInit; t >= t0; t -= ds)
     {
+        //Every sample within the empty span adds nothing, so step over them all at once
+        if(emptySpaceSkipping == 1)
+        {
+            float span = emptySpan(ray_origin, ray_direction, t, -1.0);
+            if(span > 0)
+            {
+                ds = skipStep(span, dsInit);
+                kPrev = 0;
+                continue;
+            }
+        }
+
         ds = dsInit;
         vec3 position = getPosition(ray_origin, ray_direction, t);
+        sampleFootprint = t * pixelAngle;
         vec4 jE = getJ(position, ds);
 
+        if(adaptiveSampling == 1)
+        {
+            float k = jE.a * kScale;
+            ds = adaptiveStep(position, ray_direction, t, abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
         //If there is no emission/absorption, we can just keep going.  try to speed up a little
         if(length(jE) == 0)
         {
-            ds = ds * 2.0; //adjust this lower if you see artifacts
+            if(adaptiveSampling == 0)
+                ds = ds * 2.0; //adjust this lower if you see artifacts
             continue;
         }
 
@@ -531,7 +835,148 @@ vec3 rayTransfer(vec3 ray_origin, vec3 ray_direction, vec3 I0, float t0, float t
     return(I);
 }
 
-void sortIntersections(inout float array[MAX_TEXTURES * 2], int size)
+/**
+ * The light one sample adds on its own, dimmed by everything in front of it
+ */
+void frontStep(inout vec3 I, inout float T, vec4 jE, float ds)
+{
+    float k = jE.a * kScale;
+    I += T * transfer(vec3(0), jE.rgb * jScale, k, ds);
+    if(k >= 1E-3)
+        T *= exp(-k * ds);
+}
+
+/**
+ * Front to back version of rayTransfer, marching from t0 to t1.  I is the intensity gathered so far and T the
+ * transmittance from the current point to the camera, so the final intensity is I + T * (whatever lies behind).
+ * Each step is the same emission-absorption step as transfer(), applied in the other order.
+ */
+void rayTransferFront(vec3 ray_origin, vec3 ray_direction, inout vec3 I, inout float T, float t0, float t1)
+{
+    float dsInit = ds0;
+
+    //Adjust the step size for distance to volume.  The further away we are, the larger the step sizes can be.
+    if(!isOrtho)
+        dsInit *= (1+t0/0.5);
+
+    //Without adaptive sampling, start on the last sample of the back to front march so both take the same
+    //samples.  It steps by dsInit as scaled by getJ, which is taken for the volumes at the middle of the segment.
+    float tStart = t0 + rayJitter * dsInit;
+    float tEnd = t1;
+    if(adaptiveSampling == 0)
+    {
+        float tLast = t1 - rayJitter * dsInit;
+        if(tLast < t0)
+            return;
+        float dsGrid = dsInit * stepScale(getPosition(ray_origin, ray_direction, 0.5 * (t0 + t1)));
+        tStart = tLast - floor((tLast - t0) / dsGrid) * dsGrid;
+        tEnd = tLast + 0.5 * dsGrid;
+    }
+
+    //rayTransfer steps over the sample after each empty one it takes, which seen from the front drops a sample
+    //exactly when an odd run of empty samples lies behind it.  So each sample waits until that run is known.
+    vec4 pending = vec4(0);
+    float pendingDs = 0;
+    bool hasPending = false;
+    int emptyRun = 0;
+
+    float ds = dsInit;
+    float kPrev = 0;
+    float dsPrev = dsInit;
+    for(float t = tStart; t <= tEnd; t += ds)
+    {
+        //Nothing behind this point can be seen any more
+        if(T < terminationThreshold)
+            return;
+
+        if(emptySpaceSkipping == 1)
+        {
+            float span = emptySpan(ray_origin, ray_direction, t, 1.0);
+            if(span > 0)
+            {
+                ds = skipStep(span, dsInit);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        ds = dsInit;
+        vec3 position = getPosition(ray_origin, ray_direction, t);
+        sampleFootprint = t * pixelAngle;
+        vec4 jE = getJ(position, ds);
+
+        if(adaptiveSampling == 1)
+        {
+            float k = jE.a * kScale;
+            ds = adaptiveStep(position, ray_direction, t, abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
+        if(length(jE) == 0)
+        {
+            emptyRun++;
+            continue;
+        }
+
+        if(hasPending && (adaptiveSampling == 1 || emptyRun % 2 == 0))
+            frontStep(I, T, pending, pendingDs);
+        pending = jE;
+        pendingDs = max(.00001, ds);
+        hasPending = true;
+        emptyRun = 0;
+    }
+    if(hasPending && (adaptiveSampling == 1 || emptyRun % 2 == 0))
+        frontStep(I, T, pending, pendingDs);
+}
+
+/**
+ * Where the ray enters and leaves the texture of volume i, exact for any rotation, unlike the box intersection in main
+ */
+vec2 volumeSpan(int i, vec3 ray_origin, vec3 ray_direction)
+{
+    mat4 matrix = texture_transform(i);
+    vec3 texPos = (matrix * vec4(ray_origin, 1)).xyz + 0.5;
+    vec3 inv_dir = 1.0 / (mat3(matrix) * ray_direction);
+    vec3 tA = (vec3(0) - texPos) * inv_dir;
+    vec3 tB = (vec3(1) - texPos) * inv_dir;
+    vec3 tNear = min(tA, tB);
+    vec3 tFar = max(tA, tB);
+    return(vec2(max(tNear.x, max(tNear.y, tNear.z)), min(tFar.x, min(tFar.y, tFar.z))));
+}
+
+/**
+ * Volume of the k-th candidate for this pixel: from the tile list when culling, else every volume
+ */
+int candidateVolume(int tileBase, int k)
+{
+    if(tileBase < 0)
+        return(k);
+    return(texelFetch(tileVolumes, tileBase + k).r);
+}
+
+/**
+ * Makes the volumes the ray passes through between t0 and t1 the active set, so samples there test nothing else.
+ * Returns false if no volume can contribute to the segment.
+ */
+bool selectSegmentVolumes(float t0, float t1)
+{
+    allVolumesActive = !rayVolumesComplete;
+    if(allVolumesActive)
+        return(true);
+
+    numActiveVolumes = 0;
+    for(int k = 0; k < numRayVolumes; k++)
+    {
+        if(rayVolumeSpans[k].x <= t1 && rayVolumeSpans[k].y >= t0)
+            activeVolumes[numActiveVolumes++] = rayVolumes[k];
+    }
+
+    //Stars and emitters light up space outside the volumes too
+    return(numActiveVolumes > 0 || hasLights());
+}
+
+void sortIntersections(inout float array[MAX_RAY_VOLUMES * 2], int size)
 {
     for (int j = 1; j < size; ++j)
     {
@@ -561,11 +1006,44 @@ void main()
     //distance of pixel from center, r = 0 to 1
     float r = length(fragCoord.xy-0.5);
 
-    float array[MAX_TEXTURES * 2];
+    float array[MAX_RAY_VOLUMES * 2];
     int numTs = 0;
 
+    //Extent of all the volumes the ray hits, including any that no longer fit in the array
+    float tFirst = 1e30;
+    float tLast = -1e30;
+
+    //Candidate volumes for this pixel, from its screen tile when culling
+    int tileBase = -1;
+    int numCandidates = volumeCount();
+    if(volumeCulling == 1)
+    {
+        ivec2 tile = clamp(ivec2(gl_FragCoord.xy) / tileSize, ivec2(0), tileCount - 1);
+        int entry = (tile.y * tileCount.x + tile.x) * 2;
+        tileBase = texelFetch(tileVolumes, entry).r;
+        numCandidates = texelFetch(tileVolumes, entry + 1).r;
+    }
+
+    //The volumes the ray really passes through, kept in slot order for getJ
+    for(int k = 0; k < numCandidates; k++)
+    {
+        int i = candidateVolume(tileBase, k);
+        vec2 span = volumeSpan(i, ray_origin, ray_direction);
+        if(span.x >= span.y || span.y <= 0)
+            continue;
+
+        if(numRayVolumes == MAX_RAY_VOLUMES)
+        {
+            rayVolumesComplete = false;
+            break;
+        }
+        rayVolumes[numRayVolumes] = i;
+        rayVolumeSpans[numRayVolumes] = span;
+        numRayVolumes++;
+    }
+
     //If we have stars around, we have to cover the entire volume
-    if(star_brightness > 0)
+    if(STARS != 0 && star_brightness > 0)
     {
         vec2 intersectionArray =  intersect_box(ray_origin, ray_direction, box_min0, box_max0);
 
@@ -585,10 +1063,12 @@ void main()
     else
     {
 
-        for(int i = 0; i < numValidTextures; i++)
+        for(int k = 0; k < numCandidates; k++)
         {
+            int i = candidateVolume(tileBase, k);
+
              //Figure out where this volume intersects the ray
-            mat4 iMatrix =  texture_iTransform[i];
+            mat4 iMatrix =  texture_iTransform(i);
             vec3 box_min = (iMatrix * vec4(box_min0, 1) ).xyz;
             vec3 box_max = (iMatrix * vec4(box_max0, 1) ).xyz;
 
@@ -603,6 +1083,11 @@ void main()
                 continue;
             }
 
+            tFirst = custom_min(tFirst, t);
+            tLast = custom_max(tLast, s);
+            if(numTs == MAX_RAY_VOLUMES * 2)
+                continue;
+
             array[numTs++] = t;
             array[numTs++] = s;
         }
@@ -618,21 +1103,45 @@ void main()
 
     sortIntersections(array, numTs);
 
+    //Boundaries that did not fit are merged: consecutive pairs still cover every volume hit
+    array[0] = custom_min(array[0], tFirst);
+    array[numTs-1] = custom_max(array[numTs-1], tLast);
+
     //If the first hit is beyond 10, we can assume we are ortho
     if(array[0] > 10.0)
         isOrtho = true;
 
     vec3 I = backgroundColor;
-    //Now we cast a ray for each pair of intersections (i.e. volumes) that we travel through
-    for(int i = numTs-1; i > 0; i--)
+    if(frontToBack == 1)
     {
-        int index0 = i-1;
-        int index1 = i;
+        //Nearest pair of intersections first, stopping once the ray is opaque
+        vec3 IFront = vec3(0);
+        float T = 1;
+        for(int i = 1; i < numTs; i++)
+        {
+            if(!selectSegmentVolumes(array[i-1], array[i]))
+                continue;
+            rayTransferFront(ray_origin, ray_direction, IFront, T, array[i-1], array[i]);
+            if(T < terminationThreshold)
+                break;
+        }
+        I = IFront + T * backgroundColor;
+    }
+    else
+    {
+        //Now we cast a ray for each pair of intersections (i.e. volumes) that we travel through
+        for(int i = numTs-1; i > 0; i--)
+        {
+            int index0 = i-1;
+            int index1 = i;
 
-        float t0 = array[index0];
-        float t1 = array[index1];
+            float t0 = array[index0];
+            float t1 = array[index1];
 
-        I = rayTransfer(ray_origin, ray_direction, I, t0, t1);
+            if(!selectSegmentVolumes(t0, t1))
+                continue;
+            I = rayTransfer(ray_origin, ray_direction, I, t0, t1);
+        }
     }
 
     fragColor = vec4(I * exposure, 1);
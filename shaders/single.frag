@@ -2,15 +2,53 @@
 
 uniform sampler3D tex;
 
+//For a bricked (sparse) texture, sampled from the brick atlas instead of tex;
+//-1 while tex is still streaming in, which then reads as empty
+uniform int bricked = 0;
+uniform ivec3 texSize;
+uniform ivec3 brickCount;
+uniform int brickBase = 0;
+uniform sampler3D brickAtlas;
+uniform isamplerBuffer brickIndex;
+uniform ivec3 brickAtlasSlots = ivec3(1);
+uniform int brickSize = 16;
+
+//Texels stored as scaled bytes decode as value * channelScale + channelBias, per stored channel
+uniform vec4 channelScale = vec4(1);
+uniform vec4 channelBias = vec4(0);
+
+//Empty space skipping: macro cells of macroCellSize^3 texels, non-zero where the cell may hold data
+uniform int emptySpaceSkipping = 1;
+uniform usamplerBuffer macroCells;
+uniform int macroBase = 0;
+uniform ivec3 macroCount; //0 if there is no grid
+uniform int macroCellSize = 8;
+
+//Front to back compositing with early termination
+uniform int frontToBack = 0;
+uniform float terminationThreshold = 0.001; //Transmittance below which the rest of the ray is ignored
+
+//Adaptive sampling: the step follows the data instead of ds0
+uniform int adaptiveSampling = 0;
+uniform float samplingQuality = 2; //Samples per voxel
+uniform float pixelAngle = 0.0017; //Angle covered by one pixel, for the footprint of a sample
+uniform float maxStepOpacityChange = 0.05; //Largest change of optical depth across one step at quality 1
+
+//Level of detail: a dense texture carries a mip chain, sampled at the level matching the pixel footprint
+uniform int mipmapping = 1;
+
 out vec4 fragColor;
 
 uniform float jScale = 1;
 uniform float kScale = 1;
 uniform float ds0 = .01;
+uniform float rayJitter = 0; //Offset of the first sample as a fraction of a step, varied per frame when refining
 
 in vec3 cameraPos;
 in vec3 rayDir;
 
+float sampleFootprint = 0; //Width the current sample covers, the pixel footprint at its distance (set by the march loops)
+
 float boxSize = 0.5; //using slightly less than .5 removes dots from result when camera is very close in
 
 vec3 box_min = -vec3(boxSize);
@@ -37,13 +75,85 @@ vec3 getPosition(vec3 ray_origin, vec3 ray_direction, float t)
     return(pos);
 }
 
+vec4 getBrickedTexture(vec3 texPos)
+{
+    vec3 voxel = clamp(texPos, 0.0, 1.0) * vec3(texSize);
+    ivec3 brick = clamp(ivec3(voxel) / brickSize, ivec3(0), brickCount - 1);
+
+    int slot = texelFetch(brickIndex, brickBase + (brick.z * brickCount.y + brick.y) * brickCount.x + brick.x).r;
+    if(slot < 0)
+        return(vec4(0));
+
+    ivec3 slotPos = ivec3(slot % brickAtlasSlots.x, (slot / brickAtlasSlots.x) % brickAtlasSlots.y, slot / (brickAtlasSlots.x * brickAtlasSlots.y));
+    vec3 atlasVoxel = vec3(slotPos * (brickSize + 2) + 1) + (voxel - vec3(brick * brickSize));
+    return(textureLod(brickAtlas, atlasVoxel / vec3(textureSize(brickAtlas, 0)), 0) * channelScale + channelBias);
+}
+
 vec4 getJ(in vec3 position, vec3 ray_origin)
 {
     vec3 texPos = position.xyz + (0.5);
-    vec4 jE = texture(tex, texPos).bgra;
+    vec4 jE;
+    if(bricked < 0)
+        return(vec4(0));
+    if(bricked == 1)
+        jE = getBrickedTexture(texPos).bgra;
+    else
+    {
+        //Mip level whose texels match the sample footprint
+        float level = mipmapping == 1 ? max(0.0, log2(max(sampleFootprint * float(max(texSize.x, max(texSize.y, texSize.z))), 1E-6))) : 0.0;
+        jE = (textureLod(tex, texPos, level) * channelScale + channelBias).bgra;
+    }
     return(jE);
 }
 
+/**
+ * Returns how far the ray can march from t through empty macro cells, 0 if the position may hold data.
+ * marchDir is -1 when marching back from t1 to t0, +1 when marching forward.
+ */
+float emptySpan(vec3 ray_origin, vec3 ray_direction, float t, float marchDir)
+{
+    if(macroCount.x == 0 || macroCount.y == 0 || macroCount.z == 0)
+        return(0.0);
+
+    vec3 texPos = clamp(getPosition(ray_origin, ray_direction, t) + 0.5, 0.0, 1.0);
+    vec3 cellSize = vec3(macroCellSize) / vec3(texSize);
+    ivec3 cell = clamp(ivec3(texPos / cellSize), ivec3(0), macroCount - 1);
+    if(texelFetch(macroCells, macroBase + (cell.z * macroCount.y + cell.y) * macroCount.x + cell.x).r != 0u)
+        return(0.0);
+
+    //Distance to where the ray leaves this empty cell
+    vec3 inv_dir = 1.0 / (marchDir * ray_direction);
+    vec3 cellMin = vec3(cell) * cellSize;
+    vec3 cellMax = min(cellMin + cellSize, vec3(1));
+    vec3 tFar = max((cellMin - texPos) * inv_dir, (cellMax - texPos) * inv_dir);
+    return(min(tFar.x, min(tFar.y, tFar.z)));
+}
+
+/**
+ * Step length for adaptive sampling: one voxel along the ray divided by samplingQuality, never shorter than the
+ * pixel footprint, and shortened where the opacity changes quickly (kGradient, per unit length).
+ */
+float adaptiveStep(vec3 ray_direction, float t, float kGradient)
+{
+    float voxelStep = 1.0 / max(length(vec3(texSize) * ray_direction), 1E-6);
+    float ds = max(voxelStep / samplingQuality, t * pixelAngle);
+
+    if(kGradient > 1E-6)
+        ds = min(ds, sqrt(maxStepOpacityChange / (samplingQuality * kGradient)));
+
+    return(max(ds, 1E-4));
+}
+
+/**
+ * How far to move past an empty span, keeping the fixed step grid unless sampling adaptively
+ */
+float skipStep(float span)
+{
+    if(adaptiveSampling == 1)
+        return(span + 1E-4);
+    return(ds0 * max(1.0, floor(span / ds0)));
+}
+
 float when_eq(float x, float y)
 {
   return 1.0 - abs(sign(x - y));
@@ -73,11 +183,36 @@ vec3 rayTransfer(vec3 ray_origin, vec3 ray_direction, vec3 I0, float t0, float t
     //The final intensity of the ray
     vec3 I = vec3(I0);
 
+    //Previous sample, for the opacity gradient of adaptive sampling
+    float kPrev = 0;
+    float dsPrev = ds0;
+
     //for(float t = t0; t <= t1; t += ds)
-    for(float t = t1; t >= t0; t -= ds)
+    for(float t = t1 - rayJitter * ds0; t >= t0; t -= ds)
     {
+        //Every sample within the empty span adds nothing, so step over them all at once
+        ds = ds0;
+        if(emptySpaceSkipping == 1)
+        {
+            float span = emptySpan(ray_origin, ray_direction, t, -1.0);
+            if(span > 0)
+            {
+                ds = skipStep(span);
+                kPrev = 0;
+                continue;
+            }
+        }
+
         vec3 position = getPosition(ray_origin, ray_direction, t);
+        sampleFootprint = t * pixelAngle;
         vec4 jE = getJ(position, ray_origin);
+        if(adaptiveSampling == 1)
+        {
+            float k = jE.a * kScale;
+            ds = adaptiveStep(ray_direction, t, abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
         //Add the emission from this cell
         I = transfer(I, jE.rgb * jScale, jE.a * kScale, ds);
     }
@@ -85,6 +220,60 @@ vec3 rayTransfer(vec3 ray_origin, vec3 ray_direction, vec3 I0, float t0, float t
     return(I);
 }
 
+/**
+ * Front to back version of rayTransfer over the same samples, with early termination.  T is the transmittance
+ * to the camera, so the result is the gathered intensity plus T times I0 from behind the volume.
+ */
+vec3 rayTransferFront(vec3 ray_origin, vec3 ray_direction, vec3 I0, float t0, float t1)
+{
+    vec3 I = vec3(0);
+    float T = 1;
+    float ds = ds0;
+
+    float kPrev = 0;
+    float dsPrev = ds0;
+
+    //Start on the last sample of the back to front march so both take the same samples
+    float tLast = t1 - rayJitter * ds0;
+    float tStart = adaptiveSampling == 1 ? t0 + rayJitter * ds0 : tLast - floor((tLast - t0) / ds0) * ds0;
+    //Half a step of slack, so rounding in t cannot lose that last sample
+    float tEnd = adaptiveSampling == 1 ? t1 : tLast + 0.5 * ds0;
+    for(float t = tStart; t <= tEnd; t += ds)
+    {
+        if(T < terminationThreshold)
+            break;
+
+        ds = ds0;
+        if(emptySpaceSkipping == 1)
+        {
+            float span = emptySpan(ray_origin, ray_direction, t, 1.0);
+            if(span > 0)
+            {
+                ds = skipStep(span);
+                kPrev = 0;
+                continue;
+            }
+        }
+
+        vec3 position = getPosition(ray_origin, ray_direction, t);
+        sampleFootprint = t * pixelAngle;
+        vec4 jE = getJ(position, ray_origin);
+        float k = jE.a * kScale;
+        if(adaptiveSampling == 1)
+        {
+            ds = adaptiveStep(ray_direction, t, abs(k - kPrev) / dsPrev);
+            kPrev = k;
+            dsPrev = ds;
+        }
+
+        //The light this step adds on its own, dimmed by everything in front of it
+        I += T * transfer(vec3(0), jE.rgb * jScale, k, ds);
+        T *= mix(exp(-k * ds), 1.0, when_eq(k, 0));
+    }
+
+    return(I + T * I0);
+}
+
 void main()
 {
    //The ray
@@ -102,6 +291,10 @@ void main()
         discard;
     }
 
-    vec3 I = rayTransfer(ray_origin, ray_direction, vec3(0,0,0), t0, t1);
+    vec3 I;
+    if (frontToBack == 1)
+        I = rayTransferFront(ray_origin, ray_direction, vec3(0,0,0), t0, t1);
+    else
+        I = rayTransfer(ray_origin, ray_direction, vec3(0,0,0), t0, t1);
     fragColor = vec4(I, 1);
 }
@@ -0,0 +1,8 @@
+# The SSE2 texel kernels in onereader.cpp and onecpurenderer.cpp build on any
+# x86-64 target; the SSSE3 record byte swap in onereader.cpp is compiled in only
+# when the compiler targets SSSE3. GCC and Clang get SSSE3; MSVC has no SSSE3
+# switch, so it gets AVX, which implies it.
+contains(QT_ARCH, x86_64)|contains(QT_ARCH, i386) {
+    msvc: QMAKE_CXXFLAGS += $$QMAKE_CFLAGS_AVX
+    else: QMAKE_CXXFLAGS += $$QMAKE_CFLAGS_SSSE3
+}
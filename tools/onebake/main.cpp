@@ -0,0 +1,114 @@
+// main.cpp (onebake: converts .ONE files to the pre-baked .onec format)
+#include "onereader.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("onebake");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts .ONE files (or whole directories of them) to .onec.");
+    parser.addHelpOption();
+    QCommandLineOption brickedOption("bricked", "Bake sparse bricks instead of dense textures.");
+    QCommandLineOption recursiveOption({"r", "recursive"}, "Descend into subdirectories.");
+    QCommandLineOption outputOption({"o", "output"},
+                                    "Write .onec files to <dir> instead of next to their sources.", "dir");
+    QCommandLineOption forceOption({"f", "force"}, "Rebake files whose .onec is up to date.");
+    QCommandLineOption compareOption("compare", "Time loading each .ONE against its .onec.");
+    parser.addOption(brickedOption);
+    parser.addOption(recursiveOption);
+    parser.addOption(outputOption);
+    parser.addOption(forceOption);
+    parser.addOption(compareOption);
+    parser.addPositionalArgument("paths", ".ONE files or directories to convert.", "<path>...");
+    parser.process(app);
+
+    QTextStream out(stdout);
+    if (parser.positionalArguments().isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    QStringList files;
+    for (const QString& path : parser.positionalArguments()) {
+        if (QFileInfo(path).isDir()) {
+            QDirIterator it(path, QStringList{"*.one", "*.ONE"}, QDir::Files,
+                            parser.isSet(recursiveOption) ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+            while (it.hasNext()) {
+                files << it.next();
+            }
+        } else {
+            files << path;
+        }
+    }
+
+    QString outputDir = parser.value(outputOption);
+    if (!outputDir.isEmpty() && !QDir().mkpath(outputDir)) {
+        out << "Cannot create output directory " << outputDir << "\n";
+        return 1;
+    }
+
+    OneReader reader;
+    reader.setStorageMode(parser.isSet(brickedOption) ? OneReader::BrickedStorage : OneReader::DenseStorage);
+    reader.setUseBaked(false);  // Always decode the .ONE itself
+    reader.setMipmaps(false);   // Mip chains are not baked; the viewer builds them at load
+
+    int failures = 0;
+    for (const QString& file : files) {
+        QFileInfo info(file);
+        QString target = outputDir.isEmpty() ? OneReader::bakedFileName(file)
+                                             : QDir(outputDir).filePath(info.completeBaseName() + ".onec");
+
+        QFileInfo targetInfo(target);
+        if (!parser.isSet(forceOption) && targetInfo.exists() && targetInfo.lastModified() >= info.lastModified()) {
+            out << file << ": up to date\n";
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        OneReader::SceneHandle scene = reader.loadScene(file);
+        if (!scene) {
+            out << file << ": failed to load\n";
+            ++failures;
+            continue;
+        }
+        qint64 decodeMs = timer.restart();
+
+        if (!OneReader::saveBaked(*scene, target)) {
+            out << file << ": failed to write " << target << "\n";
+            ++failures;
+            continue;
+        }
+        qint64 writeMs = timer.elapsed();
+        out << file << " -> " << target << " (decode " << decodeMs << " ms, write " << writeMs << " ms, "
+            << QString::number(QFileInfo(target).size() / 1048576.0, 'f', 1) << " MB)\n";
+
+        if (parser.isSet(compareOption)) {
+            // Both timings cover header parsing and texel availability; the .onec
+            // payload is paged in lazily on first use, as it would be at upload
+            timer.restart();
+            OneReader::SceneHandle baked = reader.loadScene(target);
+            qint64 bakedMs = std::max<qint64>(1, timer.elapsed());
+            if (!baked || baked->textures.size() != scene->textures.size()
+                || baked->memoryBytes() != scene->memoryBytes()) {
+                out << "  reloading " << target << " gave a different scene\n";
+                ++failures;
+                continue;
+            }
+            out << "  load .ONE " << decodeMs << " ms, .onec " << bakedMs << " ms ("
+                << QString::number(double(decodeMs) / bakedMs, 'f', 1) << "x)\n";
+        }
+        out.flush();
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,18 @@
+QT       += core concurrent
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+include(../../simd.pri)
+
+TARGET = onebake
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../onereader.cpp
+
+HEADERS += \
+    ../../onereader.h
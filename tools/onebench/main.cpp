@@ -0,0 +1,450 @@
+// main.cpp (onebench: loader and renderer benchmarks over synthetic or given .ONE files)
+#define _USE_MATH_DEFINES // For M_PI in MSVC
+#include "onecpurenderer.h"
+#include "onegenerator.h"
+#include "onereader.h"
+#include "onerenderer.h"
+#include "oneview.h"
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QApplication>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+namespace {
+
+bool verbose = false;
+
+// The loader logs every load; only worth seeing with --verbose
+void messageHandler(QtMsgType type, const QMessageLogContext& context, const QString& message) {
+    if (type == QtDebugMsg && !verbose) return;
+    QTextStream(stderr) << qFormatLogMessage(type, context, message) << "\n";
+}
+
+// Peak resident memory of the process in MB, -1 where it cannot be read
+double peakRssMB() {
+#if defined(Q_OS_LINUX)
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        for (const QByteArray& line : status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toDouble() / 1024.0; // kB
+            }
+        }
+    }
+    return -1.0;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / 1048576.0;
+    }
+    return -1.0;
+#else
+    return -1.0;
+#endif
+}
+
+// Starts a new peak, so each load reports its own. Only Linux can do this; elsewhere
+// the peak covers the whole run so far.
+void resetPeakRss() {
+#if defined(Q_OS_LINUX)
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+#endif
+}
+
+double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    const size_t rank = static_cast<size_t>(std::ceil(fraction * values.size()));
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+struct Case {
+    QString name;
+    OneGenerator::Options options;
+};
+
+// The generated suite: a dense and a sparse single volume, and two nesting depths
+QList<Case> suite(bool quick) {
+    const int scale = quick ? 2 : 1;
+    QList<Case> cases;
+    Case dense{"dense-float", {}};
+    dense.options.resolution = 128 / scale;
+    cases << dense;
+
+    Case sparse{"sparse-float", {}};
+    sparse.options.resolution = 192 / scale;
+    sparse.options.density = 0.1f;
+    cases << sparse;
+
+    Case nestedByte{"nested-byte", {}};
+    nestedByte.options.volumes = 6;
+    nestedByte.options.resolution = 64 / scale;
+    nestedByte.options.density = 0.5f;
+    nestedByte.options.floatTexels = false;
+    nestedByte.options.nestRotation = 15.0f;
+    cases << nestedByte;
+
+    Case nestedFloat{"nested-float", {}};
+    nestedFloat.options.volumes = 12;
+    nestedFloat.options.resolution = 64 / scale;
+    nestedFloat.options.density = 0.3f;
+    nestedFloat.options.nestScale = 0.7f;
+    nestedFloat.options.nestRotation = 20.0f;
+    cases << nestedFloat;
+    return cases;
+}
+
+// Times uploading every dense texture of a scene, all its mip levels at the
+// precision the renderer would use, on an offscreen 3.3 core context
+class UploadBench {
+public:
+    bool initialize() {
+        QSurfaceFormat format;
+        format.setVersion(3, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+        m_context.setFormat(format);
+        m_surface.setFormat(format);
+        m_surface.create();
+        if (!m_context.create() || !m_context.makeCurrent(&m_surface)) return false;
+        m_gl = m_context.versionFunctions<QOpenGLFunctions_3_3_Core>();
+        return m_gl && m_gl->initializeOpenGLFunctions();
+    }
+
+    QString renderer() const {
+        return QString::fromLatin1(reinterpret_cast<const char*>(m_gl->glGetString(GL_RENDERER)));
+    }
+
+    QJsonObject upload(const OneReader::SceneData& scene) {
+        m_context.makeCurrent(&m_surface); // The GL renderer's context may be current
+        QElapsedTimer timer;
+        timer.start();
+        qint64 bytes = 0;
+        QVector<GLuint> textures;
+        for (const OneReader::Texture& tex : scene.textures) {
+            if (tex.isBricked || tex.valueCount() == 0) continue;
+
+            GLenum internalFormat = GL_RGBA8;
+            GLenum type = GL_UNSIGNED_BYTE;
+            if (tex.isFloat && tex.gpuPrecision == OneReader::Float16Precision) {
+                internalFormat = GL_RGBA16F;
+                type = GL_HALF_FLOAT;
+            } else if (tex.isFloat && tex.gpuPrecision == OneReader::Float32Precision) {
+                internalFormat = GL_RGBA32F;
+                type = GL_FLOAT;
+            }
+
+            GLuint texture = 0;
+            m_gl->glGenTextures(1, &texture);
+            m_gl->glBindTexture(GL_TEXTURE_3D, texture);
+            textures << texture;
+            for (int level = 0; level <= static_cast<int>(tex.mips.size()); ++level) {
+                const OneReader::Texture::MipLevel* mip = level > 0 ? &tex.mips[level - 1] : nullptr;
+                const void* texels = mip ? mip->byteData.data() : tex.byteTexels();
+                size_t dataSize = mip ? mip->byteData.size() : tex.valueCount();
+                if (tex.isFloat) {
+                    if (tex.gpuPrecision == OneReader::Float16Precision) {
+                        texels = mip ? mip->halfTexels.data() : tex.halfTexels.data();
+                        dataSize = (mip ? mip->halfTexels.size() : tex.halfTexels.size()) * sizeof(quint16);
+                    } else if (tex.gpuPrecision == OneReader::Scaled8Precision) {
+                        texels = mip ? mip->scaledTexels.data() : tex.scaledTexels.data();
+                        dataSize = mip ? mip->scaledTexels.size() : tex.scaledTexels.size();
+                    } else {
+                        texels = mip ? mip->data.data() : tex.floatTexels();
+                        dataSize = (mip ? mip->data.size() : tex.valueCount()) * sizeof(float);
+                    }
+                }
+                m_gl->glTexImage3D(GL_TEXTURE_3D, level, internalFormat, mip ? mip->sizeX : tex.sizeX,
+                                   mip ? mip->sizeY : tex.sizeY, mip ? mip->sizeZ : tex.sizeZ, 0, GL_RGBA, type, texels);
+                bytes += dataSize;
+            }
+        }
+        m_gl->glFinish();
+        const qint64 nsecs = timer.nsecsElapsed();
+        m_gl->glDeleteTextures(textures.size(), textures.constData());
+
+        QJsonObject result;
+        result["textures"] = textures.size();
+        result["mb"] = bytes / 1048576.0;
+        result["ms"] = nsecs / 1e6;
+        result["mbPerSecond"] = nsecs > 0 ? bytes / 1048576.0 / (nsecs / 1e9) : 0.0;
+        return result;
+    }
+
+private:
+    QOpenGLContext m_context;
+    QOffscreenSurface m_surface;
+    QOpenGLFunctions_3_3_Core* m_gl = nullptr;
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv); // For the offscreen GL context and the GL renderer's widget
+    QCoreApplication::setApplicationName("onebench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks loading, texture upload and CPU and GL rendering of .ONE files. "
+                                     "Without files, a synthetic suite is generated first.");
+    parser.addHelpOption();
+    QCommandLineOption jsonOption("json", "Write the results as JSON to <file> (- for stdout).", "file");
+    QCommandLineOption repeatOption("repeat", "Loads per file and mode (default 3).", "n", "3");
+    QCommandLineOption framesOption("frames", "Frames along the camera path (default 8).", "n", "8");
+    QCommandLineOption sizeOption("size", "Render size (default 640x480).", "WxH", "640x480");
+    QCommandLineOption quickOption("quick", "Generate a smaller suite.");
+    QCommandLineOption keepOption("keep", "Generate the suite into <dir> and keep it.", "dir");
+    QCommandLineOption noGlOption("no-gl", "Skip the texture upload and GL render benchmarks.");
+    QCommandLineOption verboseOption("verbose", "Show the loader's log.");
+    parser.addOption(jsonOption);
+    parser.addOption(repeatOption);
+    parser.addOption(framesOption);
+    parser.addOption(sizeOption);
+    parser.addOption(quickOption);
+    parser.addOption(keepOption);
+    parser.addOption(noGlOption);
+    parser.addOption(verboseOption);
+    parser.addPositionalArgument("files", ".ONE files to benchmark instead of the generated suite.", "[<file>...]");
+    parser.process(app);
+
+    verbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(messageHandler);
+
+    // With the JSON on stdout, the readable summary goes to stderr
+    const bool jsonToStdout = parser.value(jsonOption) == "-";
+    QTextStream out(jsonToStdout ? stderr : stdout);
+    const int repeat = std::max(1, parser.value(repeatOption).toInt());
+    const int frames = std::max(1, parser.value(framesOption).toInt());
+    const QStringList sizeParts = parser.value(sizeOption).toLower().split('x');
+    const QSize size(sizeParts.value(0).toInt(), sizeParts.value(1).toInt());
+    if (size.isEmpty()) {
+        out << "Invalid --size\n";
+        return 1;
+    }
+
+    // Files to run: the given ones, or the generated suite
+    QList<QPair<QString, QString>> files; // Name, path
+    QTemporaryDir tempDir;
+    if (!parser.positionalArguments().isEmpty()) {
+        for (const QString& file : parser.positionalArguments()) {
+            files << qMakePair(QFileInfo(file).completeBaseName(), file);
+        }
+    } else {
+        const QString dir = parser.isSet(keepOption) ? parser.value(keepOption) : tempDir.path();
+        if (!QDir().mkpath(dir)) {
+            out << "Cannot create " << dir << "\n";
+            return 1;
+        }
+        for (const Case& c : suite(parser.isSet(quickOption))) {
+            const QString path = QDir(dir).filePath(c.name + ".one");
+            QElapsedTimer timer;
+            timer.start();
+            if (!OneGenerator::write(path, c.options)) {
+                out << "Cannot generate " << path << "\n";
+                return 1;
+            }
+            out << "Generated " << path << " (" << QString::number(QFileInfo(path).size() / 1048576.0, 'f', 1)
+                << " MB) in " << timer.elapsed() << " ms\n";
+            files << qMakePair(c.name, path);
+        }
+    }
+
+    UploadBench uploads;
+    const bool gl = !parser.isSet(noGlOption) && uploads.initialize();
+    if (!parser.isSet(noGlOption) && !gl) {
+        out << "No OpenGL 3.3 context, skipping the upload and GL render benchmarks\n";
+    }
+    // The viewer's renderer, drawing nested.frag offscreen along the same camera path
+    std::unique_ptr<OneRenderer> glRenderer;
+    if (gl) {
+        glRenderer.reset(new OneRenderer);
+        glRenderer->setNestedMode(true);
+        glRenderer->resize(size);
+        glRenderer->show();
+        QCoreApplication::processEvents();
+    }
+
+    struct LoadMode {
+        const char* name;
+        OneReader::LoadMode load;
+        OneReader::StorageMode storage;
+    };
+    const LoadMode loadModes[] = {{"mapped-dense", OneReader::MappedLoad, OneReader::DenseStorage},
+                                  {"stream-dense", OneReader::StreamLoad, OneReader::DenseStorage},
+                                  {"mapped-bricked", OneReader::MappedLoad, OneReader::BrickedStorage}};
+
+    QJsonArray results;
+    int failures = 0;
+    for (const auto& file : files) {
+        const double fileMB = QFileInfo(file.second).size() / 1048576.0;
+        out << file.first << " (" << QString::number(fileMB, 'f', 1) << " MB)\n";
+        QJsonObject result;
+        result["name"] = file.first;
+        result["file"] = file.second;
+        result["fileMB"] = fileMB;
+
+        // Parse speed and peak memory per load path. No scene outlives its load,
+        // so each peak covers that load alone.
+        OneReader reader;
+        reader.setUseBaked(false);
+        QJsonArray loads;
+        for (const LoadMode& mode : loadModes) {
+            reader.setLoadMode(mode.load);
+            reader.setStorageMode(mode.storage);
+            std::vector<double> times;
+            double peak = -1.0;
+            for (int i = 0; i < repeat; ++i) {
+                resetPeakRss();
+                QElapsedTimer timer;
+                timer.start();
+                OneReader::SceneHandle loaded = reader.loadScene(file.second);
+                times.push_back(timer.nsecsElapsed() / 1e6);
+                peak = std::max(peak, peakRssMB());
+                if (!loaded) break;
+            }
+            if (static_cast<int>(times.size()) < repeat) {
+                out << "  " << mode.name << ": failed to load\n";
+                ++failures;
+                continue;
+            }
+
+            const double median = percentile(times, 0.5);
+            QJsonObject load;
+            load["mode"] = mode.name;
+            load["medianMs"] = median;
+            load["bestMs"] = *std::min_element(times.begin(), times.end());
+            load["mbPerSecond"] = fileMB / std::max(1e-6, median / 1000.0);
+            load["peakRssMB"] = peak >= 0.0 ? QJsonValue(peak) : QJsonValue();
+            loads << load;
+            out << "  load " << mode.name << ": " << QString::number(median, 'f', 1) << " ms, "
+                << QString::number(load["mbPerSecond"].toDouble(), 'f', 1) << " MB/s, peak RSS "
+                << (peak >= 0.0 ? QString::number(peak, 'f', 0) + " MB" : QString("n/a")) << "\n";
+        }
+        result["load"] = loads;
+
+        // The upload and render benchmarks get a load of their own, once the peaks are in
+        reader.setLoadMode(OneReader::MappedLoad);
+        reader.setStorageMode(OneReader::DenseStorage);
+        const OneReader::SceneHandle scene = reader.loadScene(file.second);
+        if (!scene) {
+            results << result;
+            continue;
+        }
+        result["volumes"] = scene->volumes.size();
+        result["textureMB"] = scene->memoryBytes() / 1048576.0;
+
+        if (gl) {
+            const QJsonObject upload = uploads.upload(*scene);
+            result["upload"] = upload;
+            out << "  upload: " << QString::number(upload["ms"].toDouble(), 'f', 1) << " ms, "
+                << QString::number(upload["mbPerSecond"].toDouble(), 'f', 0) << " MB/s\n";
+        }
+
+        // Fixed camera path: an orbit that also swings in and out, the same for every run
+        QVector<QMatrix4x4> views;
+        for (int frame = 0; frame < frames; ++frame) {
+            const float phase = 2.0f * float(M_PI) * frame / frames;
+            const QQuaternion rotation = QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 360.0f * frame / frames)
+                                       * QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, 20.0f);
+            views << OneView::viewMatrix(rotation, 1.5f + 0.5f * std::sin(phase));
+        }
+
+        OneCpuRenderer renderer;
+        OneCpuRenderer::Settings settings;
+        settings.size = size;
+        settings.projectionMatrix = OneView::projectionMatrix(size);
+        std::vector<float> image;
+        std::vector<double> frameTimes;
+        qint64 rays = 0;
+        qint64 renderNs = 0;
+        for (const QMatrix4x4& view : views) {
+            settings.viewMatrix = view;
+            renderer.render(*scene, settings, image);
+            frameTimes.push_back(renderer.lastStats().nsecs / 1e6);
+            rays += renderer.lastStats().rays;
+            renderNs += renderer.lastStats().nsecs;
+        }
+        QJsonObject render;
+        render["renderer"] = "cpu";
+        render["width"] = size.width();
+        render["height"] = size.height();
+        render["frames"] = frames;
+        render["threads"] = renderer.lastStats().threads;
+        render["meanMs"] = renderNs / 1e6 / frames;
+        render["p50Ms"] = percentile(frameTimes, 0.5);
+        render["p95Ms"] = percentile(frameTimes, 0.95);
+        render["raysPerSecond"] = renderNs > 0 ? rays * 1e9 / renderNs : 0.0;
+        result["render"] = render;
+        out << "  render cpu: " << QString::number(render["p50Ms"].toDouble(), 'f', 1) << " ms p50, "
+            << QString::number(render["p95Ms"].toDouble(), 'f', 1) << " ms p95, "
+            << QString::number(render["raysPerSecond"].toDouble() / 1e6, 'f', 2) << " Mrays/s\n";
+
+        // GPU time of each nested.frag draw, so shader changes show up here
+        if (glRenderer) {
+            glRenderer->setScene(scene);
+            const std::vector<double> gpuTimes = glRenderer->timeViews(views, size);
+            glRenderer->setScene(nullptr);
+            if (static_cast<int>(gpuTimes.size()) == frames) {
+                double gpuMs = 0.0;
+                for (double ms : gpuTimes) {
+                    gpuMs += ms;
+                }
+                QJsonObject glRender;
+                glRender["renderer"] = "gl";
+                glRender["width"] = size.width();
+                glRender["height"] = size.height();
+                glRender["frames"] = frames;
+                glRender["meanMs"] = gpuMs / frames;
+                glRender["p50Ms"] = percentile(gpuTimes, 0.5);
+                glRender["p95Ms"] = percentile(gpuTimes, 0.95);
+                result["glRender"] = glRender;
+                out << "  render gl:  " << QString::number(glRender["p50Ms"].toDouble(), 'f', 2) << " ms p50, "
+                    << QString::number(glRender["p95Ms"].toDouble(), 'f', 2) << " ms p95 (GPU)\n";
+            } else {
+                out << "  render gl: nothing drawn\n";
+            }
+        }
+        out.flush();
+        results << result;
+    }
+
+    QJsonObject report;
+    report["version"] = 1;
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["cpuThreads"] = QThread::idealThreadCount();
+    report["glRenderer"] = gl ? QJsonValue(uploads.renderer()) : QJsonValue();
+    report["repeat"] = repeat;
+    report["results"] = results;
+    const QByteArray json = QJsonDocument(report).toJson();
+    if (jsonToStdout) {
+        QTextStream(stdout) << json;
+    } else if (parser.isSet(jsonOption)) {
+        QFile jsonFile(parser.value(jsonOption));
+        if (!jsonFile.open(QIODevice::WriteOnly) || jsonFile.write(json) != json.size()) {
+            out << "Cannot write " << parser.value(jsonOption) << "\n";
+            return 1;
+        }
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+QT       += core gui widgets concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+include(../../simd.pri)
+
+TARGET = onebench
+
+INCLUDEPATH += ../.. ../onegen
+
+win32: LIBS += -lpsapi
+
+SOURCES += \
+    main.cpp \
+    ../onegen/onegenerator.cpp \
+    ../../onecpurenderer.cpp \
+    ../../onereader.cpp \
+    ../../onerenderer.cpp
+
+HEADERS += \
+    ../onegen/onegenerator.h \
+    ../../onecpurenderer.h \
+    ../../onereader.h \
+    ../../onerenderer.h \
+    ../../oneview.h
+
+RESOURCES += \
+    ../../shaders.qrc
@@ -0,0 +1,442 @@
+// main.cpp (onecheck: consistency checks for OneReader on generated .ONE files)
+#include "onecpurenderer.h"
+#include "onegenerator.h"
+#include "onereader.h"
+#include "oneview.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+QTextStream out(stdout);
+bool verbose = false;
+
+void messageHandler(QtMsgType type, const QMessageLogContext& context, const QString& message) {
+    if (type == QtDebugMsg && !verbose) return;
+    QTextStream(stderr) << qFormatLogMessage(type, context, message) << "\n";
+}
+
+// A texture as the original single pass reader built it: every record into a
+// VoxelData list, the bounding box from the list, then a scatter into the box
+// in stored (g, b, r, a) order. Bytes go through / 255 and back like it did.
+struct ReferenceTexture {
+    qint64 id = 0;
+    bool isFloat = false;
+    int sizeX = 0;
+    int sizeY = 0;
+    int sizeZ = 0;
+    std::vector<float> data;
+    std::vector<unsigned char> byteData;
+};
+
+QString readString(QDataStream& in) {
+    quint16 length;
+    in >> length;
+    QByteArray bytes(length, '\0');
+    in.readRawData(bytes.data(), length);
+    return QString::fromUtf8(bytes);
+}
+
+bool referenceDecode(const QString& filename, std::vector<ReferenceTexture>& textures) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::BigEndian);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    // Header: its length is the file's last 8 bytes
+    qint64 headerLength;
+    file.seek(file.size() - 8);
+    in >> headerLength;
+    file.seek(file.size() - 8 - headerLength);
+    qint32 fileId, version;
+    qint64 sceneId;
+    in >> fileId >> version >> sceneId;
+    if (fileId != 102380) return false;
+    readString(in);
+    readString(in);
+    qint32 numVolumes;
+    in >> numVolumes;
+    for (int i = 0; i < numVolumes; ++i) {
+        qint64 id;
+        in >> id;
+        readString(in);
+        readString(in);
+    }
+    qint32 numTextures;
+    in >> numTextures;
+    textures.resize(numTextures);
+    for (ReferenceTexture& tex : textures) {
+        in >> tex.id;
+        readString(in);
+        tex.isFloat = readString(in).contains("TYPE:RGBA_FLOAT");
+    }
+
+    file.seek(0);
+    for (ReferenceTexture& tex : textures) {
+        qint64 id;
+        qint32 numVoxels;
+        in >> id >> numVoxels;
+        if (id != tex.id) return false;
+
+        struct VoxelData {
+            int x, y, z;
+            float r, g, b, a;
+        };
+        std::vector<VoxelData> voxList;
+        voxList.reserve(numVoxels);
+        int minX = INT_MAX, minY = INT_MAX, minZ = INT_MAX;
+        int maxX = INT_MIN, maxY = INT_MIN, maxZ = INT_MIN;
+        for (int v = 0; v < numVoxels; ++v) {
+            qint32 x, y, z;
+            in >> x >> y >> z;
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            minZ = std::min(minZ, z);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+            maxZ = std::max(maxZ, z);
+            float r, g, b, a;
+            if (tex.isFloat) {
+                in >> r >> g >> b >> a;
+            } else {
+                quint8 rb, gb, bb, ab;
+                in >> rb >> gb >> bb >> ab;
+                r = rb / 255.0f;
+                g = gb / 255.0f;
+                b = bb / 255.0f;
+                a = ab / 255.0f;
+            }
+            voxList.push_back({x, y, z, r, g, b, a});
+        }
+        if (in.status() != QDataStream::Ok) return false;
+        if (voxList.empty()) continue;
+
+        tex.sizeX = maxX - minX + 1;
+        tex.sizeY = maxY - minY + 1;
+        tex.sizeZ = maxZ - minZ + 1;
+        const size_t values = static_cast<size_t>(tex.sizeX) * tex.sizeY * tex.sizeZ * 4;
+        if (tex.isFloat) {
+            tex.data.assign(values, 0.0f);
+        } else {
+            tex.byteData.assign(values, 0);
+        }
+        for (const VoxelData& v : voxList) {
+            size_t index = ((static_cast<size_t>(v.z - minZ) * tex.sizeY + (v.y - minY)) * tex.sizeX + (v.x - minX)) * 4;
+            if (tex.isFloat) {
+                tex.data[index] = v.g;
+                tex.data[index + 1] = v.b;
+                tex.data[index + 2] = v.r;
+                tex.data[index + 3] = v.a;
+            } else {
+                tex.byteData[index] = static_cast<unsigned char>(v.g * 255.0f);
+                tex.byteData[index + 1] = static_cast<unsigned char>(v.b * 255.0f);
+                tex.byteData[index + 2] = static_cast<unsigned char>(v.r * 255.0f);
+                tex.byteData[index + 3] = static_cast<unsigned char>(v.a * 255.0f);
+            }
+        }
+    }
+    return true;
+}
+
+// Every texel of the loaded scene against the reference, through texel() so
+// dense and bricked layouts are compared alike. Float texels must match
+// exactly; byte texels read back as byte / 255.
+bool compareScene(const OneReader::SceneData& scene, const std::vector<ReferenceTexture>& reference, QString& error) {
+    if (scene.textures.size() != static_cast<int>(reference.size())) {
+        error = QString("%1 textures, expected %2").arg(scene.textures.size()).arg(reference.size());
+        return false;
+    }
+    for (int i = 0; i < scene.textures.size(); ++i) {
+        const OneReader::Texture& tex = scene.textures[i];
+        const ReferenceTexture& ref = reference[i];
+        if (tex.id != ref.id || tex.isFloat != ref.isFloat || tex.sizeX != ref.sizeX || tex.sizeY != ref.sizeY
+            || tex.sizeZ != ref.sizeZ) {
+            error = QString("texture %1 is %2x%3x%4, expected %5x%6x%7").arg(tex.id).arg(tex.sizeX).arg(tex.sizeY)
+                        .arg(tex.sizeZ).arg(ref.sizeX).arg(ref.sizeY).arg(ref.sizeZ);
+            return false;
+        }
+        float rgba[4];
+        for (int z = 0; z < tex.sizeZ; ++z) {
+            for (int y = 0; y < tex.sizeY; ++y) {
+                for (int x = 0; x < tex.sizeX; ++x) {
+                    tex.texel(x, y, z, rgba);
+                    const size_t index = ((static_cast<size_t>(z) * tex.sizeY + y) * tex.sizeX + x) * 4;
+                    for (int c = 0; c < 4; ++c) {
+                        const float expected = ref.isFloat ? ref.data[index + c] : ref.byteData[index + c] / 255.0f;
+                        if (memcmp(&rgba[c], &expected, sizeof(float)) != 0) {
+                            error = QString("texture %1 texel (%2, %3, %4) channel %5 is %6, expected %7")
+                                        .arg(tex.id).arg(x).arg(y).arg(z).arg(c).arg(rgba[c]).arg(expected);
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Two-pass decode against the reference, for both load modes and both storage modes
+int checkDecode(const QString& dir) {
+    struct Case {
+        const char* name;
+        OneGenerator::Options options;
+    };
+    QList<Case> cases;
+    Case dense{"dense-float", {}};
+    dense.options.resolution = 40;
+    cases << dense;
+    Case sparse{"sparse-byte", {}};
+    sparse.options.resolution = 72;
+    sparse.options.density = 0.2f;
+    sparse.options.floatTexels = false;
+    cases << sparse;
+    Case nested{"nested-float", {}};
+    nested.options.volumes = 4;
+    nested.options.resolution = 24;
+    nested.options.density = 0.5f;
+    nested.options.seed = 7;
+    cases << nested;
+
+    struct Mode {
+        const char* name;
+        OneReader::LoadMode load;
+        OneReader::StorageMode storage;
+    };
+    const Mode modes[] = {{"mapped-dense", OneReader::MappedLoad, OneReader::DenseStorage},
+                          {"stream-dense", OneReader::StreamLoad, OneReader::DenseStorage},
+                          {"mapped-bricked", OneReader::MappedLoad, OneReader::BrickedStorage},
+                          {"stream-bricked", OneReader::StreamLoad, OneReader::BrickedStorage}};
+
+    int failures = 0;
+    for (const Case& c : cases) {
+        const QString path = QDir(dir).filePath(QString(c.name) + ".one");
+        std::vector<ReferenceTexture> reference;
+        if (!OneGenerator::write(path, c.options) || !referenceDecode(path, reference)) {
+            out << "FAIL decode " << c.name << ": cannot generate or read the file\n";
+            ++failures;
+            continue;
+        }
+        for (const Mode& mode : modes) {
+            OneReader reader;
+            reader.setUseBaked(false);
+            reader.setMipmaps(false);
+            reader.setTexturePrecision(OneReader::Float32Precision);
+            reader.setLoadMode(mode.load);
+            reader.setStorageMode(mode.storage);
+            OneReader::SceneHandle scene = reader.loadScene(path);
+            QString error = "load failed";
+            const bool ok = scene && compareScene(*scene, reference, error);
+            out << (ok ? "PASS" : "FAIL") << " decode " << c.name << " " << mode.name;
+            if (!ok) {
+                out << ": " << error;
+                ++failures;
+            }
+            out << "\n";
+        }
+    }
+    out.flush();
+    return failures;
+}
+
+// Newest load wins: each round starts a slow load, starts a fast one after a
+// growing delay, and expects exactly one loadingFinished(true), the fast
+// file as the current scene, and no textureReady from the slow load after
+// the fast one started.
+// Each round starts a slow load and supersedes it after a growing delay, so the
+// second load() lands in decoding as well as in the macro cell, precision and
+// mip passes. The newest load must win, and it must get the loader within
+// maxWait ms of the call.
+int checkLoadRace(const QString& dir, int rounds, qint64 maxWait) {
+    OneGenerator::Options slowOptions;
+    slowOptions.volumes = 3;
+    slowOptions.resolution = 160;
+    OneGenerator::Options fastOptions;
+    fastOptions.volumes = 2;
+    fastOptions.resolution = 16;
+    const QString slowPath = QDir(dir).filePath("race-slow.one");
+    const QString fastPath = QDir(dir).filePath("race-fast.one");
+    if (!OneGenerator::write(slowPath, slowOptions) || !OneGenerator::write(fastPath, fastOptions)) {
+        out << "FAIL race: cannot generate the files\n";
+        return 1;
+    }
+
+    int failures = 0;
+    qint64 longestWait = 0;
+    for (int round = 0; round < rounds; ++round) {
+        OneReader reader;
+        reader.setUseBaked(false);
+        reader.setTexturePrecision(OneReader::Scaled8Precision); // Every pass of the slow load polls for cancel
+        int finished = 0;
+        int succeeded = 0;
+        int staleTextures = 0;
+        bool fastStarted = false;
+        QEventLoop loop;
+        QObject::connect(&reader, &OneReader::loadingFinished, [&](bool success) {
+            ++finished;
+            succeeded += success ? 1 : 0;
+            QTimer::singleShot(200, &loop, &QEventLoop::quit); // Let any late signal of the slow load arrive
+        });
+        QObject::connect(&reader, &OneReader::textureReady, [&](OneReader::SceneHandle scene, int, float) {
+            if (fastStarted && scene->volumes.size() != fastOptions.volumes) ++staleTextures;
+        });
+
+        reader.load(slowPath);
+        QThread::msleep(static_cast<unsigned long>(round * 3)); // From before the slow load starts decoding to well into it
+        QCoreApplication::processEvents();
+        fastStarted = true;
+        reader.load(fastPath);
+        QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+        loop.exec();
+
+        OneReader::SceneHandle scene = reader.currentScene();
+        const qint64 wait = reader.lastLoadWait();
+        longestWait = std::max(longestWait, wait);
+        const bool ok = finished == 1 && succeeded == 1 && staleTextures == 0 && scene
+                     && scene->volumes.size() == fastOptions.volumes && wait >= 0 && wait <= maxWait;
+        if (!ok) {
+            out << "FAIL race round " << round << ": " << finished << " finished, " << succeeded << " succeeded, "
+                << staleTextures << " stale textures, current scene has "
+                << (scene ? scene->volumes.size() : -1) << " volumes, waited " << wait << " ms for the loader"
+                << " (limit " << maxWait << " ms)\n";
+            ++failures;
+        }
+    }
+    if (failures == 0) {
+        out << "PASS race: newest load won in " << rounds << " rounds, waited at most " << longestWait
+            << " ms for the cancelled load (limit " << maxWait << " ms)\n";
+    }
+    out.flush();
+    return failures;
+}
+
+// Front to back marching (without early termination) against back to front,
+// with OneCpuRenderer in single and nested mode from a few views. Both take the
+// same samples, up to rounding in t: a sample right at a segment end can fall on
+// either side of it, which the max-abs limit allows for (about one sample of a
+// ray). Limits are fractions of the back to front image's brightest channel.
+// Empty space skipping is off, as its jumps are measured from either end.
+int checkMarchOrder(const QString& dir) {
+    const float kMaxAbsTolerance = 0.05f;
+    const float kRmsTolerance = 0.005f;
+
+    OneGenerator::Options single;
+    single.resolution = 40;
+    single.density = 0.5f;
+    OneGenerator::Options nested;
+    nested.volumes = 4;
+    nested.resolution = 24;
+    nested.density = 0.5f;
+    nested.nestRotation = 30.0f;
+    nested.seed = 7;
+    const struct {
+        const char* name;
+        OneGenerator::Options options;
+    } cases[] = {{"march-single", single}, {"march-nested", nested}};
+
+    int failures = 0;
+    for (const auto& c : cases) {
+        const QString path = QDir(dir).filePath(QString(c.name) + ".one");
+        OneReader reader;
+        reader.setUseBaked(false);
+        OneReader::SceneHandle scene = OneGenerator::write(path, c.options) ? reader.loadScene(path) : nullptr;
+        if (!scene) {
+            out << "FAIL march " << c.name << ": cannot generate or load the file\n";
+            ++failures;
+            continue;
+        }
+
+        OneCpuRenderer renderer;
+        OneCpuRenderer::Settings settings;
+        settings.size = QSize(96, 72);
+        settings.projectionMatrix = OneView::projectionMatrix(settings.size);
+        settings.emptySpaceSkipping = false;
+        settings.terminationThreshold = 0.0f;
+        for (bool nestedMode : {false, true}) {
+            settings.nestedMode = nestedMode;
+            float maxAbs = 0.0f;
+            double sumSquares = 0.0;
+            size_t count = 0;
+            float peak = 0.0f;
+            for (float yaw : {0.0f, 35.0f, 110.0f}) {
+                const QQuaternion rotation = QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, yaw)
+                                           * QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, 20.0f);
+                settings.viewMatrix = OneView::viewMatrix(rotation, 1.5f);
+                std::vector<float> backToFront;
+                std::vector<float> frontToBack;
+                settings.frontToBack = false;
+                const bool rendered = renderer.render(*scene, settings, backToFront);
+                settings.frontToBack = true;
+                if (!rendered || !renderer.render(*scene, settings, frontToBack)) continue;
+
+                for (size_t i = 0; i < backToFront.size(); ++i) {
+                    if (i % 4 == 3) continue; // Alpha is always 1
+                    const float diff = std::abs(frontToBack[i] - backToFront[i]);
+                    maxAbs = std::max(maxAbs, diff);
+                    sumSquares += double(diff) * diff;
+                    peak = std::max(peak, std::abs(backToFront[i]));
+                    ++count;
+                }
+            }
+            const double rms = count > 0 ? std::sqrt(sumSquares / count) : 0.0;
+            const bool ok = count > 0 && peak > 0.0f && maxAbs <= kMaxAbsTolerance * peak
+                         && rms <= kRmsTolerance * peak;
+            out << (ok ? "PASS" : "FAIL") << " march " << c.name << (nestedMode ? " nested" : " single")
+                << ": max abs " << maxAbs << ", RMS " << rms << " of peak " << peak << " (limits "
+                << kMaxAbsTolerance << " and " << kRmsTolerance << " of peak)\n";
+            failures += ok ? 0 : 1;
+        }
+    }
+    out.flush();
+    return failures;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("onecheck");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Checks OneReader decoding against the original single pass reader, "
+                                     "that the newest of overlapping loads wins, and that front to back "
+                                     "marching matches back to front.");
+    parser.addHelpOption();
+    QCommandLineOption roundsOption("rounds", "Rounds of the load race check (default 20).", "n", "20");
+    QCommandLineOption maxWaitOption("max-wait", "Longest a load may wait for the one it cancels, in ms (default 250).",
+                                     "ms", "250");
+    QCommandLineOption verboseOption("verbose", "Show the loader's log.");
+    parser.addOption(roundsOption);
+    parser.addOption(maxWaitOption);
+    parser.addOption(verboseOption);
+    parser.process(app);
+
+    verbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(messageHandler);
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        out << "Cannot create a temporary directory\n";
+        return 1;
+    }
+    int failures = checkDecode(dir.path());
+    failures += checkLoadRace(dir.path(), std::max(1, parser.value(roundsOption).toInt()),
+                              parser.value(maxWaitOption).toLongLong());
+    failures += checkMarchOrder(dir.path());
+    out << (failures == 0 ? "All checks passed\n" : QString("%1 checks failed\n").arg(failures));
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+QT       += core gui concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+include(../../simd.pri)
+
+TARGET = onecheck
+
+INCLUDEPATH += ../.. ../onegen
+
+SOURCES += \
+    main.cpp \
+    ../onegen/onegenerator.cpp \
+    ../../onecpurenderer.cpp \
+    ../../onereader.cpp
+
+HEADERS += \
+    ../onegen/onegenerator.h \
+    ../../onecpurenderer.h \
+    ../../onereader.h \
+    ../../oneview.h
@@ -0,0 +1,14 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = onegen
+
+SOURCES += \
+    main.cpp \
+    onegenerator.cpp
+
+HEADERS += \
+    onegenerator.h
@@ -0,0 +1,193 @@
+// onegenerator.cpp
+#include "onegenerator.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QStringList>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+const qint32 kFileId = 102380;
+const qint32 kVersion = 1;
+
+void writeString(QDataStream& out, const QString& text) {
+    const QByteArray utf8 = text.toUtf8();
+    out << static_cast<quint16>(utf8.size());
+    out.writeRawData(utf8.constData(), utf8.size());
+}
+
+// KEY:VALUE pairs joined by !@, as OneReader::parseParams() splits them
+QString joinParams(const QList<QPair<QString, QString>>& params) {
+    QStringList parts;
+    for (const auto& param : params) {
+        parts << param.first + ":" + param.second;
+    }
+    return parts.join("!@");
+}
+
+inline uchar* putInt(uchar* p, qint32 value) {
+    qToBigEndian<qint32>(value, p);
+    return p + 4;
+}
+
+inline uchar* putFloat(uchar* p, float value) {
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    qToBigEndian<quint32>(bits, p);
+    return p + 4;
+}
+
+// Smooth emission and absorption pattern, different per texture
+void voxelValue(int x, int y, int z, int texture, float rgba[4]) {
+    const float phase = texture * 0.7f;
+    rgba[0] = 0.5f + 0.5f * std::sin(x * 0.21f + phase);
+    rgba[1] = 0.5f + 0.5f * std::sin(y * 0.17f + phase * 1.3f);
+    rgba[2] = 0.5f + 0.5f * std::sin(z * 0.13f + phase * 1.7f);
+    rgba[3] = 0.5f + 0.5f * std::sin((x + y + z) * 0.09f + phase) * std::cos(x * 0.05f);
+}
+
+// Writes one texture block: its ID, voxel count and records, a z slice at a time
+bool writeTexture(QFile& file, qint64 id, int texture, const OneGenerator::Options& options, std::mt19937& random) {
+    const int n = options.resolution;
+    const int b = OneGenerator::kBlockSize;
+    const int blocks = (n + b - 1) / b;
+
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<quint8> occupied(static_cast<size_t>(blocks) * blocks * blocks);
+    for (quint8& block : occupied) {
+        block = uniform(random) < options.density ? 1 : 0;
+    }
+    auto isOccupied = [&](int x, int y, int z) {
+        return occupied[(static_cast<size_t>(z / b) * blocks + y / b) * blocks + x / b] != 0;
+    };
+    // The two corners are always written, so the texture spans the full resolution
+    auto isCorner = [&](int x, int y, int z) {
+        return (x == 0 && y == 0 && z == 0) || (x == n - 1 && y == n - 1 && z == n - 1);
+    };
+
+    qint64 count = 0;
+    for (int z = 0; z < n; ++z) {
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                if (isOccupied(x, y, z) || isCorner(x, y, z)) ++count;
+            }
+        }
+    }
+    if (count > std::numeric_limits<qint32>::max()) {
+        qDebug() << "Too many voxels for a .ONE texture:" << count;
+        return false;
+    }
+
+    uchar header[12];
+    qToBigEndian<qint64>(id, header);
+    qToBigEndian<qint32>(static_cast<qint32>(count), header + 8);
+    if (file.write(reinterpret_cast<const char*>(header), sizeof(header)) != sizeof(header)) return false;
+
+    const int recordSize = options.floatTexels ? 3 * 4 + 4 * 4 : 3 * 4 + 4;
+    std::vector<uchar> slice(static_cast<size_t>(n) * n * recordSize);
+    for (int z = 0; z < n; ++z) {
+        uchar* p = slice.data();
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                const bool inside = isOccupied(x, y, z);
+                if (!inside && !isCorner(x, y, z)) continue;
+
+                float rgba[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                if (inside) {
+                    voxelValue(x, y, z, texture, rgba);
+                }
+                p = putInt(p, x);
+                p = putInt(p, y);
+                p = putInt(p, z);
+                if (options.floatTexels) {
+                    // Absorption is scaled by the scene OPACITY (600), so it stays small
+                    p = putFloat(p, rgba[0]);
+                    p = putFloat(p, rgba[1]);
+                    p = putFloat(p, rgba[2]);
+                    p = putFloat(p, rgba[3] * 0.005f);
+                } else {
+                    *p++ = static_cast<uchar>(rgba[0] * 255.0f);
+                    *p++ = static_cast<uchar>(rgba[1] * 255.0f);
+                    *p++ = static_cast<uchar>(rgba[2] * 255.0f);
+                    *p++ = static_cast<uchar>(rgba[3] * 2.0f);
+                }
+            }
+        }
+        const qint64 bytes = p - slice.data();
+        if (file.write(reinterpret_cast<const char*>(slice.data()), bytes) != bytes) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool OneGenerator::write(const QString& filename, const Options& options) {
+    if (options.volumes < 1 || options.resolution < 1) return false;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write" << filename;
+        return false;
+    }
+
+    std::mt19937 random(options.seed);
+    for (int i = 0; i < options.volumes; ++i) {
+        if (!writeTexture(file, 1000 + i, i, options, random)) return false;
+    }
+
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::BigEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << kFileId << kVersion << qint64(1);
+    writeString(out, "Synthetic");
+    writeString(out, joinParams({{"EMISSION", "1.0"}, {"OPACITY", "600.0"}, {"EXPOSURE", "2.0"}}));
+
+    // Each volume sits at a random spot inside the one before, its centre
+    // kept far enough from the parent's faces for it to fit unrotated
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    float centre[3] = {0.0f, 0.0f, 0.0f};
+    float size = 1.0f;
+    out << static_cast<qint32>(options.volumes);
+    for (int i = 0; i < options.volumes; ++i) {
+        const float childSize = i == 0 ? 1.0f : size * options.nestScale;
+        if (i > 0) {
+            for (float& c : centre) {
+                c += uniform(random) * 0.5f * std::max(0.0f, size - childSize);
+            }
+        }
+        size = childSize;
+
+        out << qint64(100 + i);
+        writeString(out, QString("Volume %1").arg(i));
+        writeString(out, joinParams({{"TEXTURE_ID_0", QString::number(1000 + i)},
+                                     {"ORDER", QString::number(i)},
+                                     {"SCALE_X", QString::number(size)},
+                                     {"SCALE_Y", QString::number(size)},
+                                     {"SCALE_Z", QString::number(size)},
+                                     {"OFFSET_X", QString::number(2.0f * centre[0])}, // Volumes centre on OFFSET / 2
+                                     {"OFFSET_Y", QString::number(2.0f * centre[1])},
+                                     {"OFFSET_Z", QString::number(2.0f * centre[2])},
+                                     {"ROT_Y", QString::number(options.nestRotation * i)}}));
+    }
+
+    out << static_cast<qint32>(options.volumes);
+    for (int i = 0; i < options.volumes; ++i) {
+        out << qint64(1000 + i);
+        writeString(out, QString("Texture %1").arg(i));
+        writeString(out, joinParams({{"TYPE", options.floatTexels ? "RGBA_FLOAT" : "RGBA_BYTE"}}));
+    }
+
+    uchar length[8];
+    qToBigEndian<qint64>(header.size(), length);
+    return file.write(header) == header.size()
+        && file.write(reinterpret_cast<const char*>(length), sizeof(length)) == sizeof(length);
+}
@@ -0,0 +1,34 @@
+// onegenerator.h
+#ifndef ONEGENERATOR_H
+#define ONEGENERATOR_H
+
+#include <QString>
+#include <QtGlobal>
+
+// Writes synthetic .ONE files in the layout OneReader::doLoad() reads: the
+// texture blocks (ID, voxel count, big-endian x, y, z and RGBA records) from
+// the start of the file, then the header (file ID 102380, scene, volumes,
+// textures) followed by its length in the last 8 bytes.
+//
+// Every volume gets a texture of its own. Volume n nests inside volume n - 1
+// at nestScale of its size, at a random spot that keeps it inside, turned by
+// nestRotation about Y per level, with ORDER n so it is drawn on top.
+class OneGenerator {
+public:
+    struct Options {
+        int volumes = 1;
+        int resolution = 64; // Voxels along each side of every texture
+        float density = 1.0f; // Fraction of 8^3 voxel blocks that hold voxels
+        bool floatTexels = true; // RGBA_FLOAT records, otherwise RGBA_BYTE
+        float nestScale = 0.5f;
+        float nestRotation = 0.0f; // Degrees
+        quint32 seed = 1;
+    };
+
+    // False if the file cannot be written
+    static bool write(const QString& filename, const Options& options);
+
+    static const int kBlockSize = 8; // Voxels along each side of a sparsity block
+};
+
+#endif // ONEGENERATOR_H
@@ -0,0 +1,241 @@
+// main.cpp (onerender: renders .ONE files to images without a window or a GPU)
+#include "onecpurenderer.h"
+#include "onereader.h"
+#include "oneview.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cstring>
+
+// Uncompressed scanline OpenEXR with 32-bit float B, G, R channels (the
+// channel list is sorted by name), rows top first like the image
+static bool writeExr(const QString& filename, const std::vector<float>& image, const QSize& size) {
+    const int width = size.width();
+    const int height = size.height();
+
+    QByteArray header;
+    QDataStream h(&header, QIODevice::WriteOnly);
+    h.setByteOrder(QDataStream::LittleEndian);
+    h.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    auto attribute = [&h](const char* name, const char* type, qint32 bytes) {
+        h.writeRawData(name, static_cast<int>(strlen(name)) + 1);
+        h.writeRawData(type, static_cast<int>(strlen(type)) + 1);
+        h << bytes;
+    };
+    const char* channels[] = {"B", "G", "R"};
+    attribute("channels", "chlist", 3 * 18 + 1);
+    for (const char* channel : channels) {
+        h.writeRawData(channel, 2);
+        h << qint32(2) << quint8(0) << quint8(0) << quint8(0) << quint8(0) << qint32(1) << qint32(1); // FLOAT, 1x1 sampling
+    }
+    h << quint8(0);
+    attribute("compression", "compression", 1);
+    h << quint8(0);
+    attribute("dataWindow", "box2i", 16);
+    h << qint32(0) << qint32(0) << qint32(width - 1) << qint32(height - 1);
+    attribute("displayWindow", "box2i", 16);
+    h << qint32(0) << qint32(0) << qint32(width - 1) << qint32(height - 1);
+    attribute("lineOrder", "lineOrder", 1);
+    h << quint8(0); // Increasing y
+    attribute("pixelAspectRatio", "float", 4);
+    h << 1.0f;
+    attribute("screenWindowCenter", "v2f", 8);
+    h << 0.0f << 0.0f;
+    attribute("screenWindowWidth", "float", 4);
+    h << 1.0f;
+    h << quint8(0);
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << qint32(20000630) << qint32(2); // Magic, version 2 single part scanline
+    out.writeRawData(header.constData(), header.size());
+
+    // One scanline per chunk: its y, byte count and each channel's row
+    const qint32 rowBytes = width * 3 * static_cast<qint32>(sizeof(float));
+    const qint64 firstChunk = 8 + header.size() + qint64(height) * 8;
+    for (int y = 0; y < height; ++y) {
+        out << quint64(firstChunk + qint64(y) * (8 + rowBytes));
+    }
+    for (int y = 0; y < height; ++y) {
+        out << qint32(y) << rowBytes;
+        const float* row = image.data() + static_cast<size_t>(y) * width * 4;
+        for (int c : {2, 1, 0}) {
+            for (int x = 0; x < width; ++x) {
+                out << row[x * 4 + c];
+            }
+        }
+    }
+    return out.status() == QDataStream::Ok && file.error() == QFileDevice::NoError;
+}
+
+static bool parseFloats(const QString& text, int count, float* values) {
+    const QStringList parts = text.split(',');
+    if (parts.size() != count) return false;
+    for (int i = 0; i < count; ++i) {
+        bool ok = false;
+        values[i] = parts[i].trimmed().toFloat(&ok);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("onerender");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders .ONE files to still images or turntable sequences on the CPU.");
+    parser.addHelpOption();
+    QCommandLineOption outputOption({"o", "output"}, "Write images to <dir> (default: the current directory).", "dir");
+    QCommandLineOption formatOption("format", "Image format: png or exr (default png).", "format", "png");
+    QCommandLineOption sizeOption("size", "Image size (default 640x480).", "WxH", "640x480");
+    QCommandLineOption yawOption("yaw", "Camera angle around the vertical axis (default 0).", "degrees", "0");
+    QCommandLineOption pitchOption("pitch", "Camera angle above the horizontal (default 0).", "degrees", "0");
+    QCommandLineOption distanceOption("distance", "Camera distance from the centre (default 1.5).", "distance", "1.5");
+    QCommandLineOption framesOption("frames", "Render a turntable of <n> frames over 360 degrees of yaw.", "n", "1");
+    QCommandLineOption backgroundOption("background", "Background color, 0 to 1 per channel (default 0,0,0).",
+                                        "r,g,b", "0,0,0");
+    QCommandLineOption exposureOption("exposure", "Exposure instead of the scene's EXPOSURE.", "value");
+    QCommandLineOption singleOption("single", "Single mode: the first volume alone instead of the nested view.");
+    QCommandLineOption frontToBackOption("front-to-back", "Composite front to back with early ray termination.");
+    QCommandLineOption adaptiveOption("adaptive", "Adaptive sampling at <quality> samples per voxel.", "quality");
+    QCommandLineOption noSkippingOption("no-skipping", "Sample empty macro cells instead of leaping over them.");
+    QCommandLineOption noMipmapsOption("no-mipmaps", "Always sample the full resolution textures.");
+    QCommandLineOption bricksOption("bricked", "Load textures as sparse bricks.");
+    QCommandLineOption threadsOption("threads", "Render threads (default: one per core).", "n", "0");
+    parser.addOption(outputOption);
+    parser.addOption(formatOption);
+    parser.addOption(sizeOption);
+    parser.addOption(yawOption);
+    parser.addOption(pitchOption);
+    parser.addOption(distanceOption);
+    parser.addOption(framesOption);
+    parser.addOption(backgroundOption);
+    parser.addOption(exposureOption);
+    parser.addOption(singleOption);
+    parser.addOption(frontToBackOption);
+    parser.addOption(adaptiveOption);
+    parser.addOption(noSkippingOption);
+    parser.addOption(noMipmapsOption);
+    parser.addOption(bricksOption);
+    parser.addOption(threadsOption);
+    parser.addPositionalArgument("files", ".ONE (or .onec) files to render.", "<file>...");
+    parser.process(app);
+
+    QTextStream out(stdout);
+    if (parser.positionalArguments().isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    const QString format = parser.value(formatOption).toLower();
+    const QStringList sizeParts = parser.value(sizeOption).toLower().split('x');
+    const QSize size(sizeParts.value(0).toInt(), sizeParts.value(1).toInt());
+    const int frames = parser.value(framesOption).toInt();
+    float background[3];
+    if ((format != "png" && format != "exr") || size.isEmpty() || sizeParts.size() != 2 || frames < 1
+        || !parseFloats(parser.value(backgroundOption), 3, background)) {
+        out << "Invalid --format, --size, --frames or --background\n";
+        return 1;
+    }
+
+    const QString outputDir = parser.isSet(outputOption) ? parser.value(outputOption) : QDir::currentPath();
+    if (!QDir().mkpath(outputDir)) {
+        out << "Cannot create output directory " << outputDir << "\n";
+        return 1;
+    }
+
+    OneCpuRenderer::Settings settings;
+    settings.size = size;
+    settings.projectionMatrix = OneView::projectionMatrix(size);
+    settings.backgroundColor = QVector3D(background[0], background[1], background[2]);
+    settings.nestedMode = !parser.isSet(singleOption);
+    settings.overrideExposure = parser.isSet(exposureOption);
+    settings.exposure = parser.value(exposureOption).toFloat();
+    settings.frontToBack = parser.isSet(frontToBackOption);
+    settings.adaptiveSampling = parser.isSet(adaptiveOption);
+    if (settings.adaptiveSampling) {
+        settings.samplingQuality = std::max(0.01f, parser.value(adaptiveOption).toFloat());
+    }
+    settings.emptySpaceSkipping = !parser.isSet(noSkippingOption);
+    settings.mipmapping = !parser.isSet(noMipmapsOption);
+    settings.threads = parser.value(threadsOption).toInt();
+
+    const float yaw = parser.value(yawOption).toFloat();
+    const float pitch = parser.value(pitchOption).toFloat();
+    const float distance = parser.value(distanceOption).toFloat();
+
+    // One reader and renderer for the whole batch; every frame of a file
+    // renders from its one loaded scene
+    OneReader reader;
+    reader.setStorageMode(parser.isSet(bricksOption) ? OneReader::BrickedStorage : OneReader::DenseStorage);
+    reader.setMipmaps(settings.mipmapping);
+    OneCpuRenderer renderer;
+    std::vector<float> image;
+
+    int failures = 0;
+    int totalFrames = 0;
+    qint64 totalRenderNs = 0;
+    qint64 slowestNs = 0;
+    for (const QString& file : parser.positionalArguments()) {
+        QElapsedTimer timer;
+        timer.start();
+        OneReader::SceneHandle scene = reader.loadScene(file);
+        if (!scene) {
+            out << file << ": failed to load\n";
+            ++failures;
+            continue;
+        }
+        out << file << ": loaded in " << timer.elapsed() << " ms, " << scene->volumes.size() << " volumes, "
+            << QString::number(scene->memoryBytes() / 1048576.0, 'f', 1) << " MB\n";
+        out.flush();
+
+        const QString baseName = QFileInfo(file).completeBaseName();
+        for (int frame = 0; frame < frames; ++frame) {
+            const QQuaternion rotation = QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, yaw + 360.0f * frame / frames)
+                                       * QQuaternion::fromAxisAndAngle(1.0f, 0.0f, 0.0f, pitch);
+            settings.viewMatrix = OneView::viewMatrix(rotation, distance);
+            if (!renderer.render(*scene, settings, image)) {
+                out << file << ": nothing to render\n";
+                ++failures;
+                break;
+            }
+
+            const QString name = frames > 1 ? QString("%1_%2.%3").arg(baseName).arg(frame, 4, 10, QChar('0')).arg(format)
+                                            : QString("%1.%2").arg(baseName, format);
+            const QString target = QDir(outputDir).filePath(name);
+            timer.restart();
+            bool written = format == "exr" ? writeExr(target, image, size)
+                                           : OneCpuRenderer::toImage(image, size).save(target);
+            const qint64 writeMs = timer.elapsed();
+            if (!written) {
+                out << "  failed to write " << target << "\n";
+                ++failures;
+                break;
+            }
+
+            const OneCpuRenderer::Stats& stats = renderer.lastStats();
+            out << "  " << name << ": " << QString::number(stats.nsecs / 1e6, 'f', 1) << " ms, "
+                << QString::number(stats.raysPerSecond() / 1e6, 'f', 2) << " Mrays/s (" << stats.rays << " rays, "
+                << stats.threads << " threads), write " << writeMs << " ms\n";
+            out.flush();
+            ++totalFrames;
+            totalRenderNs += stats.nsecs;
+            slowestNs = std::max(slowestNs, stats.nsecs);
+        }
+    }
+
+    if (totalFrames > 0) {
+        out << totalFrames << " frames, " << QString::number(totalRenderNs / 1e6 / totalFrames, 'f', 1)
+            << " ms/frame average, " << QString::number(slowestNs / 1e6, 'f', 1) << " ms slowest\n";
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+QT       += core gui concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+include(../../simd.pri)
+
+TARGET = onerender
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../onecpurenderer.cpp \
+    ../../onereader.cpp
+
+HEADERS += \
+    ../../onecpurenderer.h \
+    ../../onereader.h \
+    ../../oneview.h